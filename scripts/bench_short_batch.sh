@@ -0,0 +1,61 @@
+#!/bin/bash
+
+# Time the batched short-record aligner against per-record WFA on the same mappings.
+# Output: TSV with mode, seconds, max RSS (KB), records and records aligned by the batch kernel.
+
+usage() {
+    echo "Usage: $0 [-w <wfmash>] [-r <reference>] [-q <reads>] [-t <threads>] [-o <workdir>]"
+    echo "  -w, --wfmash      wfmash binary [build/bin/wfmash]"
+    echo "  -r, --reference   reference FASTA [data/reference.fa.gz]"
+    echo "  -q, --reads       read FASTA [data/reads.255bps.fa.gz]"
+    echo "  -t, --threads     threads [1]"
+    echo "  -o, --workdir     directory for mappings and alignments [bench_short_batch]"
+    exit 1
+}
+
+WFMASH=build/bin/wfmash
+REFERENCE=data/reference.fa.gz
+READS=data/reads.255bps.fa.gz
+THREADS=1
+WORKDIR=bench_short_batch
+
+PARSED_ARGUMENTS=$(getopt -a -n "$0" -o w:r:q:t:o:h --long wfmash:,reference:,reads:,threads:,workdir:,help -- "$@")
+if [ "$?" != "0" ]; then
+    usage
+fi
+
+eval set -- "$PARSED_ARGUMENTS"
+while :
+do
+    case "$1" in
+        -w | --wfmash) WFMASH="$2" ; shift 2 ;;
+        -r | --reference) REFERENCE="$2" ; shift 2 ;;
+        -q | --reads) READS="$2" ; shift 2 ;;
+        -t | --threads) THREADS="$2" ; shift 2 ;;
+        -o | --workdir) WORKDIR="$2" ; shift 2 ;;
+        -h | --help) usage ;;
+        --) shift ; break ;;
+        *) usage ;;
+    esac
+done
+
+mkdir -p "$WORKDIR"
+
+# Map once, so that both modes align exactly the same records
+"$WFMASH" "$REFERENCE" "$READS" -m -s 200 -p 90 -t "$THREADS" > "$WORKDIR/mappings.paf" 2> "$WORKDIR/map.log"
+
+echo -e "mode\tseconds\tmax_rss_kb\trecords\tbatched"
+for mode in wfa batch; do
+    if [ "$mode" == "wfa" ]; then
+        mode_args="--short-align-max-len 0"
+    else
+        mode_args="--short-align-max-len 512"
+    fi
+    /usr/bin/time -f "%e %M" -o "$WORKDIR/$mode.time" \
+        "$WFMASH" "$REFERENCE" "$READS" -i "$WORKDIR/mappings.paf" -t "$THREADS" --policy-tag $mode_args \
+        > "$WORKDIR/$mode.paf" 2> "$WORKDIR/$mode.log"
+    read -r seconds rss < "$WORKDIR/$mode.time"
+    records=$(wc -l < "$WORKDIR/$mode.paf")
+    batched=$(grep -c 'wp:Z:batch' "$WORKDIR/$mode.paf")
+    echo -e "$mode\t$seconds\t$rss\t$records\t$batched"
+done
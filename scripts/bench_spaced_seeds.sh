@@ -0,0 +1,105 @@
+#!/bin/bash
+
+# Compare contiguous k-mers against spaced seed sets on simulated divergent reads.
+# Each scheme indexes the same target; density is reported as index windows per kbp and
+# sensitivity as the fraction of reads with a mapping overlapping their true origin.
+# Output: TSV with identity, scheme, windows per kbp, reads mapped correctly, reads, sensitivity, seconds.
+
+usage() {
+    echo "Usage: $0 [-w <wfmash>] [-s <schemes>] [-d <identities>] [-g <length>] [-r <read length>] [-t <threads>] [-o <workdir>]"
+    echo "  -w, --wfmash      wfmash binary [build/bin/wfmash]"
+    echo "  -s, --schemes     semicolon-separated --spaced-seeds values, kN for contiguous N-mers"
+    echo "                    [k15;k11;111010010100110111;111010010100110111,111100110010100001011]"
+    echo "  -d, --identities  comma-separated read identities [0.90,0.875,0.85,0.825,0.80]"
+    echo "  -g, --length      target length [2000000]"
+    echo "  -r, --read-length read length [10000]"
+    echo "  -t, --threads     threads [4]"
+    echo "  -o, --workdir     directory for simulated data [bench_spaced_seeds]"
+    exit 1
+}
+
+WFMASH=build/bin/wfmash
+SCHEMES="k15;k11;111010010100110111;111010010100110111,111100110010100001011"
+IDENTITIES=0.90,0.875,0.85,0.825,0.80
+LENGTH=2000000
+READ_LENGTH=10000
+THREADS=4
+WORKDIR=bench_spaced_seeds
+
+PARSED_ARGUMENTS=$(getopt -a -n "$0" -o w:s:d:g:r:t:o:h --long wfmash:,schemes:,identities:,length:,read-length:,threads:,workdir:,help -- "$@")
+if [ "$?" != "0" ]; then
+    usage
+fi
+
+eval set -- "$PARSED_ARGUMENTS"
+while :
+do
+    case "$1" in
+        -w | --wfmash) WFMASH="$2" ; shift 2 ;;
+        -s | --schemes) SCHEMES="$2" ; shift 2 ;;
+        -d | --identities) IDENTITIES="$2" ; shift 2 ;;
+        -g | --length) LENGTH="$2" ; shift 2 ;;
+        -r | --read-length) READ_LENGTH="$2" ; shift 2 ;;
+        -t | --threads) THREADS="$2" ; shift 2 ;;
+        -o | --workdir) WORKDIR="$2" ; shift 2 ;;
+        -h | --help) usage ;;
+        --) shift ; break ;;
+        *) usage ;;
+    esac
+done
+
+mkdir -p "$WORKDIR"
+
+# Simulate a random target and reads sampled from it with substitutions and short indels
+# (2:1 ratio) at the given divergence; read names carry their origin on the target
+simulate() {
+    python3 - "$1" "$2" "$3" "$4" <<'EOF'
+import random, sys
+length, read_length, identity, prefix = int(sys.argv[1]), int(sys.argv[2]), float(sys.argv[3]), sys.argv[4]
+rng = random.Random(length + int(identity * 1000))
+target = ''.join(rng.choice('ACGT') for _ in range(length))
+with open(prefix + '.target.fa', 'w') as out:
+    out.write('>target\n' + target + '\n')
+with open(prefix + '.reads.fa', 'w') as out:
+    for start in range(0, length - read_length + 1, read_length):
+        read = []
+        for base in target[start:start + read_length]:
+            r = rng.random()
+            if r < (1 - identity) * 2 / 3:
+                read.append(rng.choice([b for b in 'ACGT' if b != base]))
+            elif r < (1 - identity) * 5 / 6:
+                continue
+            elif r < (1 - identity):
+                read.append(base + ''.join(rng.choice('ACGT') for _ in range(rng.randint(1, 3))))
+            else:
+                read.append(base)
+        out.write('>read_%d_%d\n%s\n' % (start, start + read_length, ''.join(read)))
+EOF
+}
+
+echo -e "identity\tscheme\twindows_per_kbp\tcorrect\treads\tsensitivity\tseconds"
+for identity in ${IDENTITIES//,/ }; do
+    prefix="$WORKDIR/sim.$identity"
+    simulate "$LENGTH" "$READ_LENGTH" "$identity" "$prefix"
+    reads=$(grep -c '>' "$prefix.reads.fa")
+    pct=$(python3 -c "print(int(max(50, $identity * 100 - 10)))")
+    IFS=';' read -ra schemes <<< "$SCHEMES"
+    for scheme in "${schemes[@]}"; do
+        if [[ "$scheme" == k* ]]; then
+            scheme_args="-k ${scheme#k}"
+        else
+            scheme_args="--spaced-seeds $scheme"
+        fi
+        out="$prefix.$(echo "$scheme" | md5sum | cut -c 1-8)"
+        /usr/bin/time -f "%e" -o "$out.time" \
+            "$WFMASH" "$prefix.target.fa" "$prefix.reads.fa" -m -p "$pct" -N \
+                -t "$THREADS" $scheme_args > "$out.paf" 2> "$out.log"
+        seconds=$(tail -n 1 "$out.time")
+        windows=$(grep -o '[0-9]* windows' "$out.log" | head -n 1 | cut -f 1 -d ' ')
+        density=$(python3 -c "print('%.2f' % (${windows:-0} * 1000 / $LENGTH))")
+        # A read is mapped correctly when one of its mappings overlaps its origin
+        correct=$(awk '{ split($1, o, "_"); if ($8 < o[3] && $9 > o[2]) ok[$1] = 1 } END { print length(ok) }' "$out.paf")
+        sensitivity=$(python3 -c "print('%.4f' % ($correct / $reads))")
+        echo -e "$identity\t$scheme\t$density\t$correct\t$reads\t$sensitivity\t$seconds"
+    done
+done
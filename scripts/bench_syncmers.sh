@@ -0,0 +1,94 @@
+#!/bin/bash
+
+# Compare k-mer selection schemes (all k-mers vs open syncmers) on the bundled test data.
+# For each input and --syncmers setting: index size on disk, seed hits per sketched fragment
+# and mapping sensitivity, taken as the fraction of query bases covered by a mapping.
+# Output: TSV with input, syncmers, index bytes, seed hits per fragment, covered fraction, seconds.
+
+usage() {
+    echo "Usage: $0 [-w <wfmash>] [-s <syncmer sizes>] [-a <args>] [-t <threads>] [-o <workdir>] [inputs...]"
+    echo "  -w, --wfmash      wfmash binary [build/bin/wfmash]"
+    echo "  -s, --syncmers    comma-separated --syncmers values, 0 for all k-mers [0,5,7,9]"
+    echo "  -a, --args        extra mapping arguments [-p 90 -n 1]"
+    echo "  -t, --threads     threads [4]"
+    echo "  -o, --workdir     directory for indices and mappings [bench_syncmers]"
+    echo "  inputs            FASTA files mapped all-vs-all [data/scerevisiae8.fa.gz data/LPA.subset.fa.gz]"
+    exit 1
+}
+
+WFMASH=build/bin/wfmash
+SYNCMERS=0,5,7,9
+ARGS="-p 90 -n 1"
+THREADS=4
+WORKDIR=bench_syncmers
+
+PARSED_ARGUMENTS=$(getopt -a -n "$0" -o w:s:a:t:o:h --long wfmash:,syncmers:,args:,threads:,workdir:,help -- "$@")
+if [ "$?" != "0" ]; then
+    usage
+fi
+
+eval set -- "$PARSED_ARGUMENTS"
+while :
+do
+    case "$1" in
+        -w | --wfmash) WFMASH="$2" ; shift 2 ;;
+        -s | --syncmers) SYNCMERS="$2" ; shift 2 ;;
+        -a | --args) ARGS="$2" ; shift 2 ;;
+        -t | --threads) THREADS="$2" ; shift 2 ;;
+        -o | --workdir) WORKDIR="$2" ; shift 2 ;;
+        -h | --help) usage ;;
+        --) shift ; break ;;
+        *) usage ;;
+    esac
+done
+
+INPUTS=("$@")
+if [ ${#INPUTS[@]} -eq 0 ]; then
+    INPUTS=(data/scerevisiae8.fa.gz data/LPA.subset.fa.gz)
+fi
+
+mkdir -p "$WORKDIR"
+
+# Fraction of query bases covered by at least one mapping
+covered_fraction() {
+    python3 - "$1" "$2" <<'EOF'
+import sys
+from collections import defaultdict
+intervals = defaultdict(list)
+with open(sys.argv[1]) as paf:
+    for line in paf:
+        f = line.split('\t')
+        intervals[f[0]].append((int(f[2]), int(f[3])))
+total = sum(int(line.split('\t')[1]) for line in open(sys.argv[2]))
+covered = 0
+for ivs in intervals.values():
+    end = -1
+    for s, e in sorted(ivs):
+        s = max(s, end)
+        if e > s:
+            covered += e - s
+        end = max(end, e)
+print('%.4f' % (covered / total))
+EOF
+}
+
+echo -e "input\tsyncmers\tindex_bytes\tseed_hits_per_fragment\tcovered\tseconds"
+for input in "${INPUTS[@]}"; do
+    name=$(basename "$input" .fa.gz)
+    for s in ${SYNCMERS//,/ }; do
+        if [ "$s" == "0" ]; then
+            scheme_args=""
+        else
+            scheme_args="--syncmers $s"
+        fi
+        prefix="$WORKDIR/$name.s$s"
+        "$WFMASH" "$input" -m -t "$THREADS" $ARGS $scheme_args -W "$prefix.idx" 2> "$prefix.index.log"
+        /usr/bin/time -f "%e" -o "$prefix.time" \
+            "$WFMASH" "$input" -m -t "$THREADS" $ARGS $scheme_args > "$prefix.paf" 2> "$prefix.log"
+        seconds=$(tail -n 1 "$prefix.time")
+        index_bytes=$(stat -c %s "$prefix.idx")
+        hits=$(grep -o '([0-9.]* per fragment)' "$prefix.log" | tr -d '(' | cut -f 1 -d ' ')
+        covered=$(covered_fraction "$prefix.paf" "$input.fai")
+        echo -e "$name\t$s\t$index_bytes\t${hits:-NA}\t$covered\t$seconds"
+    done
+done
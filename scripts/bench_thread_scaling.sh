@@ -0,0 +1,163 @@
+#!/bin/bash
+
+# Measure how wfmash scales with threads on one dataset. For each thread count the index build
+# (-W), mapping only (-m with the saved index) and alignment only (-i with the mappings of the
+# single-thread run) are timed separately, each with --perf-counters for the per-stage times.
+# Reports speedup, parallel efficiency and the Karp-Flatt serial fraction per step, the
+# thread-seconds of each internal stage, and the serial sections logged by wfmash
+# (index merge, one-to-one filter, sorted output) with their share of the step's wall time.
+# Output: <workdir>/scaling.json and a plain-text summary on stdout (also <workdir>/scaling.txt).
+
+usage() {
+    echo "Usage: $0 [-w <wfmash>] [-T <threads>] [-a <args>] [-o <workdir>] target.fa [query.fa]"
+    echo "  -w, --wfmash      wfmash binary [build/bin/wfmash]"
+    echo "  -T, --threads     comma-separated thread counts [1,2,4,... up to nproc]"
+    echo "  -a, --args        extra wfmash arguments for all steps [-p 90]"
+    echo "  -o, --workdir     directory for indices, outputs and logs [bench_thread_scaling]"
+    exit 1
+}
+
+WFMASH=build/bin/wfmash
+THREADS=""
+ARGS="-p 90"
+WORKDIR=bench_thread_scaling
+
+PARSED_ARGUMENTS=$(getopt -a -n "$0" -o w:T:a:o:h --long wfmash:,threads:,args:,workdir:,help -- "$@")
+if [ "$?" != "0" ]; then
+    usage
+fi
+
+eval set -- "$PARSED_ARGUMENTS"
+while :
+do
+    case "$1" in
+        -w | --wfmash) WFMASH="$2" ; shift 2 ;;
+        -T | --threads) THREADS="$2" ; shift 2 ;;
+        -a | --args) ARGS="$2" ; shift 2 ;;
+        -o | --workdir) WORKDIR="$2" ; shift 2 ;;
+        -h | --help) usage ;;
+        --) shift ; break ;;
+        *) usage ;;
+    esac
+done
+
+if [ $# -lt 1 ]; then
+    usage
+fi
+TARGET="$1"
+QUERY="${2:-}"
+
+if [ -z "$THREADS" ]; then
+    max=$(nproc)
+    THREADS=1
+    t=2
+    while [ "$t" -lt "$max" ]; do
+        THREADS="$THREADS,$t"
+        t=$((t * 2))
+    done
+    if [ "$max" -gt 1 ]; then
+        THREADS="$THREADS,$max"
+    fi
+fi
+
+mkdir -p "$WORKDIR"
+
+# Run a command with its output and log in the given files and record its wall seconds
+timed() {
+    local prefix="$1"
+    local output="$2"
+    shift 2
+    /usr/bin/time -f "%e" -o "$prefix.time" "$@" > "$output" 2> "$prefix.log"
+    tail -n 1 "$prefix.time" > "$prefix.seconds"
+}
+
+# The mappings aligned by every alignment run come from the single-thread mapping
+MAPPINGS="$WORKDIR/mappings.paf"
+"$WFMASH" "$TARGET" $QUERY -m -t 1 $ARGS > "$MAPPINGS" 2> "$WORKDIR/mappings.log"
+
+for t in ${THREADS//,/ }; do
+    prefix="$WORKDIR/t$t"
+    echo "[bench_thread_scaling] $t threads" >&2
+    timed "$prefix.index" /dev/null \
+        "$WFMASH" "$TARGET" -t "$t" $ARGS -W "$prefix.idx" --perf-counters "$prefix.index.tsv"
+    timed "$prefix.map" /dev/null \
+        "$WFMASH" "$TARGET" $QUERY -m -t "$t" $ARGS -I "$prefix.idx" --perf-counters "$prefix.map.tsv"
+    timed "$prefix.align" /dev/null \
+        "$WFMASH" "$TARGET" $QUERY -i "$MAPPINGS" -t "$t" $ARGS --perf-counters "$prefix.align.tsv"
+    rm -f "$prefix.idx"
+done
+
+python3 - "$WORKDIR" "$THREADS" <<'EOF' | tee "$WORKDIR/scaling.txt"
+import json, re, sys
+workdir, threads = sys.argv[1], [int(t) for t in sys.argv[2].split(',')]
+steps = ['index', 'map', 'align']
+serial_re = re.compile(r'serial section (.+): ([0-9.eE+-]+)s')
+
+def stage_seconds(path):
+    stages = {}
+    try:
+        with open(path) as tsv:
+            header = tsv.readline().rstrip('\n').split('\t')
+            for line in tsv:
+                row = dict(zip(header, line.rstrip('\n').split('\t')))
+                stages[row['stage']] = float(row['seconds'])
+    except OSError:
+        pass
+    return stages
+
+def serial_sections(path):
+    sections = {}
+    with open(path) as log:
+        for line in log:
+            m = serial_re.search(line)
+            if m:
+                sections[m.group(1)] = sections.get(m.group(1), 0.0) + float(m.group(2))
+    return sections
+
+report = {'threads': threads, 'steps': {}}
+for step in steps:
+    runs = []
+    for t in threads:
+        prefix = '%s/t%d.%s' % (workdir, t, step)
+        runs.append({
+            'threads': t,
+            'seconds': float(open(prefix + '.seconds').read().strip() or 'nan'),
+            'stage_thread_seconds': stage_seconds(prefix + '.tsv'),
+            'serial_sections': serial_sections(prefix + '.log'),
+        })
+    base = runs[0]
+    for run in runs:
+        p = run['threads'] / base['threads']
+        speedup = base['seconds'] / run['seconds'] if run['seconds'] > 0 else float('nan')
+        run['speedup'] = speedup
+        run['efficiency'] = speedup / p
+        # Karp-Flatt: the serial fraction that explains the measured speedup under Amdahl's law
+        run['serial_fraction'] = (1 / speedup - 1 / p) / (1 - 1 / p) if p > 1 else None
+        run['serial_share'] = {name: s / run['seconds'] for name, s in run['serial_sections'].items()
+                               if run['seconds'] > 0}
+    report['steps'][step] = runs
+
+with open(workdir + '/scaling.json', 'w') as out:
+    json.dump(report, out, indent=2)
+
+for step in steps:
+    runs = report['steps'][step]
+    print('== %s ==' % step)
+    print('threads\tseconds\tspeedup\tefficiency\tserial_fraction')
+    for run in runs:
+        sf = '%.3f' % run['serial_fraction'] if run['serial_fraction'] is not None else '-'
+        print('%d\t%.2f\t%.2f\t%.2f\t%s' % (run['threads'], run['seconds'], run['speedup'], run['efficiency'], sf))
+    stages = sorted({s for run in runs for s in run['stage_thread_seconds']})
+    if stages:
+        # Thread-seconds that grow with the thread count point at contention rather than serial work
+        print('stage thread-seconds\t' + '\t'.join('t%d' % run['threads'] for run in runs))
+        for stage in stages:
+            print(stage + '\t' + '\t'.join('%.2f' % run['stage_thread_seconds'].get(stage, 0.0) for run in runs))
+    last = runs[-1]
+    for name, share in sorted(last['serial_share'].items(), key=lambda x: -x[1]):
+        flag = '  <-- limits scaling' if share >= 0.1 else ''
+        print('serial section %s: %.2fs, %.1f%% of the step at %d threads%s'
+              % (name, last['serial_sections'][name], 100 * share, last['threads'], flag))
+    print()
+print('JSON report: %s/scaling.json' % workdir)
+EOF
@@ -0,0 +1,93 @@
+#!/bin/bash
+
+# Time biWFA against WFlign on simulated divergent pairs to locate the crossover
+# used by --wflign-min-length and --wflign-max-identity.
+# Output: TSV with length, identity, engine, seconds, max RSS (KB) and gap-compressed identity.
+
+usage() {
+    echo "Usage: $0 [-w <wfmash>] [-l <lengths>] [-d <identities>] [-t <threads>] [-o <workdir>]"
+    echo "  -w, --wfmash      wfmash binary [build/bin/wfmash]"
+    echo "  -l, --lengths     comma-separated pair lengths [5000,10000,25000,50000,100000]"
+    echo "  -d, --identities  comma-separated identities [0.99,0.95,0.90,0.85,0.80]"
+    echo "  -t, --threads     threads [1]"
+    echo "  -o, --workdir     directory for simulated data [bench_wflign_crossover]"
+    exit 1
+}
+
+WFMASH=build/bin/wfmash
+LENGTHS=5000,10000,25000,50000,100000
+IDENTITIES=0.99,0.95,0.90,0.85,0.80
+THREADS=1
+WORKDIR=bench_wflign_crossover
+
+PARSED_ARGUMENTS=$(getopt -a -n "$0" -o w:l:d:t:o:h --long wfmash:,lengths:,identities:,threads:,workdir:,help -- "$@")
+if [ "$?" != "0" ]; then
+    usage
+fi
+
+eval set -- "$PARSED_ARGUMENTS"
+while :
+do
+    case "$1" in
+        -w | --wfmash) WFMASH="$2" ; shift 2 ;;
+        -l | --lengths) LENGTHS="$2" ; shift 2 ;;
+        -d | --identities) IDENTITIES="$2" ; shift 2 ;;
+        -t | --threads) THREADS="$2" ; shift 2 ;;
+        -o | --workdir) WORKDIR="$2" ; shift 2 ;;
+        -h | --help) usage ;;
+        --) shift ; break ;;
+        *) usage ;;
+    esac
+done
+
+mkdir -p "$WORKDIR"
+
+# Simulate a target and a query derived from it with substitutions and short indels
+# (2:1 ratio) at the given divergence, plus the mapping record the aligner consumes
+simulate() {
+    python3 - "$1" "$2" "$3" <<'EOF'
+import random, sys
+length, identity, prefix = int(sys.argv[1]), float(sys.argv[2]), sys.argv[3]
+rng = random.Random(length * 1000 + int(identity * 1000))
+target = ''.join(rng.choice('ACGT') for _ in range(length))
+query = []
+for base in target:
+    r = rng.random()
+    if r < (1 - identity) * 2 / 3:
+        query.append(rng.choice([b for b in 'ACGT' if b != base]))
+    elif r < (1 - identity) * 5 / 6:
+        continue
+    elif r < (1 - identity):
+        query.append(base + ''.join(rng.choice('ACGT') for _ in range(rng.randint(1, 3))))
+    else:
+        query.append(base)
+query = ''.join(query)
+with open(prefix + '.fa', 'w') as out:
+    out.write('>target\n' + target + '\n>query\n' + query + '\n')
+with open(prefix + '.paf', 'w') as out:
+    out.write('\t'.join(map(str, ['query', len(query), 0, len(query), '+', 'target', length, 0, length,
+                                  0, max(length, len(query)), 255, 'id:f:%.4f' % identity])) + '\n')
+EOF
+    samtools faidx "$3.fa"
+}
+
+echo -e "length\tidentity\tengine\tseconds\tmax_rss_kb\tgi"
+for length in ${LENGTHS//,/ }; do
+    for identity in ${IDENTITIES//,/ }; do
+        prefix="$WORKDIR/pair.$length.$identity"
+        simulate "$length" "$identity" "$prefix"
+        for engine in biwfa wflign; do
+            if [ "$engine" == "biwfa" ]; then
+                engine_args="--wflign-min-length 0"
+            else
+                engine_args="--force-wflign"
+            fi
+            /usr/bin/time -f "%e %M" -o "$prefix.$engine.time" \
+                "$WFMASH" "$prefix.fa" "$prefix.fa" -i "$prefix.paf" -t "$THREADS" $engine_args \
+                > "$prefix.$engine.paf" 2> "$prefix.$engine.log"
+            read -r seconds rss < "$prefix.$engine.time"
+            gi=$(grep -o 'gi:f:[0-9.e-]*' "$prefix.$engine.paf" | head -n 1 | cut -f 3 -d ':')
+            echo -e "$length\t$identity\t$engine\t$seconds\t$rss\t${gi:-NA}"
+        done
+    done
+done
@@ -52,6 +52,20 @@ struct Parameters {
     int64_t chain_gap;                            //max distance for 2d range union-find mapping chaining;
     int wflign_min_inv_patch_len;                 //minimum length of an inverted patch
     int wflign_max_patching_score;                //maximum score allowed for patching
+    uint64_t wflign_min_length;                   //mappings at least this long and below wflign_max_identity use WFlign (0=never)
+    float wflign_max_identity;                    //estimated identity below which long mappings use WFlign
+    bool wflign_orientation_filter;               //skip inverted patch probes when the k-mer content favours the forward strand
+    uint64_t wflign_parallel_probe_len;           //minimum patch length for concurrent forward/inverted probes (0=never)
+    uint64_t wfa_max_memory;                      //memory budget per alignment used to pick the WFA memory mode
+    int wfa_heuristic;                            //WFA heuristic for the main alignment (0=auto,1=none,2=adaptive,3=xdrop)
+    int wfa_max_steps;                            //max WFA steps for the main alignment before escalating to WFlign (0=unlimited)
+    double align_max_seconds;                     //wall-clock budget per record before emitting an approximate result (0=unlimited)
+    bool identity_prepass;                        //stop alignments as soon as their score rules out min_identity
+    uint64_t short_align_max_len;                 //records with queries up to this long are aligned in lockstep batches (0=never)
+    bool replay;                                  //align a single record repeatedly and report per-phase timings
+    uint64_t replay_record;                       //1-based record of the input PAF to replay (0=read it from stdin)
+    uint64_t replay_repeats;                      //times the replayed record is aligned
+    std::string replay_bundle;                    //write the replayed record as a self-contained test case with this prefix
 
     std::vector<std::string> refSequences;        //reference sequence(s)
     std::vector<std::string> querySequences;      //query sequence(s)
@@ -59,8 +73,14 @@ struct Parameters {
     std::string pafOutputFile;                    //paf/sam output file name
 
     bool emit_md_tag;                             //Output the MD tag
+    bool emit_policy_tag;                         //Output the WFA policy of each alignment as a wp:Z: tag
     bool sam_format;                              //Emit the output in SAM format (PAF default)
     bool no_seq_in_sam;                           //Do not fill the SEQ field in SAM format
+    bool sort_by_target;                          //Sort the output by target with bounded memory
+    uint64_t sort_memory;                         //Bytes of records buffered and being spilled as sorted runs
+    std::string sort_temp_prefix;                 //Path prefix of the spilled sorted runs
+    std::string output_shards;                    //Write one sorted output file per target with this prefix
+    std::string output_index;                     //Coordinate index of the sorted output(s)
     bool disable_chain_patching;                  //Disable alignment patching at chain boundaries
     bool multithread_fasta_input;                 //Multithreaded fasta input
     uint64_t target_padding;                      //Additional padding around target sequence
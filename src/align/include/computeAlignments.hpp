@@ -28,10 +28,15 @@
 
 //External includes
 #include "common/wflign/src/wflign.hpp"
+#include "common/wflign/src/alignment_formatter.hpp"
+#include "common/wflign/src/wflign_short.hpp"
 #include "common/seqiter.hpp"
 // #include "common/progress.hpp"
 #include "common/utils.hpp"
+#include "common/sorted_output.hpp"
+#include "common/perf_counters.hpp"
 #include <any>
+#include <unistd.h>
 #include <taskflow/taskflow.hpp>
 #include <taskflow/algorithm/for_each.hpp>
 #include <taskflow/algorithm/partitioner.hpp>
@@ -150,6 +155,20 @@ struct seq_record_t {
       faidx_meta_t* ref_meta;
       faidx_meta_t* query_meta;
 
+      // Records whose alignment exceeded the effort budget
+      std::atomic<uint64_t> records_escalated{0};
+      std::atomic<uint64_t> records_approximate{0};
+      // Records dropped by the min_identity pre-pass, their query bp and the time spent on them
+      std::atomic<uint64_t> records_prepass_rejected{0};
+      std::atomic<uint64_t> prepass_rejected_bp{0};
+      std::atomic<uint64_t> prepass_rejected_us{0};
+
+      // Executor of the running alignment, whose idle workers take concurrent patch probes
+      tf::Executor* align_executor = nullptr;
+
+      // Collects the records when the output is sorted by target
+      std::unique_ptr<sorted_output::TargetSortedWriter> sorter;
+
     public:
 
       explicit Aligner(const align::Parameters &p) : param(p) {
@@ -187,6 +206,121 @@ struct seq_record_t {
         this->computeAlignmentsTaskflow();
       }
 
+      /**
+       * @brief                 sort approximate mappings by target into the output
+       */
+      void sortMappings(const std::string& mappingFile)
+      {
+        std::ifstream in(mappingFile);
+        if (!in.is_open()) {
+            throw std::runtime_error("[wfmash::align] Error! Failed to open input mapping file: " + mappingFile);
+        }
+        sorter = makeSorter();
+        std::string line;
+        while (std::getline(in, line)) {
+            line += '\n';
+            sorter->add(line);
+        }
+        writeSortedOutput("");
+      }
+
+      /**
+       * @brief                 align a single mapping record repeatedly and report where the time goes
+       */
+      void replay()
+      {
+        // The record is line replay_record of the input mappings, or the first line on stdin
+        std::string line;
+        if (param.replay_record == 0) {
+            std::getline(std::cin, line);
+        } else {
+            std::ifstream in(param.mashmapPafFile);
+            if (!in.is_open()) {
+                throw std::runtime_error("[wfmash::align] Error! Failed to open input mapping file: " + param.mashmapPafFile);
+            }
+            uint64_t n = 0;
+            while (n < param.replay_record && std::getline(in, line)) {
+                ++n;
+            }
+            if (n < param.replay_record) {
+                throw std::runtime_error("[wfmash::align] Error! " + param.mashmapPafFile + " has only "
+                                         + std::to_string(n) + " records");
+            }
+        }
+        MappingBoundaryRow record;
+        parseMashmapRow(line, record, param.target_padding, param.query_padding);
+
+        std::vector<double> fetch, align, main, patch, swizzle, format;
+        wflign::wavefront::biwfa_profile_t profile;
+        wflign::wavefront::string_ostream out;
+        std::unique_ptr<seq_record_t> rec;
+        const uint64_t rss_before = residentBytes();
+        uint64_t rss_peak = rss_before;
+        for (uint64_t i = 0; i < param.replay_repeats; ++i) {
+            const auto t0 = std::chrono::steady_clock::now();
+            rec.reset(createSeqRecord(record, line, ref_meta, query_meta));
+            const auto t1 = std::chrono::steady_clock::now();
+            out.reset();
+            profile = wflign::wavefront::biwfa_profile_t();
+            processAlignment(rec.get(), out, &profile);
+            const auto t2 = std::chrono::steady_clock::now();
+            fetch.push_back(std::chrono::duration<double>(t1 - t0).count());
+            align.push_back(std::chrono::duration<double>(t2 - t1).count());
+            main.push_back(profile.main_seconds);
+            patch.push_back(profile.patch_seconds);
+            swizzle.push_back(profile.swizzle_seconds);
+            format.push_back(profile.format_seconds);
+            rss_peak = std::max(rss_peak, residentBytes());
+        }
+
+        std::cerr << "[wfmash::align] replay of " << record.qId << ":" << record.qStartPos << "-" << record.qEndPos
+                  << " (" << (record.strand == skch::strnd::FWD ? '+' : '-') << ") against "
+                  << record.refId << ":" << record.rStartPos << "-" << record.rEndPos
+                  << ", " << param.replay_repeats << " runs" << std::endl;
+        auto report = [](const std::string& phase, std::vector<double> seconds) {
+            std::sort(seconds.begin(), seconds.end());
+            std::cerr << "[wfmash::align] replay " << phase << ": median " << seconds[seconds.size() / 2]
+                      << "s, min " << seconds.front() << "s, max " << seconds.back() << "s" << std::endl;
+        };
+        report("fetch", fetch);
+        report("alignment", align);
+        if (selectWflign(rec.get())) {
+            std::cerr << "[wfmash::align] replay: the record is aligned with WFlign, no biWFA phases" << std::endl;
+        } else {
+            report("main biWFA", main);
+            report("head/tail patch", patch);
+            report("swizzle", swizzle);
+            report("formatting", format);
+            std::cerr << "[wfmash::align] replay main biWFA: policy " << wflign::wavefront::wfa_policy_to_string(profile.policy)
+                      << ", score " << profile.wfa_score << std::endl;
+        }
+        // sampled after each run, so transient peaks inside a run are not seen
+        std::cerr << "[wfmash::align] replay memory: resident set grew by "
+                  << (rss_peak - rss_before) / (1024 * 1024) << " MiB over the runs" << std::endl;
+
+        std::ofstream outstream(param.pafOutputFile);
+        if (param.sam_format) {
+            write_sam_header(outstream);
+        }
+        outstream << out.buffer();
+
+        if (!param.replay_bundle.empty()) {
+            writeReplayBundle(rec.get(), line, out.buffer());
+        }
+      }
+
+      /**
+       * @brief       current resident set size of the process, 0 if it cannot be read
+       */
+      static uint64_t residentBytes() {
+          std::ifstream statm("/proc/self/statm");
+          uint64_t size = 0, resident = 0;
+          if (!(statm >> size >> resident)) {
+              return 0;
+          }
+          return resident * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+      }
+
       /**
        * @brief       parse mashmap row sequence
        * @param[in]   mappingRecordLine
@@ -310,16 +444,66 @@ struct alignment_result_t {
         : output(std::move(out)), alignment_length(len), success(true) {}
 };
 
+std::unique_ptr<sorted_output::TargetSortedWriter> makeSorter() {
+    std::vector<std::string> target_names;
+    for (int i = 0; i < faidx_meta_nseq(ref_meta); ++i) {
+        target_names.emplace_back(faidx_meta_iseq(ref_meta, i));
+    }
+    return std::make_unique<sorted_output::TargetSortedWriter>(
+        param.sam_format ? sorted_output::format_t::SAM : sorted_output::format_t::PAF,
+        target_names, param.sort_memory, param.sort_temp_prefix);
+}
+
+// Merge the sorted records into the output or the per-target shards, with the coordinate index
+void writeSortedOutput(const std::string& header) {
+    perf_counters::Scope scope(perf_counters::output);
+    std::cerr << "[wfmash::align] merging " << sorter->run_count() << " sorted runs"
+              << (param.output_shards.empty() ? "" : " into per-target shards") << std::endl;
+    std::ofstream index_stream;
+    if (!param.output_index.empty()) {
+        index_stream.open(param.output_index);
+        if (!index_stream.is_open()) {
+            throw std::runtime_error("[wfmash::align] Error! Failed to open index file: " + param.output_index);
+        }
+    }
+    std::ostream* index = param.output_index.empty() ? nullptr : &index_stream;
+    if (param.output_shards.empty()) {
+        std::ofstream outstream(param.pafOutputFile);
+        if (!outstream.is_open()) {
+            throw std::runtime_error("[wfmash::align] Error! Failed to open output file: " + param.pafOutputFile);
+        }
+        const auto merge_start = std::chrono::steady_clock::now();
+        sorter->write(outstream, header, index);
+        perf_counters::serial(perf_counters::sorted_output, std::chrono::steady_clock::now() - merge_start);
+    } else {
+        sorter->write_shards(param.output_shards, header, param.threads, index);
+    }
+    sorter.reset();
+}
+
 void computeAlignmentsTaskflow() {
+    // Sorted output collects the records and writes them, header first, once all are aligned
+    std::ostringstream header;
+    if (param.sort_by_target) {
+        sorter = makeSorter();
+    }
+
     // Prepare output file
-    std::ofstream outstream(param.pafOutputFile);
-    if (!outstream.is_open()) {
-        throw std::runtime_error("[wfmash::align] Error! Failed to open output file: " + param.pafOutputFile);
+    std::ofstream outstream;
+    if (!sorter) {
+        outstream.open(param.pafOutputFile);
+        if (!outstream.is_open()) {
+            throw std::runtime_error("[wfmash::align] Error! Failed to open output file: " + param.pafOutputFile);
+        }
     }
 
     // Write SAM header if needed
     if (param.sam_format) {
-        write_sam_header(outstream);
+        if (sorter) {
+            write_sam_header(header);
+        } else {
+            write_sam_header(outstream);
+        }
     }
 
     // Start timing
@@ -329,8 +513,9 @@ void computeAlignmentsTaskflow() {
     std::atomic<uint64_t> total_alignments_processed(0);
     std::atomic<uint64_t> processed_alignment_length(0);
 
-    // Read all mapping records upfront
+    // Read all mapping records upfront; short records go first so that they can be batched
     std::vector<std::string> mapping_records;
+    std::vector<std::string> long_records;
     uint64_t total_query_length = 0;
     uint64_t total_target_length = 0;
     {
@@ -349,18 +534,40 @@ void computeAlignmentsTaskflow() {
                     parseMashmapRow(mappingRecordLine, currentRecord, param.target_padding);
                     total_query_length += currentRecord.qEndPos - currentRecord.qStartPos;
                     total_target_length += currentRecord.rEndPos - currentRecord.rStartPos;
-                    mapping_records.push_back(std::move(mappingRecordLine));
+                    if (isShortRecord(currentRecord)) {
+                        mapping_records.push_back(std::move(mappingRecordLine));
+                    } else {
+                        long_records.push_back(std::move(mappingRecordLine));
+                    }
                 } catch (const std::exception& e) {
                     std::cerr << "[wfmash::align] Warning: Skipping invalid record: " << e.what() << std::endl;
                 }
             }
         }
     }
+    const size_t num_short_records = mapping_records.size();
+    mapping_records.insert(mapping_records.end(),
+                           std::make_move_iterator(long_records.begin()),
+                           std::make_move_iterator(long_records.end()));
+    long_records.clear();
+
+    // Work units: batches of short records aligned in lockstep, then one unit per remaining record
+    std::vector<std::pair<size_t, size_t>> work_units;
+    for (size_t i = 0; i < num_short_records; i += SHORT_BATCH_LANES) {
+        work_units.emplace_back(i, std::min(num_short_records, i + SHORT_BATCH_LANES));
+    }
+    for (size_t i = num_short_records; i < mapping_records.size(); ++i) {
+        work_units.emplace_back(i, i + 1);
+    }
 
     std::cerr << "[wfmash::align] Found " << mapping_records.size()
               << " mapping records for alignment ("
               << total_query_length << " query bp, "
               << total_target_length << " target bp)" << std::endl;
+    if (num_short_records > 0) {
+        std::cerr << "[wfmash::align] " << num_short_records
+                  << " short records will be aligned in batches of " << SHORT_BATCH_LANES << std::endl;
+    }
 
     // Progress meter
     auto progress = std::make_shared<progress_meter::ProgressMeter>(
@@ -372,17 +579,32 @@ void computeAlignmentsTaskflow() {
     // Create taskflow executor with thread count
     tf::Executor executor(param.threads);
     tf::Taskflow taskflow;
+    align_executor = &executor;
 
     // Mutex for synchronized output writing
     std::mutex output_mutex;
 
     // Using for_each with iterators and DynamicPartitioner for better load balancing
     taskflow.for_each(
-        mapping_records.begin(),
-        mapping_records.end(),
-        [&](const std::string& record) {
+        work_units.begin(),
+        work_units.end(),
+        [&](const std::pair<size_t, size_t>& unit) {
+            if (unit.first < num_short_records) {
+                processShortBatch(
+                    &mapping_records[unit.first],
+                    unit.second - unit.first,
+                    ref_meta,
+                    query_meta,
+                    param,
+                    total_alignments_processed,
+                    processed_alignment_length,
+                    progress,
+                    output_mutex,
+                    outstream);
+                return;
+            }
             processMappingRecord(
-                record,
+                mapping_records[unit.first],
                 ref_meta,
                 query_meta,
                 param,
@@ -398,9 +620,14 @@ void computeAlignmentsTaskflow() {
 
     // Run the taskflow
     executor.run(taskflow).wait();
+    align_executor = nullptr;
 
     // Close output stream
-    outstream.close();
+    if (sorter) {
+        writeSortedOutput(header.str());
+    } else {
+        outstream.close();
+    }
 
     // End timing
     auto end_time = std::chrono::high_resolution_clock::now();
@@ -414,6 +641,17 @@ void computeAlignmentsTaskflow() {
               << "total aligned records = " << total_alignments_processed.load()
               << ", total aligned bp = " << processed_alignment_length.load()
               << ", completed in " << duration.count() << " seconds" << std::endl;
+    if (records_escalated.load() > 0 || records_approximate.load() > 0) {
+        std::cerr << "[wfmash::align] "
+                  << records_escalated.load() << " records escalated to WFlign, "
+                  << records_approximate.load() << " records left as approximate mappings (ea:Z:approx, unmapped in SAM)" << std::endl;
+    }
+    if (param.identity_prepass) {
+        std::cerr << "[wfmash::align] "
+                  << "identity pre-pass rejected " << records_prepass_rejected.load() << " records ("
+                  << prepass_rejected_bp.load() << " query bp) in "
+                  << prepass_rejected_us.load() / 1e6 << "s of bounded alignment, skipping their full alignment and traceback" << std::endl;
+    }
 }
 
 // Process a single mapping record (extracted to avoid lambda issues with for_each)
@@ -438,53 +676,15 @@ void processMappingRecord(
             createSeqRecord(currentRecord, record, ref_meta, query_meta)
         );
 
-        // Process alignment
-        std::string alignment_output = processAlignment(seq_rec.get());
-        uint64_t alignment_length = currentRecord.qEndPos - currentRecord.qStartPos;
-
-        // Format the output
-        std::stringstream formatted_buffer;
-        std::string_view output(alignment_output);
-        size_t start = 0;
-        size_t end = output.find('\n');
-
-        while (end != std::string_view::npos) {
-            // Process one line at a time without copying
-            std::string_view line = output.substr(start, end - start);
-            if (!line.empty()) {
-                // Parse fields using string_view
-                auto fields = tokenize_view(line);
-
-                // Find the CIGAR string field (should be after cg:Z:)
-                auto cigar_it = std::find_if(fields.begin(), fields.end(),
-                    [](std::string_view s) {
-                        return s.size() >= 5 && s.substr(0, 5) == "cg:Z:";
-                    });
-
-                if (cigar_it != fields.end()) {
-                    // Reconstruct the line efficiently with a single allocation
-                    std::string new_line;
-                    new_line.reserve(line.size() + 1); // +1 for newline
-
-                    for (const auto& f : fields) {
-                        if (!new_line.empty()) new_line += '\t';
-                        new_line.append(f.data(), f.size());
-                    }
-                    new_line += '\n';
-
-                    formatted_buffer << new_line;
-                } else {
-                    // If no CIGAR string found, output the line unchanged
-                    formatted_buffer << line << '\n';
-                }
-            }
-
-            start = end + 1;
-            end = output.find('\n', start);
+        // Process alignment; the writers emit final-format records into a buffer reused by this thread
+        thread_local wflign::wavefront::string_ostream alignment_output;
+        alignment_output.reset();
+        {
+            perf_counters::Scope scope(perf_counters::wfa);
+            processAlignment(seq_rec.get(), alignment_output);
         }
-
-        // Capture the formatted output
-        std::string formatted_output = formatted_buffer.str();
+        const std::string& formatted_output = alignment_output.buffer();
+        uint64_t alignment_length = currentRecord.qEndPos - currentRecord.qStartPos;
 
         // Update statistics
         processed_alignment_length.fetch_add(alignment_length, std::memory_order_relaxed);
@@ -494,7 +694,10 @@ void processMappingRecord(
         progress->increment(alignment_length);
 
         // Write to output with minimal critical section
-        if (!formatted_output.empty()) {
+        perf_counters::Scope scope(perf_counters::output);
+        if (!formatted_output.empty() && sorter) {
+            sorter->add(formatted_output);
+        } else if (!formatted_output.empty()) {
             std::lock_guard<std::mutex> lock(output_mutex);
             outstream << formatted_output;
             // Only flush occasionally to reduce I/O overhead
@@ -508,6 +711,129 @@ void processMappingRecord(
     }
 }
 
+// Whether a record is aligned on the batched short-read path
+bool isShortRecord(const MappingBoundaryRow& record) const {
+    return param.short_align_max_len > 0
+        && !param.force_wflign
+        && record.qEndPos - record.qStartPos <= param.short_align_max_len;
+}
+
+// Process a batch of short mapping records: align them in lockstep, then send those the batch
+// kernel could not align optimally through the regular per-record path
+void processShortBatch(
+    const std::string* records,
+    const size_t num_records,
+    faidx_meta_t* ref_meta,
+    faidx_meta_t* query_meta,
+    const align::Parameters& param,
+    std::atomic<uint64_t>& total_alignments_processed,
+    std::atomic<uint64_t>& processed_alignment_length,
+    std::shared_ptr<progress_meter::ProgressMeter>& progress,
+    std::mutex& output_mutex,
+    std::ofstream& outstream) {
+
+    std::vector<std::unique_ptr<seq_record_t>> seq_recs;
+    std::vector<std::vector<char>> strands;
+    std::vector<wflign::wavefront::short_pair_t> pairs;
+    seq_recs.reserve(num_records);
+    strands.reserve(num_records);
+    pairs.reserve(num_records);
+
+    for (size_t k = 0; k < num_records; ++k) {
+        try {
+            MappingBoundaryRow currentRecord;
+            parseMashmapRow(records[k], currentRecord, param.target_padding, param.query_padding);
+            std::unique_ptr<seq_record_t> rec(createSeqRecord(currentRecord, records[k], ref_meta, query_meta));
+
+            skch::CommonFunc::makeUpperCaseAndValidDNA(rec->raw_ref_sequence, rec->refLen);
+            skch::CommonFunc::makeUpperCaseAndValidDNA(rec->raw_query_sequence, rec->queryLen);
+            std::vector<char> strand(rec->queryLen + 1);
+            if (rec->currentRecord.strand == skch::strnd::FWD) {
+                std::copy(rec->querySequence.begin(), rec->querySequence.end(), strand.begin());
+            } else {
+                skch::CommonFunc::reverseComplement(rec->raw_query_sequence, strand.data(), rec->queryLen);
+            }
+
+            wflign::wavefront::short_pair_t pair;
+            pair.query_name = &rec->currentRecord.qId;
+            pair.query = strand.data();
+            pair.query_total_length = rec->queryTotalLength;
+            pair.query_offset = rec->queryStartPos;
+            pair.query_length = rec->queryLen;
+            pair.query_is_rev = rec->currentRecord.strand != skch::strnd::FWD;
+            pair.target_name = &rec->currentRecord.refId;
+            pair.target = &rec->raw_ref_sequence[rec->currentRecord.rStartPos - rec->refStartPos];
+            pair.target_total_length = rec->refTotalLength;
+            pair.target_offset = rec->currentRecord.rStartPos;
+            pair.target_length = rec->currentRecord.rEndPos - rec->currentRecord.rStartPos;
+            pair.mashmap_estimated_identity = rec->currentRecord.mashmap_estimated_identity;
+            pair.chain_id = rec->currentRecord.chain_id;
+            pair.chain_length = rec->currentRecord.chain_length;
+            pair.chain_pos = rec->currentRecord.chain_pos;
+
+            pairs.push_back(pair);
+            strands.push_back(std::move(strand));
+            seq_recs.push_back(std::move(rec));
+        } catch (const std::exception& e) {
+            std::cerr << "[wfmash::align] Error processing record: " << e.what() << std::endl;
+        }
+    }
+
+    wflign_penalties_t wfa_penalties;
+    wfa_penalties.match = 0;
+    wfa_penalties.mismatch = param.wfa_patching_mismatch_score;
+    wfa_penalties.gap_opening1 = param.wfa_patching_gap_opening_score1;
+    wfa_penalties.gap_extension1 = param.wfa_patching_gap_extension_score1;
+    wfa_penalties.gap_opening2 = param.wfa_patching_gap_opening_score2;
+    wfa_penalties.gap_extension2 = param.wfa_patching_gap_extension_score2;
+
+    thread_local wflign::wavefront::string_ostream alignment_output;
+    alignment_output.reset();
+    std::vector<bool> aligned;
+    perf_counters::Scope wfa_scope(perf_counters::wfa);
+    wflign::wavefront::do_short_batch_alignment(
+        pairs.data(),
+        pairs.size(),
+        alignment_output,
+        wfa_penalties,
+        param.emit_md_tag,
+        !param.sam_format,
+        param.no_seq_in_sam,
+        param.min_identity,
+        param.emit_policy_tag,
+        aligned);
+
+    uint64_t batch_length = 0;
+    for (size_t k = 0; k < seq_recs.size(); ++k) {
+        if (!aligned[k]) {
+            try {
+                processAlignment(seq_recs[k].get(), alignment_output);
+            } catch (const std::exception& e) {
+                std::cerr << "[wfmash::align] Error processing record: " << e.what() << std::endl;
+            }
+        }
+        batch_length += seq_recs[k]->currentRecord.qEndPos - seq_recs[k]->currentRecord.qStartPos;
+    }
+
+    // Update statistics and progress
+    processed_alignment_length.fetch_add(batch_length, std::memory_order_relaxed);
+    const uint64_t processed_before = total_alignments_processed.fetch_add(seq_recs.size(), std::memory_order_relaxed);
+    progress->increment(batch_length);
+
+    perf_counters::Scope output_scope(perf_counters::output);
+    const std::string& formatted_output = alignment_output.buffer();
+    if (!formatted_output.empty() && sorter) {
+        sorter->add(formatted_output);
+    } else if (!formatted_output.empty()) {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        outstream << formatted_output;
+        // Only flush occasionally to reduce I/O overhead
+        if ((processed_before + seq_recs.size()) / 1000 != processed_before / 1000) {
+            outstream.flush();
+        }
+    }
+}
+
 // Thread-local readers that persist for the lifetime of the thread
 struct ThreadLocalReaders {
     faidx_reader_t* ref_reader;
@@ -620,7 +946,9 @@ seq_record_t* createSeqRecord(const MappingBoundaryRow& currentRecord,
     }
 }
 
-std::string processAlignment(seq_record_t* rec) {
+// Append the output records for rec to out; a non-null profile receives the biWFA phase timings
+void processAlignment(seq_record_t* rec, wflign::wavefront::string_ostream& out,
+                      wflign::wavefront::biwfa_profile_t* profile = nullptr) {
     // Thread-local buffer for query strand
     thread_local std::vector<char> queryRegionStrand;
 
@@ -651,10 +979,44 @@ std::string processAlignment(seq_record_t* rec) {
     wfa_penalties.gap_opening2 = param.wfa_patching_gap_opening_score2;
     wfa_penalties.gap_extension2 = param.wfa_patching_gap_extension_score2;
 
-    std::stringstream output;
+    // The time budget covers the whole record: biWFA is checked against it once it stops at
+    // --max-align-steps, WFlign checks it while aligning segments
+    const auto record_start = std::chrono::steady_clock::now();
+    const auto deadline = param.align_max_seconds > 0
+        ? record_start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+              std::chrono::duration<double>(param.align_max_seconds))
+        : std::chrono::steady_clock::time_point::max();
+    auto seconds_since = [](const std::chrono::steady_clock::time_point& t) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+    };
+    std::string& buffer = out.buffer();
+
+    // Out of time without output: emit the approximate mapping, tagged with the time it took
+    auto emitApproximate = [&]() {
+        const double elapsed = seconds_since(record_start);
+        records_approximate.fetch_add(1, std::memory_order_relaxed);
+        std::cerr << "[wfmash::align] Warning: " << rec->currentRecord.qId << ":" << rec->currentRecord.qStartPos
+                  << "-" << rec->currentRecord.qEndPos << " exceeded its alignment budget after " << elapsed
+                  << "s, emitting the approximate mapping" << std::endl;
+        std::stringstream tags;
+        tags << "\tea:Z:approx\tet:f:" << elapsed;
+        buffer += param.sam_format ? approximateMappingSam(rec) : approximateMappingPaf(rec);
+        buffer += tags.str();
+        buffer += '\n';
+    };
+
+    if (selectWflign(rec)) {
+        const size_t wflign_start = buffer.size();
+        runWflign(rec, queryRegionStrand.data(), ref_seq_ptr, out, deadline);
+        if (buffer.size() == wflign_start && std::chrono::steady_clock::now() > deadline) {
+            emitApproximate();
+        }
+        return;
+    }
 
     // Do direct biWFA alignment
-    wflign::wavefront::do_biwfa_alignment(
+    bool rejected_by_prepass = false;
+    const bool completed = wflign::wavefront::do_biwfa_alignment(
         rec->currentRecord.qId,
         queryRegionStrand.data(),
         rec->queryTotalLength,
@@ -666,7 +1028,7 @@ std::string processAlignment(seq_record_t* rec) {
         rec->refTotalLength,
         rec->currentRecord.rStartPos,
         rec->currentRecord.rEndPos - rec->currentRecord.rStartPos,
-        output,
+        out,
         wfa_penalties,
         param.emit_md_tag,
         !param.sam_format,
@@ -677,12 +1039,225 @@ std::string processAlignment(seq_record_t* rec) {
         rec->currentRecord.mashmap_estimated_identity,
         rec->currentRecord.chain_id,
         rec->currentRecord.chain_length,
-        rec->currentRecord.chain_pos);
+        rec->currentRecord.chain_pos,
+        param.wfa_max_memory,
+        static_cast<wflign::wavefront::wfa_heuristic_t>(param.wfa_heuristic),
+        param.wfa_max_steps,
+        param.identity_prepass,
+        &rejected_by_prepass,
+        profile,
+        param.emit_policy_tag);
+
+    if (rejected_by_prepass) {
+        records_prepass_rejected.fetch_add(1, std::memory_order_relaxed);
+        prepass_rejected_bp.fetch_add(rec->queryLen, std::memory_order_relaxed);
+        prepass_rejected_us.fetch_add(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - record_start).count(), std::memory_order_relaxed);
+    }
+    if (completed) {
+        return;
+    }
+
+    // biWFA gave up on this record: escalate to the segmented WFlign path, which stops at the
+    // deadline too, otherwise fall back to the approximate mapping
+    const size_t escalated_start = buffer.size();
+    if (std::chrono::steady_clock::now() < deadline) {
+        runWflign(rec, queryRegionStrand.data(), ref_seq_ptr, out, deadline);
+    }
+    if (buffer.size() == escalated_start) {
+        emitApproximate();
+        return;
+    }
+
+    records_escalated.fetch_add(1, std::memory_order_relaxed);
+    // Flag every record produced by the escalated alignment, with the time it took
+    std::stringstream tags;
+    tags << "\tea:Z:wflign\tet:f:" << seconds_since(record_start);
+    appendTagToRecords(buffer, escalated_start, tags.str());
+}
 
-    return output.str();
+// Write the replayed record as a self-contained test case: the fetched query and target regions,
+// the record and its alignment output moved onto them (as scripts/make_align_test_case.sh does)
+void writeReplayBundle(const seq_record_t* rec, const std::string& record, const std::string& output) {
+    const std::string query_name = rec->currentRecord.qId + ":" + std::to_string(rec->queryStartPos + 1)
+        + "-" + std::to_string(rec->queryStartPos + rec->queryLen);
+    const std::string target_name = rec->currentRecord.refId + ":" + std::to_string(rec->refStartPos + 1)
+        + "-" + std::to_string(rec->refStartPos + rec->refLen);
+    const std::string& prefix = param.replay_bundle;
+
+    std::ofstream fasta(prefix + ".fa");
+    fasta << ">" << query_name << "\n" << rec->querySequence << "\n"
+          << ">" << target_name << "\n" << rec->refSequence << "\n";
+
+    // Rename the sequences and shift the coordinates of a PAF line onto the bundled regions
+    auto relocate = [&](const std::string& paf_line) {
+        const auto tokens = tokenize_view(paf_line);
+        std::string relocated;
+        for (size_t i = 0; i < tokens.size(); ++i) {
+            if (i) relocated += '\t';
+            switch (i) {
+                case 0: relocated += query_name; break;
+                case 1: relocated += std::to_string(rec->queryLen); break;
+                case 2: case 3: relocated += std::to_string(std::stoull(std::string(tokens[i])) - rec->queryStartPos); break;
+                case 5: relocated += target_name; break;
+                case 6: relocated += std::to_string(rec->refLen); break;
+                case 7: case 8: relocated += std::to_string(std::stoull(std::string(tokens[i])) - rec->refStartPos); break;
+                default: relocated.append(tokens[i].data(), tokens[i].size());
+            }
+        }
+        return relocated + "\n";
+    };
+    std::ofstream(prefix + ".paf") << relocate(record);
+    if (param.sam_format) {
+        std::cerr << "[wfmash::align] replay bundle: no expected output for SAM, rerun in PAF to record it" << std::endl;
+    } else {
+        std::ofstream expected(prefix + ".expected.paf");
+        size_t start = 0, end;
+        while ((end = output.find('\n', start)) != std::string::npos) {
+            expected << relocate(output.substr(start, end - start));
+            start = end + 1;
+        }
+    }
+    std::cerr << "[wfmash::align] replay bundle written to " << prefix << ".{fa,paf"
+              << (param.sam_format ? "" : ",expected.paf") << "}, align it with: wfmash "
+              << prefix << ".fa -i " << prefix << ".paf and the same alignment options" << std::endl;
+}
+
+// Whether a record should go straight to WFlign: for long, divergent mappings the sketch-filtered
+// wflambda layer is much cheaper than exact end-to-end biWFA
+bool selectWflign(const seq_record_t* rec) const {
+    if (param.force_wflign) {
+        return true;
+    }
+    const uint64_t length = std::max(
+        rec->currentRecord.qEndPos - rec->currentRecord.qStartPos,
+        rec->currentRecord.rEndPos - rec->currentRecord.rStartPos);
+    return param.wflign_min_length > 0
+        && length >= param.wflign_min_length
+        && rec->currentRecord.mashmap_estimated_identity < param.wflign_max_identity;
+}
+
+// Align a record with WFlign's segmented wflambda path, which bounds the work by aligning
+// fixed-size segments under the WFmash heuristic and patching between them; nothing is
+// written if the deadline passes first
+void runWflign(seq_record_t* rec, char* query, char* target, wflign::wavefront::string_ostream& out,
+               const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max()) {
+    // One instance per thread; only the estimated identity and the output change between records
+    thread_local std::unique_ptr<wflign::wavefront::WFlign> wflign;
+    if (!wflign) {
+        wflign = std::make_unique<wflign::wavefront::WFlign>(
+            param.wflambda_segment_length,
+            param.min_identity,
+            true, // force the segmented path
+            param.wfa_mismatch_score,
+            param.wfa_gap_opening_score,
+            param.wfa_gap_extension_score,
+            param.wfa_patching_mismatch_score,
+            param.wfa_patching_gap_opening_score1,
+            param.wfa_patching_gap_extension_score1,
+            param.wfa_patching_gap_opening_score2,
+            param.wfa_patching_gap_extension_score2,
+            rec->currentRecord.mashmap_estimated_identity,
+            param.wflign_mismatch_score,
+            param.wflign_gap_opening_score,
+            param.wflign_gap_extension_score,
+            param.wflign_max_mash_dist,
+            param.wflign_min_wavefront_length,
+            param.wflign_max_distance_threshold,
+            param.wflign_max_len_major,
+            param.wflign_max_len_minor,
+            param.wflign_erode_k,
+            param.chain_gap,
+            param.wflign_min_inv_patch_len,
+            param.wflign_max_patching_score);
+        wflign->disable_chain_patching = param.disable_chain_patching;
+        wflign->min_concurrent_probe_length = param.wflign_parallel_probe_len;
+        wflign->patch_orientation_filter = param.wflign_orientation_filter;
+    }
+    wflign->probe_executor = align_executor;
+    wflign->deadline = deadline;
+    wflign->mashmap_estimated_identity = rec->currentRecord.mashmap_estimated_identity;
+    wflign->set_output(
+        &out,
+#ifdef WFA_PNG_TSV_TIMING
+        false,
+        nullptr,
+        param.prefix_wavefront_plot_in_png,
+        param.wfplot_max_size,
+        false,
+        nullptr,
+#endif
+        true, // merge alignments
+        param.emit_md_tag,
+        !param.sam_format,
+        param.no_seq_in_sam);
+    const size_t wflign_start = out.buffer().size();
+    wflign->wflign_affine_wavefront(
+        rec->currentRecord.qId,
+        query,
+        rec->queryTotalLength,
+        rec->queryStartPos,
+        rec->queryLen,
+        rec->currentRecord.strand != skch::strnd::FWD,
+        rec->currentRecord.refId,
+        target,
+        rec->refTotalLength,
+        rec->currentRecord.rStartPos,
+        rec->currentRecord.rEndPos - rec->currentRecord.rStartPos);
+    if (param.emit_policy_tag) {
+        // WFlign mixes many WFA runs per record, so its records name the path instead of a policy
+        appendTagToRecords(out.buffer(), wflign_start, "\twp:Z:wflign");
+    }
+}
+
+// Append a tag to every record written to the buffer since start
+void appendTagToRecords(std::string& buffer, const size_t start, const std::string& tag) {
+    const std::string records = buffer.substr(start);
+    buffer.resize(start);
+    size_t begin = 0, end;
+    while ((end = records.find('\n', begin)) != std::string::npos) {
+        buffer.append(records, begin, end - begin);
+        buffer += tag;
+        buffer += '\n';
+        begin = end + 1;
+    }
+}
+
+// The input mapping as an alignment-free PAF record (first 12 columns, identity and chain tags)
+std::string approximateMappingPaf(const seq_record_t* rec) {
+    const auto tokens = tokenize_view(rec->mappingRecordLine);
+    std::string line;
+    for (size_t i = 0; i < 12 && i < tokens.size(); ++i) {
+        if (i) line += '\t';
+        line.append(tokens[i].data(), tokens[i].size());
+    }
+    line += "\tmd:f:" + std::to_string(rec->currentRecord.mashmap_estimated_identity);
+    line += approximateChainTag(rec);
+    return line;
+}
+
+// The input mapping as an unmapped SAM record placed at the target start, so that it sorts with its neighbours
+std::string approximateMappingSam(const seq_record_t* rec) {
+    std::string line = rec->currentRecord.qId;
+    line += "\t4\t" + rec->currentRecord.refId
+        + "\t" + std::to_string(rec->currentRecord.rStartPos + 1)
+        + "\t0\t*\t*\t0\t0\t*\t*";
+    line += "\tmd:f:" + std::to_string(rec->currentRecord.mashmap_estimated_identity);
+    line += approximateChainTag(rec);
+    return line;
+}
+
+// ch:Z: tag of an approximate record, empty for records that are not part of a chain
+std::string approximateChainTag(const seq_record_t* rec) {
+    if (rec->currentRecord.chain_id < 0 || rec->currentRecord.chain_length <= 0) {
+        return "";
+    }
+    return "\tch:Z:" + std::to_string(rec->currentRecord.chain_id) + "."
+        + std::to_string(rec->currentRecord.chain_length) + "."
+        + std::to_string(rec->currentRecord.chain_pos);
 }
 
-void write_sam_header(std::ofstream& outstream) {
+void write_sam_header(std::ostream& outstream) {
     // Use the FASTA metadata to get sequence names and lengths
     int num_seqs = faidx_meta_nseq(ref_meta);
     for (int i = 0; i < num_seqs; i++) {
@@ -12,32 +12,39 @@
 #include <iostream>
 #include <bitset>
 #include <chrono>
-#if defined(__APPLE__)
-  #include <sys/types.h>
-  #include <sys/sysctl.h>
-#elif defined(__linux__) || defined(__linux) || defined(linux) || defined(__gnu_linux__)
-  #include <omp.h>
-  #include <sys/sysinfo.h>
-#endif
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+#include <filesystem>
+#include <unistd.h>
 
 
 // using namespace std;
 
 namespace ales {
-  int* l;								// Seeds lengths
+  // Search state is per thread so that several random restarts can run at once;
+  // the parameters k, N, p and w are shared and set before any search starts.
+  thread_local int* l;					// Seeds lengths
   int k;                // Number of seeds
   int N;								// Length of the random region R
   double p;							// Similarity level
   int w;								// Weight
-  bool mode;							// mode decides if sensitivity (0) or estimated sensitivity (1) will be used.
-  bool bestMode = 0;					// variable used to control print statement
-  int estCount = 0;					// variable used to control print statement
-  double optimized_best = 0.0;		// holds the best sensitivity obtained in the function findOptimal()
-  int original_m = 0;					// resets the m value in adaptive length algorithm
-  int original_M = 0;					// resets the M value in adaptive length algorithm
+  thread_local bool mode;				// mode decides if sensitivity (0) or estimated sensitivity (1) will be used.
+  thread_local bool bestMode = 0;		// variable used to control print statement
+  thread_local int estCount = 0;		// variable used to control print statement
+  thread_local double optimized_best = 0.0;	// holds the best sensitivity obtained in the function findOptimal()
+  thread_local int original_m = 0;		// resets the m value in adaptive length algorithm
+  thread_local int original_M = 0;		// resets the M value in adaptive length algorithm
   bool isRegionCreated = false;		// makes sure homologous_array is created only once
+  std::mutex region_mutex;				// guards creation of the homologous array
+  std::mutex exact_mutex;				// one exact sensitivity table at a time, so restarts share totalVirtualMem
   uint32_t iterations = 1;
-  double sens = 0.0;
+  thread_local double sens = 0.0;
+  thread_local std::mt19937 rng;		// seeded per restart, all random choices of the search draw from it
+  uint32_t const max_restarts = 8;		// at most this many independent searches per seed set, one per thread
+  uint64_t const search_seed = 0x5eedA1e5;	// restart r uses search_seed + r
+  uint32_t const cache_version = 1;		// bump when the search changes so stale cache entries are ignored
 
   /*
    * Precomputed arrays:
@@ -296,8 +303,9 @@ namespace ales {
   uint128_t *homologous_array_128;			// can store upto 128 bit long random region
   uint64_t *homologous_array_64;				// can store upto 64 bit long random region
   uint32_t *homologous_array_32;				// can store upto 32 bit long random region
-  long double totalVirtualMem = 0.0;			// total memory of system - decides when to switch to estimated sensitivity
-  int homologous_array_size = 0;				// size of the homologous array to be created if necessary
+  // memory allowed for one exact sensitivity computation, beyond it the estimate is used; fixed rather than
+  // taken from the machine so that the chosen seeds do not depend on where they were generated
+  long double const totalVirtualMem = 1024.0 * 1024 * 1024;
 
   // prints an array (used for printing seeds)
   void printArray2(char** array, int length)
@@ -512,11 +520,11 @@ namespace ales {
   // used to estimate the sensitivity
   void makeHomologousRegion(double p, int N){
 
+    std::lock_guard<std::mutex> guard(region_mutex);
     if(isRegionCreated)
       return;
 
-    std::random_device rd{}; // use to seed the rng
-    std::mt19937 rng{rd()}; // rng
+    std::mt19937 rng{search_seed}; // fixed seed, the estimate must not vary between runs
     std::bernoulli_distribution distribution(p);
 
     // std::cerr<<std::endl<<"Seeds found for which Real Sensitivity cannot be computed because of Insufficient Memory"<<std::endl;
@@ -549,6 +557,7 @@ namespace ales {
         homologous_array_128[i] = rn;
       }
     }
+    isRegionCreated = true;
   }
 
   // Calculate the estimated sensitivity using homologous_array created earlier.
@@ -722,13 +731,15 @@ namespace ales {
       long double arraySize = ((NO_BS * 7 * 8.0) / (1024 * 1024 * 1024));
       double totalRam = (totalVirtualMem / (1024 * 1024 *1024) * 1.0);
 
-      if(((totalRam * 0.9) < arraySize) || ((totalRam * 0.9) < (arraySize * floor(totalRam)))){		// try to filter using less expensive operations
+      if(totalRam < arraySize){		// try to filter using less expensive operations
         makeHomologousRegion(P, N);
-        isRegionCreated = true;
         MAX_NO_BS = NO_BS = 0;
         delete[] seed_length; delete[] INT_REV_SEEDS;
         return ESTIMATE_SENSITIVITY(SEEDS, NO_SEEDS, N);
       }
+      // concurrent restarts would each hold up to totalVirtualMem; the exact tables are built one at a time
+      // instead of splitting the budget, which keeps the estimate/exact choice independent of the thread count
+      std::lock_guard<std::mutex> exact_guard(exact_mutex);
       // bound for computing sensitivity (not allocate more than 120GB)
       BS = new long long *[NO_BS];
       for (i=0; i<=NO_BS-1; i++)	{
@@ -1008,8 +1019,8 @@ namespace ales {
       count++;
       if(count == 20)
         return -1;
-      seed_no = std::rand()%NO_SEEDS;
-      pos = std::rand()%(l[seed_no]);
+      seed_no = rng()%NO_SEEDS;
+      pos = rng()%(l[seed_no]);
       if(pos != 0 && pos != l[seed_no] - 1 && l[seed_no] < N)
         flag = false;
     }
@@ -1038,8 +1049,8 @@ namespace ales {
     while(flag){
       if(count == 20)
         return -1;
-      seed_no = std::rand()%NO_SEEDS;
-      pos = std::rand()%(l[seed_no]);
+      seed_no = rng()%NO_SEEDS;
+      pos = rng()%(l[seed_no]);
       if(S[seed_no][pos] == '0')
         if(pos != 0 && pos != l[seed_no] - 1){
           flag = false;
@@ -1085,7 +1096,7 @@ namespace ales {
 
     for(int i = 1; i <= trial; i++){
       mode = 0;
-      int  choice = std::rand()%2;
+      int  choice = rng()%2;
       // copy values from SEED to tSEED
       if(i == 1){
         for(int j = 0; j < NO_SEEDS; j++){
@@ -1202,8 +1213,12 @@ namespace ales {
     int i=0, j=0, j1=0, k=0, pos=0, old_m = m, old_M = M, badMove = 0;
     double curSens = 0.0;
     double avg_m = 0.0, avg_M = 0.0;
-    //srand((unsigned )(time(0)));
     double t[2] = {0, 0};
+    // keep the best set seen, the buffers in seeds are reused by every try
+    char** origSeeds = seeds;
+    std::vector<std::string> bestSet;
+    if (bestSens > 0)
+      bestSet.assign(seeds, seeds + nSeeds);
 
     t[0] = clock()/ 1000000.0;
     for (k=0; k<tries; k++) { // try "tries" times starting with random seeds and OC them
@@ -1212,7 +1227,7 @@ namespace ales {
       badMove++;
       if(nSeeds == 1){
         for(i = 0;i < nSeeds;i++)
-          length[i] = rand()%(M-m+1) + m;
+          length[i] = rng()%(M-m+1) + m;
       }
       // adaptive seed lengths - use the mean of the seed lengths obtained after indel optimization.
       // adapth the seed length after every 50 iterations.
@@ -1253,7 +1268,7 @@ namespace ales {
         seeds[i][length[i]-1] = '1';
         seeds[i][length[i]] = '\0';
         for (j=2; j<weight; j++) {
-          pos = rand()%(length[i]-j) + 1;
+          pos = rng()%(length[i]-j) + 1;
           j1=0;
           while (pos>0) {
             if (seeds[i][j1] == '0')
@@ -1292,6 +1307,7 @@ namespace ales {
         if (curSens > bestSens) {
           badMove = 0;
           bestSens = curSens;
+          bestSet.assign(seeds, seeds + nSeeds);
           t[1] = clock()/ 1000000.0;
           // std::cerr << "\n --- random try number " << k << " --- " << std::endl;
           // std::cerr << "seeds: " << std::endl;
@@ -1317,6 +1333,8 @@ namespace ales {
     // std::cerr << std::endl << "Best sensitivity is " << bestSens << std::endl;
     // std::cerr<<std::endl;
     // std::cerr << "Computed in " << t[1]-t[0] << " seconds" << std::endl << std::endl;
+    for (i=0; i<(int)bestSet.size(); i++)
+      strcpy(origSeeds[i], bestSet[i].c_str());
     sens = bestSens;
     return bestSens;
   }
@@ -1325,32 +1343,7 @@ namespace ales {
   // This set is called ALeS-initial seed. Then the program tries to improve the seeds by computing random seeds and applying OC on them.
   void ALeS(char** S){
 
-    srand((unsigned )(time(0)));
     double t[2];
-    // calculating the total memory available in the system to prevent the code from crashing while computing sensitivity.
-    // total virtual memory of the system is total memory available - (1.5 time the size of homologous array)
-    // 1.5 times the size is used for safety
-
-    // if linux system detected
-#if defined(__linux__) || defined(__linux) || defined(linux) || defined(__gnu_linux__)
-    struct sysinfo si;
-    sysinfo (&si);
-    totalVirtualMem = (si.totalram + si.totalswap);
-    totalVirtualMem *= si.mem_unit;
-    totalVirtualMem -= 1.5 * homologous_array_size;
-    // if apple system detected
-#elif defined(__APPLE__)
-    long long memSize;
-    size_t length = sizeof(long long);
-    int mib[4] = {0,0,0,0};
-    size_t miblen = sizeof(mib)/sizeof(int);
-    sysctlnametomib("hw.memsize", mib, &miblen);
-    int iError = sysctl(mib, 2, &memSize, &length, NULL, 0);
-    if(iError != 0)
-      std::cerr<<"Error calculating memory"<<std::endl;
-    totalVirtualMem = memSize;
-    totalVirtualMem-= 1.5 * homologous_array_size;
-#endif
 
     t[0] = clock()/ 1000000.0;
     int m = 0;// min
@@ -1394,9 +1387,6 @@ namespace ales {
       // std::cerr << "The program starts computing better seeds ..."<<std::endl;
       // std::cerr << "If you reach a set of seeds with your desired sensitivity you can kill the program ... "<<std::endl;
 
-      for (int i = 0;i < k;i++) {
-        S[i] = new char[100];
-      }
       RANDOM_START_SWAP_FOR_OC_WITH_RANDOM_LENGTH(m, M, w, l, S, k, iterations, N, p, sensitivity);
     }
   }
@@ -1413,20 +1403,14 @@ namespace ales {
     std::cerr<<" <lengthOfHomologyRegion> : Length of homologous region"<<std::endl;
   }
 
-  char** ales_wrapper() {
+  // run one search, seeded so that the same restart always finds the same seeds
+  char** ales_wrapper(uint64_t restart_seed) {
+    rng.seed(restart_seed);
     double ttime[2] = {0, 0};
     ttime[0] = clock()/ 1000000.0;
 
     l = new int[k];		// seeds' lengths array
 
-    //calculating the array size in advance required for estimating sensitivity
-    if(N <= 32)
-      homologous_array_size = array_size * sizeof(uint32_t);
-    else if(N <= 64)
-      homologous_array_size = array_size * sizeof(uint64_t);
-    else
-      homologous_array_size = array_size * sizeof(uint128_t);
-
     char** S = new char* [k];   // set of seeds
     for(int i = 0;i < k;i++)
       S[i] = new char[100];
@@ -1477,20 +1461,97 @@ namespace ales {
     }
   }
 
-  spaced_seeds generate_spaced_seeds(int weight, int number_of_seeds, float similarity, int region_length) {
-    // set parameters
-    w=weight; k=number_of_seeds; p=similarity; N=region_length;
+  // default location of the seed cache: $WFMASH_ALES_CACHE, else $XDG_CACHE_HOME/wfmash, else ~/.cache/wfmash
+  std::string default_cache_dir() {
+    if (const char* dir = getenv("WFMASH_ALES_CACHE")) return dir;
+    if (const char* dir = getenv("XDG_CACHE_HOME")) return std::string(dir) + "/wfmash";
+    if (const char* dir = getenv("HOME")) return std::string(dir) + "/.cache/wfmash";
+    return "";
+  }
 
-    char** raw_spaced_seeds = ales_wrapper();
-    std::vector<spaced_seed> sp;
+  std::string cache_path(const std::string& cache_dir, int weight, int number_of_seeds, float similarity, int region_length,
+                         uint32_t restarts) {
+    char name[160];
+    snprintf(name, sizeof(name), "ales-v%u-w%d-n%d-p%.4f-l%d-r%u.seeds", cache_version, weight, number_of_seeds, similarity,
+             region_length, restarts);
+    return cache_dir + "/" + name;
+  }
 
-    for (uint32_t i=0; i<number_of_seeds; i++) {
-      char* s = raw_spaced_seeds[i];
-      sp.push_back(spaced_seed{s, strlen(s)});
+  // cache entries hold the sensitivity on the first line and one seed per line after it
+  bool read_cached_seeds(const std::string& path, int number_of_seeds, double& sensitivity, std::vector<std::string>& seeds) {
+    std::ifstream in(path);
+    if (!in || !(in >> sensitivity)) return false;
+    std::string seed;
+    while (in >> seed) seeds.push_back(seed);
+    return (int)seeds.size() == number_of_seeds;
+  }
+
+  // write through a temporary file and rename it, so concurrent jobs never read a partial entry
+  void write_cached_seeds(const std::string& path, double sensitivity, const std::vector<std::string>& seeds) {
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+    const std::string tmp = path + ".tmp." + std::to_string(getpid());
+    {
+      std::ofstream out(tmp);
+      if (!out) return;
+      out.precision(17);
+      out << sensitivity << "\n";
+      for (const auto& seed : seeds) out << seed << "\n";
+      if (!out) {
+        std::filesystem::remove(tmp, ec);
+        return;
+      }
+    }
+    std::filesystem::rename(tmp, path, ec);
+    if (ec) std::filesystem::remove(tmp, ec);
+  }
+
+  // Generate seeds with one independent search per thread, up to max_restarts, and keep the most sensitive
+  // set, so that a single thread does a single search. Restart r always uses search_seed + r, so the result
+  // is fixed for a given thread count; a higher count adds restarts and can only find a more sensitive set.
+  // Results are cached under cache_dir (no caching if empty), keyed by the number of restarts.
+  spaced_seeds generate_spaced_seeds(int weight, int number_of_seeds, float similarity, int region_length,
+                                     int threads = 1, const std::string& cache_dir = "") {
+    double best_sensitivity = -1;
+    std::vector<std::string> best_seeds;
+    const uint32_t restarts = std::min<uint32_t>(max_restarts, std::max(1, threads));
+
+    const std::string path = cache_dir.empty() ? "" : cache_path(cache_dir, weight, number_of_seeds, similarity, region_length, restarts);
+    if (path.empty() || !read_cached_seeds(path, number_of_seeds, best_sensitivity, best_seeds)) {
+      best_seeds.clear();
+      // set parameters
+      w=weight; k=number_of_seeds; p=similarity; N=region_length;
+
+      std::vector<double> restart_sensitivity(restarts, -1);
+      std::vector<std::vector<std::string>> restart_seeds(restarts);
+      auto worker = [&](uint32_t r) {
+        char** raw_spaced_seeds = ales_wrapper(search_seed + r);
+        restart_seeds[r].assign(raw_spaced_seeds, raw_spaced_seeds + number_of_seeds);
+        restart_sensitivity[r] = sens;
+      };
+      std::vector<std::thread> workers;
+      for (uint32_t r = 1; r < restarts; r++)
+        workers.emplace_back(worker, r);
+      worker(0);
+      for (auto& t : workers)
+        t.join();
+
+      for (uint32_t r = 0; r < restarts; r++) {
+        if (restart_sensitivity[r] > best_sensitivity) {
+          best_sensitivity = restart_sensitivity[r];
+          best_seeds = restart_seeds[r];
+        }
+      }
+      if (!path.empty())
+        write_cached_seeds(path, best_sensitivity, best_seeds);
+    }
+
+    std::vector<spaced_seed> sp;
+    for (const auto& seed : best_seeds) {
+      sp.push_back(spaced_seed{strdup(seed.c_str()), seed.size()});
     }
 
-    spaced_seeds k = spaced_seeds{sp, sens};
-    return k;
+    return spaced_seeds{sp, best_sensitivity};
   }
 }
 #endif
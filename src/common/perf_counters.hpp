@@ -0,0 +1,285 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*
+ * Optional hardware counters per pipeline stage, read with Linux perf_event_open.
+ * Each thread opens its own counter group (cycles, instructions, LLC misses, branch misses,
+ * dTLB misses) on the first scope it enters. A Scope charges the counts since the last scope
+ * boundary of its thread to the stage that was running, so nested scopes are exclusive: an
+ * output scope inside a WFA scope takes its share out of the WFA counts.
+ *
+ * Counting is off unless enable() is called, which also writes the totals at exit. When the kernel refuses the counters (e.g. in
+ * containers, or with perf_event_paranoid > 2) a warning is printed once and that thread only collects
+ * timings. Availability is tracked per event: an event no thread could open is reported as NA, and the
+ * report falls back to timings only when no thread could count at all.
+ *
+ * Serial sections (single-threaded steps between parallel ones) are timed separately with
+ * serial() and reported as extra rows after the stages, with timings only.
+ */
+
+namespace perf_counters {
+
+enum Stage { sketching, l1, l2, filtering, wfa, patching, output, num_stages };
+inline const char* const stage_names[num_stages] = {
+    "sketching", "l1", "l2", "filtering", "wfa", "patching", "output"};
+
+enum Event { cycles, instructions, llc_misses, branch_misses, dtlb_misses, num_events };
+inline const char* const event_names[num_events] = {
+    "cycles", "instructions", "llc_misses", "branch_misses", "dtlb_misses"};
+
+enum Serial { index_merge, one_to_one_filter, sorted_output, num_serial };
+inline const char* const serial_names[num_serial] = {
+    "serial_index_merge", "serial_one_to_one_filter", "serial_sorted_output"};
+
+inline std::atomic<bool> enabled{false};
+inline std::atomic<bool> warned_unavailable{false};
+inline std::atomic<uint64_t> counting_threads{0};            // threads with a working counter group
+inline std::atomic<uint64_t> timing_threads{0};              // threads that could not count, timings only
+inline std::atomic<uint64_t> event_threads[num_events] = {}; // threads that could open each event
+
+// Totals per stage across threads; an event only adds up over the threads that could open it
+struct StageTotals {
+    std::atomic<uint64_t> scopes{0};
+    std::atomic<uint64_t> nanoseconds{0};
+    std::atomic<uint64_t> events[num_events] = {};
+};
+inline StageTotals totals[num_stages];
+inline StageTotals serial_totals[num_serial];
+
+// Charge the wall-clock time of a serial section; nothing is kept unless counting is enabled
+inline void serial(Serial section, std::chrono::nanoseconds elapsed) {
+    if (!enabled.load(std::memory_order_relaxed)) {
+        return;
+    }
+    serial_totals[section].scopes.fetch_add(1, std::memory_order_relaxed);
+    serial_totals[section].nanoseconds.fetch_add(elapsed.count(), std::memory_order_relaxed);
+}
+
+// The counter group of the calling thread
+class ThreadCounters {
+public:
+    ThreadCounters() {
+        static const std::pair<uint32_t, uint64_t> configs[num_events] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL
+                | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+            {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB
+                | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+        };
+        for (int e = 0; e < num_events; ++e) {
+            struct perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = configs[e].first;
+            attr.config = configs[e].second;
+            attr.disabled = leader < 0 ? 1 : 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            const int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+            if (fd < 0) {
+                if (leader < 0) {
+                    // Without cycles there is no group to join: this thread reports timings only
+                    timing_threads.fetch_add(1, std::memory_order_relaxed);
+                    warnUnavailable(errno);
+                    return;
+                }
+                continue; // this event is not supported here, count the others
+            }
+            if (leader < 0) {
+                leader = fd;
+            }
+            fds[count] = fd;
+            events[count++] = (Event)e;
+            event_threads[e].fetch_add(1, std::memory_order_relaxed);
+        }
+        counting_threads.fetch_add(1, std::memory_order_relaxed);
+        ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+
+    ~ThreadCounters() {
+        for (int i = 0; i < count; ++i) {
+            close(fds[i]);
+        }
+    }
+
+    bool ok() const { return leader >= 0; }
+
+    // Current counts, scaled up when the group was multiplexed with other users of the PMU
+    bool read(uint64_t* values) {
+        uint64_t buffer[3 + num_events];
+        if (::read(leader, buffer, sizeof(buffer)) < (ssize_t)((3 + count) * sizeof(uint64_t))) {
+            return false;
+        }
+        const uint64_t enabled_ns = buffer[1];
+        const uint64_t running_ns = buffer[2];
+        for (int e = 0; e < num_events; ++e) {
+            values[e] = 0;
+        }
+        for (int i = 0; i < count; ++i) {
+            const uint64_t raw = buffer[3 + i];
+            values[events[i]] = running_ns > 0 && running_ns < enabled_ns
+                ? (uint64_t)((double)raw * enabled_ns / running_ns) : raw;
+        }
+        return true;
+    }
+
+private:
+    int leader = -1;
+    int count = 0;
+    int fds[num_events];
+    Event events[num_events];
+
+    static void warnUnavailable(int error) {
+        if (!warned_unavailable.exchange(true)) {
+            std::cerr << "[wfmash] Warning: hardware counters unavailable (perf_event_open: " << std::strerror(error)
+                      << "), threads without counters report timings only; check /proc/sys/kernel/perf_event_paranoid" << std::endl;
+        }
+    }
+};
+
+// Per-thread attribution state: the running stage and the counts at its last boundary
+struct ThreadState {
+    ThreadCounters counters;
+    int stage = -1;
+    uint64_t last[num_events] = {};
+    std::chrono::steady_clock::time_point last_time = std::chrono::steady_clock::now();
+
+    // Charge everything since the last boundary to the running stage
+    void charge() {
+        uint64_t now[num_events] = {};
+        const bool counted = counters.ok() && counters.read(now);
+        const auto now_time = std::chrono::steady_clock::now();
+        if (stage >= 0) {
+            StageTotals& t = totals[stage];
+            t.nanoseconds.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(now_time - last_time).count(),
+                                    std::memory_order_relaxed);
+            if (counted) {
+                for (int e = 0; e < num_events; ++e) {
+                    t.events[e].fetch_add(now[e] - last[e], std::memory_order_relaxed);
+                }
+            }
+        }
+        if (counted) {
+            std::copy(now, now + num_events, last);
+        }
+        last_time = now_time;
+    }
+};
+
+inline ThreadState& threadState() {
+    thread_local ThreadState state;
+    return state;
+}
+
+// Attributes the enclosed work of the calling thread to a stage
+class Scope {
+public:
+    explicit Scope(Stage stage) {
+        if (!enabled.load(std::memory_order_relaxed)) {
+            return;
+        }
+        ThreadState& state = threadState();
+        state.charge();
+        previous = state.stage;
+        state.stage = stage;
+        active = true;
+        totals[stage].scopes.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    ~Scope() {
+        if (!active) {
+            return;
+        }
+        ThreadState& state = threadState();
+        state.charge();
+        state.stage = previous;
+    }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+private:
+    bool active = false;
+    int previous = -1;
+};
+
+// Write the totals as a TSV table, one line per stage that was entered
+inline void report(const std::string& path) {
+    std::ofstream out(path);
+    if (!out.is_open()) {
+        std::cerr << "[wfmash] ERROR: cannot write the hardware counters to " << path << std::endl;
+        return;
+    }
+    const bool counted = counting_threads.load() > 0;
+    bool event_counted[num_events];
+    for (int e = 0; e < num_events; ++e) {
+        event_counted[e] = event_threads[e].load() > 0;
+    }
+    out << "stage\tscopes\tseconds";
+    for (int e = 0; e < num_events; ++e) {
+        out << '\t' << event_names[e];
+    }
+    out << "\tipc\n";
+    for (int s = 0; s < num_stages; ++s) {
+        const StageTotals& t = totals[s];
+        if (t.scopes.load() == 0) {
+            continue;
+        }
+        out << stage_names[s] << '\t' << t.scopes.load() << '\t' << t.nanoseconds.load() / 1e9;
+        for (int e = 0; e < num_events; ++e) {
+            out << '\t';
+            if (event_counted[e]) out << t.events[e].load(); else out << "NA";
+        }
+        const uint64_t c = t.events[cycles].load();
+        out << '\t';
+        if (event_counted[cycles] && event_counted[instructions] && c > 0) out << (double)t.events[instructions].load() / c; else out << "NA";
+        out << '\n';
+    }
+    for (int s = 0; s < num_serial; ++s) {
+        const StageTotals& t = serial_totals[s];
+        if (t.scopes.load() == 0) {
+            continue;
+        }
+        out << serial_names[s] << '\t' << t.scopes.load() << '\t' << t.nanoseconds.load() / 1e9;
+        for (int e = 0; e <= num_events; ++e) {
+            out << "\tNA";
+        }
+        out << '\n';
+    }
+    std::cerr << "[wfmash] " << (counted ? "hardware counters and timings" : "timings")
+              << " per stage written to " << path << std::endl;
+    if (counted && timing_threads.load() > 0) {
+        std::cerr << "[wfmash] Warning: hardware counters cover " << counting_threads.load() << " of "
+                  << counting_threads.load() + timing_threads.load() << " threads" << std::endl;
+    }
+}
+
+inline std::string report_path;
+
+// Start attributing work to stages and write the totals to path when the program exits
+inline void enable(const std::string& path) {
+    report_path = path;
+    enabled.store(true, std::memory_order_relaxed);
+    std::atexit([]() { report(report_path); });
+}
+
+} // namespace perf_counters
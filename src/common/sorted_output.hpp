@@ -0,0 +1,514 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <unistd.h>
+#include <vector>
+#include "taskflow/taskflow.hpp"
+#include "taskflow/algorithm/for_each.hpp"
+
+/*
+ * Target-sorted PAF/SAM output with bounded memory.
+ * Records are buffered until half of the memory limit is reached, then the buffer is sorted by
+ * (target rank, target start, target end, line) and spilled as a run to a temporary file.
+ * One run is spilled at a time and adders wait while it is written and the next buffer is full,
+ * so the buffer and the run in flight together stay within the limit (plus the batches being added).
+ * Runs store each record's key in front of its line, so merging never parses records again.
+ * Writing k-way merges the runs and the last buffer, either into one stream or into one
+ * shard per target, shards being merged in parallel since each run is contiguous by target.
+ * Each run being merged holds an open file, so runs are first merged in passes of at most
+ * merge_fanin (shared among the shard threads) to stay well below the open file limit.
+ * A run that cannot be opened or read back in full is a fatal error, never a short output.
+ *
+ * The optional coordinate index is a TSV with two kinds of lines:
+ *   T  file  target  first_offset  end_offset  records
+ *   W  file  target  window_start  offset
+ * where W gives, for each 16 kbp window of the target, the byte offset of the first record
+ * overlapping it (as the linear index of BAI), and file is "-" for the main stream.
+ */
+namespace sorted_output {
+
+enum class format_t { PAF, SAM };
+
+static constexpr int index_window_shift = 14;
+
+struct entry_t {
+    uint32_t rank;
+    uint64_t start;
+    uint64_t end;
+    std::string line;                       // without the newline
+
+    bool operator<(const entry_t& o) const {
+        if (rank != o.rank) return rank < o.rank;
+        if (start != o.start) return start < o.start;
+        if (end != o.end) return end < o.end;
+        return line < o.line;
+    }
+};
+
+// Key and length in front of each record of a run
+static constexpr uint64_t run_record_header_bytes = sizeof(uint32_t) + 3 * sizeof(uint64_t);
+
+// Byte offsets of each target's records in a sorted run
+struct run_t {
+    std::string path;
+    std::map<uint32_t, std::pair<uint64_t, uint64_t>> ranges;
+};
+
+// Reference length of a SAM CIGAR
+inline uint64_t cigar_ref_length(const char* cigar, const char* end) {
+    uint64_t len = 0, n = 0;
+    for (const char* c = cigar; c < end; ++c) {
+        if (*c >= '0' && *c <= '9') {
+            n = n * 10 + (*c - '0');
+        } else {
+            if (*c == 'M' || *c == 'D' || *c == 'N' || *c == '=' || *c == 'X') len += n;
+            n = 0;
+        }
+    }
+    return len;
+}
+
+// Accumulates the coordinate index of one output file while it is written
+class index_builder_t {
+public:
+    explicit index_builder_t(const std::string& file) : file(file) {}
+
+    void add(const std::string& target, const entry_t& e, uint64_t offset, uint64_t bytes) {
+        if (target != current) {
+            flush();
+            current = target;
+            first_offset = offset;
+            records = 0;
+            windows.clear();
+            max_window = -1;
+        }
+        end_offset = offset + bytes;
+        ++records;
+        // Sorted by start, so windows up to max_window are already set by earlier (smaller) offsets
+        const int64_t w_begin = std::max<int64_t>(e.start >> index_window_shift, max_window + 1);
+        const int64_t w_end = (std::max(e.end, e.start + 1) - 1) >> index_window_shift;
+        for (int64_t w = w_begin; w <= w_end; ++w) {
+            windows.emplace_back(w, offset);
+        }
+        max_window = std::max(max_window, w_end);
+    }
+
+    void flush() {
+        if (current.empty()) return;
+        text += "T\t" + file + "\t" + current + "\t" + std::to_string(first_offset) + "\t"
+            + std::to_string(end_offset) + "\t" + std::to_string(records) + "\n";
+        for (const auto& w : windows) {
+            text += "W\t" + file + "\t" + current + "\t" + std::to_string(w.first << index_window_shift)
+                + "\t" + std::to_string(w.second) + "\n";
+        }
+        current.clear();
+    }
+
+    std::string text;
+
+private:
+    std::string file;
+    std::string current;
+    uint64_t first_offset = 0, end_offset = 0, records = 0;
+    int64_t max_window = -1;
+    std::vector<std::pair<int64_t, uint64_t>> windows;
+};
+
+class TargetSortedWriter {
+public:
+    /**
+     * @param format        PAF or SAM, to locate the target fields
+     * @param target_names  target order of the output, e.g. the order of the @SQ lines
+     * @param memory_limit  bytes of records buffered, including the run being spilled
+     * @param temp_prefix   path prefix of the spilled runs
+     * @param merge_fanin   most runs open at once while merging
+     */
+    TargetSortedWriter(format_t format,
+                       const std::vector<std::string>& target_names,
+                       uint64_t memory_limit,
+                       const std::string& temp_prefix,
+                       size_t merge_fanin = 256)
+        : format(format), names(target_names), memory_limit(memory_limit), temp_prefix(temp_prefix),
+          merge_fanin(std::max<size_t>(2, merge_fanin)) {
+        for (uint32_t i = 0; i < names.size(); ++i) {
+            ranks[names[i]] = i;
+        }
+    }
+
+    ~TargetSortedWriter() {
+        for (const auto& run : runs) {
+            std::remove(run.path.c_str());
+        }
+    }
+
+    // Add one or more complete newline-terminated records; thread-safe
+    void add(const std::string& text) {
+        std::vector<entry_t> parsed;
+        uint64_t parsed_bytes = 0;
+        size_t pos = 0;
+        while (pos < text.size()) {
+            size_t eol = text.find('\n', pos);
+            if (eol == std::string::npos) eol = text.size();
+            if (eol > pos) {
+                parsed.emplace_back();
+                parsed.back().line.assign(text, pos, eol - pos);
+                parsed_bytes += eol - pos + sizeof(entry_t);
+            }
+            pos = eol + 1;
+        }
+
+        std::vector<entry_t> spill;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            // Backpressure: a full buffer waits for the run in flight before taking more records
+            spill_done.wait(lock, [this]() { return !spilling || buffer_bytes < spill_bytes(); });
+            for (auto& e : parsed) {
+                set_key(e);
+                buffer.push_back(std::move(e));
+            }
+            buffer_bytes += parsed_bytes;
+            if (buffer_bytes >= spill_bytes() && !spilling) {
+                spill.swap(buffer);
+                buffer_bytes = 0;
+                spilling = true;
+            }
+        }
+        // Sort and write the run outside of the lock so that other threads keep adding
+        if (!spill.empty()) {
+            run_t run = write_run(spill);
+            spill = std::vector<entry_t>();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                runs.push_back(std::move(run));
+                spilling = false;
+            }
+            spill_done.notify_all();
+        }
+    }
+
+    // Merge everything into out, after the header
+    void write(std::ostream& out, const std::string& header, std::ostream* index) {
+        std::sort(buffer.begin(), buffer.end());
+        reduce_runs(merge_fanin);
+        index_builder_t builder("-");
+        uint64_t offset = header.size();
+        out << header;
+        merge(all_ranks(), [&](const entry_t& e) {
+            out << e.line << '\n';
+            if (index) builder.add(names[e.rank], e, offset, e.line.size() + 1);
+            offset += e.line.size() + 1;
+        });
+        if (index) {
+            builder.flush();
+            *index << builder.text;
+        }
+    }
+
+    // Write one file per target, PREFIX.<target>.<paf|sam>, merging targets in parallel
+    void write_shards(const std::string& prefix, const std::string& header, int threads, std::ostream* index) {
+        std::sort(buffer.begin(), buffer.end());
+        std::vector<uint32_t> targets;
+        for (uint32_t r : all_ranks()) targets.push_back(r);
+
+        // Every shard thread merges its own cursors over the runs
+        threads = std::max(1, std::min<int>(threads, targets.size()));
+        reduce_runs(merge_fanin / threads);
+
+        std::vector<std::string> index_texts(targets.size());
+        tf::Executor executor(threads);
+        tf::Taskflow taskflow;
+        taskflow.for_each_index(size_t(0), targets.size(), size_t(1), [&](size_t i) {
+            const uint32_t rank = targets[i];
+            std::string name = names[rank] == "*" ? "unmapped" : names[rank];
+            std::replace(name.begin(), name.end(), '/', '_');
+            const std::string path = prefix + "." + name + (format == format_t::SAM ? ".sam" : ".paf");
+            std::ofstream out(path);
+            if (!out) {
+                std::cerr << "[wfmash] ERROR: unable to open output shard " << path << std::endl;
+                exit(1);
+            }
+            index_builder_t builder(path);
+            uint64_t offset = header.size();
+            out << header;
+            merge({rank}, [&](const entry_t& e) {
+                out << e.line << '\n';
+                if (index) builder.add(names[e.rank], e, offset, e.line.size() + 1);
+                offset += e.line.size() + 1;
+            });
+            builder.flush();
+            index_texts[i] = std::move(builder.text);
+        });
+        executor.run(taskflow).wait();
+        if (index) {
+            for (const auto& text : index_texts) *index << text;
+        }
+    }
+
+    size_t run_count() const { return runs.size(); }
+
+private:
+    format_t format;
+    std::vector<std::string> names;
+    std::unordered_map<std::string, uint32_t> ranks;
+    uint64_t memory_limit;
+    std::string temp_prefix;
+    size_t merge_fanin;
+
+    std::mutex mutex;
+    std::condition_variable spill_done;
+    bool spilling = false;                  // a run is being written
+    std::vector<entry_t> buffer;
+    uint64_t buffer_bytes = 0;
+    std::vector<run_t> runs;
+
+    // Half of the limit is buffered while the other half may be in flight as a run
+    uint64_t spill_bytes() const { return std::max<uint64_t>(1, memory_limit / 2); }
+
+    // Find the target fields of a record; called with the lock held, as unseen target names are ranked
+    void set_key(entry_t& e) {
+        const char* fields[9] = {nullptr};
+        const char* p = e.line.c_str();
+        const int wanted = format == format_t::SAM ? 6 : 9;
+        fields[0] = p;
+        for (int f = 1; f < wanted && *p; ++p) {
+            if (*p == '\t') fields[f++] = p + 1;
+        }
+        if (format == format_t::SAM) {
+            // RNAME, POS (1-based) and CIGAR; unmapped records go to target "*"
+            if (!fields[5]) { e.rank = rank_of("*"); e.start = e.end = 0; return; }
+            e.rank = rank_of(std::string(fields[2], fields[3] - 1));
+            e.start = std::max<int64_t>(0, std::strtoll(fields[3], nullptr, 10) - 1);
+            const char* cigar_end = std::strchr(fields[5], '\t');
+            e.end = e.start + cigar_ref_length(fields[5], cigar_end ? cigar_end : fields[5] + std::strlen(fields[5]));
+        } else {
+            if (!fields[8]) { e.rank = rank_of("*"); e.start = e.end = 0; return; }
+            e.rank = rank_of(std::string(fields[5], fields[6] - 1));
+            e.start = std::strtoull(fields[7], nullptr, 10);
+            e.end = std::strtoull(fields[8], nullptr, 10);
+        }
+    }
+
+    uint32_t rank_of(const std::string& target) {
+        auto it = ranks.find(target);
+        if (it != ranks.end()) return it->second;
+        // Targets missing from the given order follow it, in order of appearance
+        const uint32_t rank = names.size();
+        names.push_back(target);
+        ranks[target] = rank;
+        return rank;
+    }
+
+    run_t create_run() const {
+        run_t run;
+        run.path = temp_prefix + "XXXXXX";
+        int fd = mkstemp(&run.path[0]);
+        if (fd == -1) {
+            std::cerr << "[wfmash] ERROR: unable to create sort run " << run.path << std::endl;
+            exit(1);
+        }
+        close(fd);
+        return run;
+    }
+
+    // Append one record to a run being written, offset being the run's size so far
+    static void write_record(std::ofstream& out, run_t& run, const entry_t& e, uint64_t& offset) {
+        auto& range = run.ranges[e.rank];
+        if (range.second == 0) range.first = offset;
+        const uint64_t length = e.line.size();
+        out.write(reinterpret_cast<const char*>(&e.rank), sizeof(e.rank));
+        out.write(reinterpret_cast<const char*>(&e.start), sizeof(e.start));
+        out.write(reinterpret_cast<const char*>(&e.end), sizeof(e.end));
+        out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+        out.write(e.line.data(), length);
+        offset += run_record_header_bytes + length;
+        range.second = offset;
+    }
+
+    static void finish_run(std::ofstream& out, const run_t& run) {
+        out.close();
+        if (!out) {
+            std::cerr << "[wfmash] ERROR: failed to write sort run " << run.path << std::endl;
+            exit(1);
+        }
+    }
+
+    run_t write_run(std::vector<entry_t>& entries) {
+        std::sort(entries.begin(), entries.end());
+        run_t run = create_run();
+        std::ofstream out(run.path, std::ios::binary);
+        uint64_t offset = 0;
+        for (const auto& e : entries) {
+            write_record(out, run, e, offset);
+        }
+        finish_run(out, run);
+        return run;
+    }
+
+    // Merge groups of runs into longer ones until at most fanin runs are left
+    void reduce_runs(size_t fanin) {
+        fanin = std::max<size_t>(2, fanin);
+        while (runs.size() > fanin) {
+            std::vector<run_t> reduced;
+            for (size_t first = 0; first < runs.size(); first += fanin) {
+                const size_t last = std::min(runs.size(), first + fanin);
+                if (last - first == 1) {
+                    reduced.push_back(std::move(runs[first]));
+                    continue;
+                }
+                std::vector<const run_t*> group;
+                std::vector<uint32_t> targets;
+                for (size_t i = first; i < last; ++i) {
+                    group.push_back(&runs[i]);
+                    for (const auto& range : runs[i].ranges) targets.push_back(range.first);
+                }
+                std::sort(targets.begin(), targets.end());
+                targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+
+                run_t run = create_run();
+                std::ofstream out(run.path, std::ios::binary);
+                uint64_t offset = 0;
+                merge(group, nullptr, targets, [&](const entry_t& e) { write_record(out, run, e, offset); });
+                finish_run(out, run);
+                for (size_t i = first; i < last; ++i) {
+                    std::remove(runs[i].path.c_str());
+                }
+                reduced.push_back(std::move(run));
+            }
+            runs.swap(reduced);
+        }
+    }
+
+    std::vector<uint32_t> all_ranks() const {
+        std::vector<uint32_t> r;
+        for (const auto& e : buffer) {
+            if (r.empty() || r.back() != e.rank) r.push_back(e.rank);
+        }
+        for (const auto& run : runs) {
+            for (const auto& range : run.ranges) r.push_back(range.first);
+        }
+        std::sort(r.begin(), r.end());
+        r.erase(std::unique(r.begin(), r.end()), r.end());
+        return r;
+    }
+
+    // One sorted input of the merge: a run file or the in-memory buffer, restricted to some targets
+    struct cursor_t {
+        std::string path;
+        std::ifstream in;
+        std::vector<std::pair<uint64_t, uint64_t>> ranges;   // file byte ranges still to read
+        const std::vector<entry_t>* memory = nullptr;
+        size_t next_index = 0, end_index = 0;
+    };
+
+    bool advance(cursor_t& c, entry_t& e) {
+        if (c.memory) {
+            if (c.next_index >= c.end_index) return false;
+            e = (*c.memory)[c.next_index++];
+            return true;
+        }
+        while (!c.ranges.empty() && c.ranges.front().first >= c.ranges.front().second) {
+            c.ranges.erase(c.ranges.begin());
+            if (!c.ranges.empty()) seek(c);
+        }
+        if (c.ranges.empty()) return false;
+        // The key was stored with the record, so merging threads share no state.
+        // The ranges say how much is left, so any short read is a damaged run
+        uint64_t length = 0;
+        c.in.read(reinterpret_cast<char*>(&e.rank), sizeof(e.rank));
+        c.in.read(reinterpret_cast<char*>(&e.start), sizeof(e.start));
+        c.in.read(reinterpret_cast<char*>(&e.end), sizeof(e.end));
+        c.in.read(reinterpret_cast<char*>(&length), sizeof(length));
+        if (c.in && c.ranges.front().first + run_record_header_bytes + length <= c.ranges.front().second) {
+            e.line.resize(length);
+            c.in.read(&e.line[0], length);
+        }
+        if (!c.in || c.ranges.front().first + run_record_header_bytes + length > c.ranges.front().second) {
+            std::cerr << "[wfmash] ERROR: sort run " << c.path << " is truncated at byte "
+                      << c.ranges.front().first << std::endl;
+            exit(1);
+        }
+        c.ranges.front().first += run_record_header_bytes + length;
+        return true;
+    }
+
+    static void seek(cursor_t& c) {
+        c.in.seekg(c.ranges.front().first);
+        if (!c.in) {
+            std::cerr << "[wfmash] ERROR: unable to seek to byte " << c.ranges.front().first
+                      << " of sort run " << c.path << std::endl;
+            exit(1);
+        }
+    }
+
+    // K-way merge of all runs and the sorted buffer over the given ranks, in order
+    void merge(const std::vector<uint32_t>& targets, const std::function<void(const entry_t&)>& emit) {
+        std::vector<const run_t*> inputs;
+        for (const auto& run : runs) inputs.push_back(&run);
+        merge(inputs, &buffer, targets, emit);
+    }
+
+    // K-way merge of some runs and optionally a sorted in-memory buffer over the given ranks, in order
+    void merge(const std::vector<const run_t*>& inputs,
+               const std::vector<entry_t>* memory,
+               const std::vector<uint32_t>& targets,
+               const std::function<void(const entry_t&)>& emit) {
+        if (targets.empty()) return;
+        std::vector<std::unique_ptr<cursor_t>> cursors;
+        for (const run_t* run : inputs) {
+            auto c = std::make_unique<cursor_t>();
+            for (uint32_t t : targets) {
+                auto it = run->ranges.find(t);
+                if (it != run->ranges.end()) c->ranges.push_back(it->second);
+            }
+            if (c->ranges.empty()) continue;
+            c->path = run->path;
+            c->in.open(run->path, std::ios::binary);
+            if (!c->in) {
+                std::cerr << "[wfmash] ERROR: unable to open sort run " << run->path << std::endl;
+                exit(1);
+            }
+            seek(*c);
+            cursors.push_back(std::move(c));
+        }
+        if (memory) {
+            auto c = std::make_unique<cursor_t>();
+            c->memory = memory;
+            auto lo = std::lower_bound(memory->begin(), memory->end(), targets.front(),
+                                       [](const entry_t& e, uint32_t r) { return e.rank < r; });
+            auto hi = std::upper_bound(memory->begin(), memory->end(), targets.back(),
+                                       [](uint32_t r, const entry_t& e) { return r < e.rank; });
+            c->next_index = lo - memory->begin();
+            c->end_index = hi - memory->begin();
+            cursors.push_back(std::move(c));
+        }
+
+        using item_t = std::pair<entry_t, size_t>;
+        auto greater = [](const item_t& a, const item_t& b) { return b.first < a.first; };
+        std::priority_queue<item_t, std::vector<item_t>, decltype(greater)> heap(greater);
+        for (size_t i = 0; i < cursors.size(); ++i) {
+            entry_t e;
+            if (advance(*cursors[i], e)) heap.emplace(std::move(e), i);
+        }
+        while (!heap.empty()) {
+            item_t top = heap.top();
+            heap.pop();
+            emit(top.first);
+            if (advance(*cursors[top.second], top.first)) heap.emplace(std::move(top.first), top.second);
+        }
+    }
+};
+
+}
@@ -3,6 +3,11 @@
 //
 
 #include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <sched.h>
+#include <unistd.h>
 #include "utils.hpp"
 
 namespace wfmash {
@@ -25,7 +30,121 @@ namespace wfmash {
         }
 
         const std::string tmp = value.substr(0, str_len);
-        return is_a_number(tmp) ? (int)(stof(tmp) * pow(10, exp)) : -1;
+        return is_a_number(tmp) ? (int64_t)(stod(tmp) * pow(10, exp)) : -1;
     }
 
+    // Directories to look for the controller files of this process: its own cgroup, then the mount root
+    static std::vector<std::string> cgroup_dirs(const std::string& controller) {
+        std::vector<std::string> dirs;
+        std::ifstream in("/proc/self/cgroup");
+        std::string line;
+        while (std::getline(in, line)) {
+            // hierarchy-ID:controller-list:path
+            const size_t first = line.find(':');
+            const size_t second = line.find(':', first + 1);
+            if (first == std::string::npos || second == std::string::npos) continue;
+            const std::string controllers = line.substr(first + 1, second - first - 1);
+            const std::string path = line.substr(second + 1);
+            if (controller.empty() ? controllers.empty() : ("," + controllers + ",").find("," + controller + ",") != std::string::npos) {
+                const std::string mount = controller.empty() ? "/sys/fs/cgroup" : "/sys/fs/cgroup/" + controllers;
+                dirs.push_back(mount + path);
+                dirs.push_back(mount);
+                if (controller.empty()) {
+                    // Hybrid hierarchies mount v2 next to the v1 controllers
+                    dirs.push_back("/sys/fs/cgroup/unified" + path);
+                } else {
+                    dirs.push_back("/sys/fs/cgroup/" + controller + path);
+                    dirs.push_back("/sys/fs/cgroup/" + controller);
+                }
+            }
+        }
+        return dirs;
+    }
+
+    static bool read_first_line(const std::string& file, std::string& line) {
+        std::ifstream in(file);
+        return in && std::getline(in, line) && !line.empty();
+    }
+
+    resource_limits_t detect_resource_limits() {
+        resource_limits_t limits;
+
+        // CPUs: the affinity mask already reflects cpusets, sysconf is the last resort
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0) {
+            limits.cpus = CPU_COUNT(&set);
+            limits.cpus_source = "affinity";
+        } else {
+            limits.cpus = std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+            limits.cpus_source = "sysconf";
+        }
+        // A CFS quota can only lower that, rounded up to whole CPUs
+        auto apply_quota = [&](const double quota, const double period, const char* source) {
+            if (quota > 0 && period > 0) {
+                const int cpus = std::max(1, (int)std::ceil(quota / period));
+                if (cpus < limits.cpus) {
+                    limits.cpus = cpus;
+                    limits.cpus_source = source;
+                }
+                return true;
+            }
+            return false;
+        };
+        bool found_quota = false;
+        for (const auto& dir : cgroup_dirs("")) {
+            std::string line;
+            if (read_first_line(dir + "/cpu.max", line)) {
+                // "max 100000" or "<quota> <period>"
+                std::istringstream fields(line);
+                std::string quota;
+                double period = 0;
+                fields >> quota >> period;
+                found_quota = quota == "max" || apply_quota(is_a_number(quota) ? std::stod(quota) : 0, period, "cgroup-v2");
+                if (found_quota) break;
+            }
+        }
+        for (const auto& dir : found_quota ? std::vector<std::string>() : cgroup_dirs("cpu")) {
+            std::string quota, period;
+            if (read_first_line(dir + "/cpu.cfs_quota_us", quota) && read_first_line(dir + "/cpu.cfs_period_us", period)) {
+                // A quota of -1 means no limit
+                if (quota != "-1" && is_a_number(quota) && is_a_number(period)) {
+                    apply_quota(std::stod(quota), std::stod(period), "cgroup-v1");
+                }
+                break;
+            }
+        }
+
+        // Memory: physical memory, lowered by the cgroup limit if there is one
+        limits.memory = (uint64_t)sysconf(_SC_PHYS_PAGES) * (uint64_t)sysconf(_SC_PAGE_SIZE);
+        limits.memory_source = "sysconf";
+        auto apply_limit = [&](const std::string& value, const char* source) {
+            // v2 reports "max" and v1 a huge page-rounded number when there is no limit
+            if (!value.empty() && value.find_first_not_of("0123456789") == std::string::npos) {
+                const uint64_t bytes = std::stoull(value);
+                if (bytes > 0 && bytes < limits.memory) {
+                    limits.memory = bytes;
+                    limits.memory_source = source;
+                }
+            }
+        };
+        bool found_limit = false;
+        for (const auto& dir : cgroup_dirs("")) {
+            std::string line;
+            if (read_first_line(dir + "/memory.max", line)) {
+                apply_limit(line, "cgroup-v2");
+                found_limit = true;
+                break;
+            }
+        }
+        for (const auto& dir : found_limit ? std::vector<std::string>() : cgroup_dirs("memory")) {
+            std::string line;
+            if (read_first_line(dir + "/memory.limit_in_bytes", line)) {
+                apply_limit(line, "cgroup-v1");
+                break;
+            }
+        }
+
+        return limits;
+    }
 }
@@ -8,4 +8,16 @@ namespace wfmash {
     bool is_a_number(const std::string& s);
 
     int64_t handy_parameter(const std::string& value);
+
+    // CPUs and memory this process may use, and where each limit came from
+    struct resource_limits_t {
+        int cpus;
+        std::string cpus_source;    // cgroup-v2, cgroup-v1, affinity or sysconf
+        uint64_t memory;            // bytes
+        std::string memory_source;  // cgroup-v2, cgroup-v1 or sysconf
+    };
+
+    // Read the cgroup v2/v1 CPU quota and memory limit of this process, falling back to
+    // the CPU affinity mask and sysconf when no limit is set
+    resource_limits_t detect_resource_limits();
 }
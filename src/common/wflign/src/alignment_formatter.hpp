@@ -0,0 +1,136 @@
+#ifndef ALIGNMENT_FORMATTER_HPP_
+#define ALIGNMENT_FORMATTER_HPP_
+
+#include <charconv>
+#include <cstdint>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "dna.hpp"
+
+/*
+ * Buffer-based formatting of the per-base parts of alignment records (MD tag, SAM SEQ).
+ * Everything appends to a caller-owned std::string so that a buffer can be reused across
+ * records by the same thread, avoiding per-character std::ostream insertions.
+ */
+namespace wflign {
+namespace wavefront {
+
+// A run of identical CIGAR operations
+struct cigar_run_t {
+    uint32_t len;
+    char op;
+};
+
+// Append the decimal representation of v
+inline void append_uint(std::string& buf, const uint64_t v) {
+    char tmp[20];
+    const auto res = std::to_chars(tmp, tmp + sizeof(tmp), v);
+    buf.append(tmp, res.ptr - tmp);
+}
+
+// Parse the compressed CIGAR in [start, end) into runs, merging adjacent runs of the same operation
+inline void cigar_to_runs(const char* cigar, const int start, const int end, std::vector<cigar_run_t>& runs) {
+    runs.clear();
+    int x = start;
+    while (x < end) {
+        uint32_t len = 0;
+        while (x < end && cigar[x] >= '0' && cigar[x] <= '9') {
+            len = len * 10 + (cigar[x] - '0');
+            ++x;
+        }
+        if (x == end) break;
+        const char op = cigar[x++];
+        if (!runs.empty() && runs.back().op == op) {
+            runs.back().len += len;
+        } else {
+            runs.push_back({len, op});
+        }
+    }
+}
+
+// Append "MD:Z:<md>" for the compressed CIGAR in [cigar_start, cigar_end); target is read from target_start
+inline void append_md_tag(
+    std::string& buf,
+    const char* cigar,
+    const int cigar_start,
+    const int cigar_end,
+    const int64_t target_start,
+    const char* target) {
+    thread_local std::vector<cigar_run_t> runs;
+    cigar_to_runs(cigar, cigar_start, cigar_end, runs);
+
+    buf.append("MD:Z:");
+    if (runs.empty()) return;
+
+    int64_t t_off = target_start;
+    uint64_t l_MD = 0;
+    for (const auto& run : runs) {
+        switch (run.op) {
+            case '=':
+            case 'M':
+                l_MD += run.len;
+                t_off += run.len;
+                break;
+            case 'X':
+                for (uint32_t ii = 0; ii < run.len; ++ii) {
+                    append_uint(buf, l_MD);
+                    buf.push_back(target[t_off + ii]);
+                    l_MD = 0;
+                }
+                t_off += run.len;
+                break;
+            case 'D':
+                append_uint(buf, l_MD);
+                buf.push_back('^');
+                buf.append(target + t_off, run.len);
+                l_MD = 0;
+                t_off += run.len;
+                break;
+            default:
+                // insertions do not consume the target
+                break;
+        }
+    }
+    append_uint(buf, l_MD);
+}
+
+// Append len bases of seq, reverse-complemented if requested
+inline void append_seq(std::string& buf, const char* seq, const uint64_t len, const bool rev_comp) {
+    if (!rev_comp) {
+        buf.append(seq, len);
+        return;
+    }
+    const size_t offset = buf.size();
+    buf.resize(offset + len);
+    char* dst = &buf[offset];
+    for (uint64_t i = 0; i < len; ++i) {
+        dst[i] = complement[(unsigned char)seq[len - 1 - i]];
+    }
+}
+
+// std::ostream appending to a std::string that is kept across records, so that a thread can
+// hand its formatted output to the writer without the copy made by std::stringstream::str()
+class string_ostream : private std::streambuf, public std::ostream {
+public:
+    string_ostream() : std::ostream(this) {}
+    std::string& buffer() { return buf; }
+    void reset() { buf.clear(); }
+private:
+    int overflow(int c) override {
+        if (c != std::streambuf::traits_type::eof()) buf.push_back(static_cast<char>(c));
+        return std::streambuf::traits_type::not_eof(c);
+    }
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        buf.append(s, n);
+        return n;
+    }
+    std::string buf;
+};
+
+} // namespace wavefront
+} // namespace wflign
+
+#endif /* ALIGNMENT_FORMATTER_HPP_ */
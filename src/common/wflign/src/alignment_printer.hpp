@@ -4,6 +4,7 @@
 #include <string>
 #include <sstream>
 #include "wflign.hpp"
+#include "alignment_formatter.hpp"
 
 namespace wflign {
 namespace wavefront {
@@ -14,11 +15,9 @@ void write_tag_and_md_string(
     const int cigar_start,
     const int cigar_end,
     const int target_start,
-    const char *target,
-    const int64_t target_offset,
-    const int64_t target_pointer_shift);
+    const char *target);
 
-void write_alignment_sam(
+bool write_alignment_sam(
     std::ostream &out,
     const alignment_t& patch_aln,
     const std::string& cigar_str,
@@ -40,7 +39,8 @@ void write_alignment_sam(
     const int64_t& target_pointer_shift,
     const int32_t& chain_id,
     const int32_t& chain_length,
-    const int32_t& chain_pos);
+    const int32_t& chain_pos,
+    const bool& with_endline = true);
 
 bool write_alignment_paf(
     std::ostream& out,
@@ -97,6 +97,9 @@ void write_merged_alignment(
     const uint64_t& min_inversion_length,
     const int& min_wf_length,
     const int& max_dist_threshold,
+    const uint64_t& min_concurrent_probe_length,
+    tf::Executor* const probe_executor,
+    const bool& orientation_filter,
 #ifdef WFA_PNG_TSV_TIMING
     const std::string* prefix_wavefront_plot_in_png,
     const uint64_t& wfplot_max_size,
@@ -1,10 +1,12 @@
 #include <cassert>
 #include <chrono>
+#include <limits>
 #include <string>
 
 #include "wflign.hpp"
 #include "wflign_patch.hpp"
 #include "wflign_swizzle.hpp"
+#include "../../perf_counters.hpp"
 
 
 // Namespaces
@@ -105,7 +107,171 @@ std::string erode_short_matches_in_cigar(const std::string& cigar, int max_match
     return result;
 }
 
-void do_biwfa_alignment(
+/*
+* WFA policy
+*/
+wfa_policy_t select_wfa_policy(
+    const uint64_t query_length,
+    const uint64_t target_length,
+    const float mashmap_estimated_identity,
+    const wflign_penalties_t& penalties,
+    const uint64_t max_memory_bytes,
+    const wfa_heuristic_t requested_heuristic) {
+
+    wfa_policy_t policy;
+    policy.exact_fallback = false;
+    policy.min_wavefront_length = MIN_WF_LENGTH;
+    policy.max_distance_threshold = 0;
+    policy.xdrop = 0;
+
+    // Guard against missing or nonsensical identity estimates
+    const float identity = (mashmap_estimated_identity > 0 && mashmap_estimated_identity <= 1)
+                           ? mashmap_estimated_identity : 0.7f;
+    const uint64_t max_len = std::max(query_length, target_length);
+
+    // Expected alignment score: one edit every 1/(1-identity) bp, each costing
+    // about the mean of a mismatch and a short gap
+    const double edit_cost = (penalties.mismatch + penalties.gap_opening1 + penalties.gap_extension1) / 2.0;
+    const double expected_score = std::max(1.0, (double)max_len * (1.0 - identity) * edit_cost);
+
+    // With full backtrace memory the wavefronts grow by one diagonal per gap extension step,
+    // so the total is ~score^2/gap_extension offsets for each of the 5 components (4 bytes each).
+    // MemoryMed keeps piggybacked backtrace blocks instead, roughly an order of magnitude less.
+    const double high_bytes = 20.0 * expected_score * expected_score / std::max(1, penalties.gap_extension1);
+    const double med_bytes = high_bytes / 8.0;
+    if (high_bytes <= (double)max_memory_bytes) {
+        policy.memory_model = wfa::WFAligner::MemoryHigh;
+    } else if (med_bytes <= (double)max_memory_bytes) {
+        policy.memory_model = wfa::WFAligner::MemoryMed;
+    } else {
+        policy.memory_model = wfa::WFAligner::MemoryUltralow;
+    }
+
+    // Long divergent records are routed to WFlign (--wflign-min-length/--wflign-max-identity), so the
+    // records that reach biWFA here are short or similar. Of those, the ones whose exact backtrace does
+    // not fit the budget would run MemoryUltralow, the slowest mode, and get the adaptive heuristic
+    // instead; the exact fallback below catches a run it breaks or pushes under min_identity
+    if (requested_heuristic == wfa_heuristic_t::automatic) {
+        policy.heuristic = policy.memory_model == wfa::WFAligner::MemoryUltralow
+                           ? wfa_heuristic_t::adaptive : wfa_heuristic_t::none;
+    } else {
+        policy.heuristic = requested_heuristic;
+    }
+
+    // Same scaling used by wflambda for its WFmash heuristic: more divergence, more lag allowed
+    policy.max_distance_threshold = std::max(MIN_WF_LENGTH, (int)(2048.0 / (identity * identity)));
+    // Allow the score to drop by the cost of a long gap plus the expected cost of a segment
+    policy.xdrop = penalties.gap_opening2 + penalties.gap_extension2 * MIN_WF_LENGTH
+                   + (int)((1.0 - identity) * MIN_WF_LENGTH * edit_cost);
+
+    return policy;
+}
+
+std::string wfa_policy_to_string(const wfa_policy_t& policy) {
+    std::string s;
+    switch (policy.memory_model) {
+        case wfa::WFAligner::MemoryHigh: s = "high"; break;
+        case wfa::WFAligner::MemoryMed: s = "med"; break;
+        case wfa::WFAligner::MemoryLow: s = "low"; break;
+        default: s = "ultralow"; break;
+    }
+    switch (policy.heuristic) {
+        case wfa_heuristic_t::adaptive: s += ",adaptive"; break;
+        case wfa_heuristic_t::xdrop: s += ",xdrop"; break;
+        default: s += ",none"; break;
+    }
+    if (policy.exact_fallback) {
+        s += ",fallback";
+    }
+    return s;
+}
+
+// Gap-compressed identity of a compressed CIGAR, as computed by the PAF/SAM writers
+static double gap_compressed_identity_of_cigar(const std::string& cigar) {
+    if (cigar.empty()) return 0.0;
+    uint64_t matches, mismatches, insertions, inserted_bp, deletions, deleted_bp, ref_len, query_len;
+    process_compressed_cigar(cigar, matches, mismatches, insertions, inserted_bp,
+                             deletions, deleted_bp, ref_len, query_len);
+    const uint64_t total = matches + mismatches + insertions + deletions;
+    return total > 0 ? (double)matches / (double)total : 0.0;
+}
+
+// Highest alignment score at which the gap-compressed identity can still reach min_identity. An alignment
+// with M matches has at most M*(1-id)/id mismatches and gaps, and at most qlen+tlen-2M gap bases. A gap
+// costs at most o+e*len with either piece of the penalties, so the score is at most
+// (M*(1-id)/id+1)*max(x,o) + e*(qlen+tlen-2M), which is linear in M and peaks at M=0 or M=min(qlen,tlen).
+// WFA returns the lowest score, so an exact alignment above the bound means that no alignment of the two
+// sequences, patched or not, passes the identity filter.
+int min_identity_score_bound(
+    const uint64_t query_length,
+    const uint64_t target_length,
+    const float min_identity,
+    const wflign_penalties_t& penalties) {
+    if (min_identity <= 0) {
+        return std::numeric_limits<int>::max();
+    }
+    const double min_len = (double)std::min(query_length, target_length);
+    const double total_len = (double)query_length + (double)target_length;
+    const double events_per_match = (1.0 - min_identity) / min_identity;
+    auto piece_bound = [&](const int gap_opening, const int gap_extension) {
+        const double event_cost = std::max(penalties.mismatch, gap_opening);
+        const double no_matches = event_cost + gap_extension * total_len;
+        const double all_matches = (min_len * events_per_match + 1.0) * event_cost
+                                   + gap_extension * (total_len - 2.0 * min_len);
+        return std::max(no_matches, all_matches);
+    };
+    const double bound = std::min(piece_bound(penalties.gap_opening1, penalties.gap_extension1),
+                                  piece_bound(penalties.gap_opening2, penalties.gap_extension2));
+    return bound >= (double)std::numeric_limits<int>::max() ? std::numeric_limits<int>::max() : (int)std::ceil(bound);
+}
+
+// Run the main end-to-end alignment under the given policy, returning the WFA status
+static int run_biwfa_with_policy(
+    const wfa_policy_t& policy,
+    const int max_alignment_steps,
+    const wflign_penalties_t& penalties,
+    char* const query,
+    const uint64_t query_length,
+    char* const target,
+    const uint64_t target_length,
+    alignment_t& aln,
+    int* const score = nullptr) {
+
+    wfa::WFAlignerGapAffine2Pieces wf_aligner(
+        0,  // match
+        penalties.mismatch,
+        penalties.gap_opening1,
+        penalties.gap_extension1,
+        penalties.gap_opening2,
+        penalties.gap_extension2,
+        wfa::WFAligner::Alignment,
+        policy.memory_model);
+    switch (policy.heuristic) {
+        case wfa_heuristic_t::adaptive:
+            wf_aligner.setHeuristicWFadaptive(policy.min_wavefront_length, policy.max_distance_threshold);
+            break;
+        case wfa_heuristic_t::xdrop:
+            wf_aligner.setHeuristicXDrop(policy.xdrop);
+            break;
+        default:
+            wf_aligner.setHeuristicNone();
+            break;
+    }
+    if (max_alignment_steps > 0) {
+        wf_aligner.setMaxAlignmentSteps(max_alignment_steps);
+    }
+
+    const int status = wf_aligner.alignEnd2End(target, (int)target_length, query, (int)query_length);
+    if (status == 0) {
+        wflign_edit_cigar_copy(wf_aligner, &aln.edit_cigar);
+    }
+    if (score) {
+        *score = status == 0 ? wf_aligner.getAlignmentScore() : -1;
+    }
+    return status;
+}
+
+bool do_biwfa_alignment(
     const std::string& query_name,
     char* const query,
     const uint64_t query_total_length,
@@ -128,27 +294,40 @@ void do_biwfa_alignment(
     const float mashmap_estimated_identity,
     const int32_t chain_id,
     const int32_t chain_length,
-    const int32_t chain_pos) {
-    
-    // Create WFA aligner for the main alignment
-    wfa::WFAlignerGapAffine2Pieces wf_aligner(
-        0,  // match
-        penalties.mismatch,
-        penalties.gap_opening1,
-        penalties.gap_extension1,
-        penalties.gap_opening2,
-        penalties.gap_extension2,
-        wfa::WFAligner::Alignment,
-        wfa::WFAligner::MemoryUltralow);
-    wf_aligner.setHeuristicNone();
-    
-    // Perform the main end-to-end alignment first
-    const int status = wf_aligner.alignEnd2End(target, (int)target_length, query, (int)query_length);
-    
-    if (status != 0) {
-        return; // Alignment failed
+    const int32_t chain_pos,
+    const uint64_t max_memory_bytes,
+    const wfa_heuristic_t requested_heuristic,
+    const int max_alignment_steps,
+    const bool identity_prepass,
+    bool* const rejected_by_prepass,
+    biwfa_profile_t* const profile,
+    const bool emit_policy_tag) {
+
+    if (rejected_by_prepass) {
+        *rejected_by_prepass = false;
     }
 
+    // Seconds since the previous call, for the per-phase profile
+    auto phase_start = std::chrono::steady_clock::now();
+    auto lap = [&phase_start]() {
+        const auto now = std::chrono::steady_clock::now();
+        const double seconds = std::chrono::duration<double>(now - phase_start).count();
+        phase_start = now;
+        return seconds;
+    };
+    int main_score = -1;
+
+    // With the pre-pass, stop WFA as soon as the score rules out min_identity; the user's step
+    // limit still wins when it is tighter, and hitting it means escalation rather than rejection.
+    // Without a finite bound there is nothing to rule out and the pre-pass stays out of the way
+    const int identity_bound = identity_prepass
+        ? min_identity_score_bound(query_length, target_length, min_identity, penalties)
+        : std::numeric_limits<int>::max();
+    const bool prepass_binding = identity_prepass
+        && identity_bound < std::numeric_limits<int>::max()
+        && (max_alignment_steps <= 0 || identity_bound < max_alignment_steps);
+    const int steps_limit = prepass_binding ? identity_bound : max_alignment_steps;
+
     // Create alignment record on stack
     alignment_t aln;
     aln.ok = true;
@@ -157,12 +336,58 @@ void do_biwfa_alignment(
     aln.query_length = query_length;
     aln.target_length = target_length;
     aln.is_rev = false;
-    
-    // Copy alignment CIGAR from the main alignment
-    wflign_edit_cigar_copy(wf_aligner, &aln.edit_cigar);
-    std::string main_cigar = wfa_edit_cigar_to_string(aln.edit_cigar);
+
+    // Pick memory mode and heuristic for this record, then perform the main end-to-end alignment
+    wfa_policy_t policy = select_wfa_policy(
+        query_length, target_length, mashmap_estimated_identity,
+        penalties, max_memory_bytes, requested_heuristic);
+    int status = run_biwfa_with_policy(policy, steps_limit, penalties, query, query_length, target, target_length, aln, &main_score);
+
+    std::string main_cigar;
+    if (status == 0) {
+        main_cigar = wfa_edit_cigar_to_string(aln.edit_cigar);
+    }
+
+    // A heuristic can drop the optimal path: if it gave up or the result would be filtered out
+    // by min_identity, redo the alignment exactly with the memory mode that is always safe.
+    // A heuristic run stopped by the pre-pass bound is rejected on its own score instead of
+    // paying for a second, exact run under the same bound; a heuristic that gave up on its own
+    // (any other status) still gets the exact run
+    bool stopped_by_prepass = prepass_binding && status == WF_STATUS_MAX_STEPS_REACHED;
+    if (policy.heuristic != wfa_heuristic_t::none && !stopped_by_prepass
+        && (status != 0 || gap_compressed_identity_of_cigar(main_cigar) < min_identity)) {
+        free(aln.edit_cigar.cigar_ops);
+        aln.edit_cigar = {nullptr, 0, 0};
+        policy.memory_model = wfa::WFAligner::MemoryUltralow;
+        policy.heuristic = wfa_heuristic_t::none;
+        policy.exact_fallback = true;
+        status = run_biwfa_with_policy(policy, steps_limit, penalties, query, query_length, target, target_length, aln, &main_score);
+        if (status == 0) {
+            main_cigar = wfa_edit_cigar_to_string(aln.edit_cigar);
+        }
+        stopped_by_prepass = prepass_binding && status == WF_STATUS_MAX_STEPS_REACHED;
+    }
+    if (profile) {
+        profile->main_seconds = lap();
+        profile->wfa_score = main_score;
+        profile->policy = policy;
+    }
+
+    if (status != 0) {
+        if (stopped_by_prepass) {
+            // The score exceeded the identity bound. Under the exact policy no alignment of the record can
+            // pass the identity filter; under a heuristic this is as approximate as the heuristic itself
+            if (rejected_by_prepass) {
+                *rejected_by_prepass = true;
+            }
+            return true;
+        }
+        return false; // Alignment failed or ran out of steps
+    }
     
     if (!disable_chain_patching) {
+        perf_counters::Scope scope(perf_counters::patching);
+
         // Set up constants for patching
         const int MIN_PATCH_LENGTH = 128;       // Minimum length to expose for patching
         const int MAX_ERODE_LENGTH = 4096;      // Maximum erosion before stopping
@@ -386,6 +611,9 @@ void do_biwfa_alignment(
         }
 
     }
+    if (profile) {
+        profile->patch_seconds = lap();
+    }
 
     // Try swizzling the CIGAR at both ends
     std::string swizzled = try_swap_start_pattern(main_cigar, query, target, 0, 0);
@@ -397,10 +625,14 @@ void do_biwfa_alignment(
     if (swizzled != main_cigar) {
         main_cigar = swizzled;
     }
-    
-    // Write alignment
+    if (profile) {
+        profile->swizzle_seconds = lap();
+    }
+
+    // Write alignment, optionally followed by the policy used for it
+    perf_counters::Scope output_scope(perf_counters::output);
     if (paf_format_else_sam) {
-        write_alignment_paf(
+        const bool wrote = write_alignment_paf(
             out,
             aln,
             main_cigar,
@@ -417,10 +649,17 @@ void do_biwfa_alignment(
             mashmap_estimated_identity,
             chain_id,
             chain_length,
-            chain_pos);
+            chain_pos,
+            false);
+        if (wrote) {
+            if (emit_policy_tag) {
+                out << "\twp:Z:" << wfa_policy_to_string(policy);
+            }
+            out << "\n";
+        }
     } else {
         // Write SAM output
-        write_alignment_sam(
+        const bool wrote = write_alignment_sam(
             out,
             aln,
             main_cigar,
@@ -442,8 +681,19 @@ void do_biwfa_alignment(
             0,
             chain_id,
             chain_length,
-            chain_pos); // No target pointer shift for biwfa
+            chain_pos,
+            false); // No target pointer shift for biwfa
+        if (wrote) {
+            if (emit_policy_tag) {
+                out << "\twp:Z:" << wfa_policy_to_string(policy);
+            }
+            out << "\n";
+        }
+    }
+    if (profile) {
+        profile->format_seconds = lap();
     }
+    return true;
 }
 
 /*
@@ -556,6 +806,10 @@ WFlign::WFlign(
     this->paf_format_else_sam = false;
     this->no_seq_in_sam = false;
     this->disable_chain_patching = false;
+    this->min_concurrent_probe_length = 0;
+    this->patch_orientation_filter = false;
+    this->probe_executor = nullptr;
+    this->deadline = std::chrono::steady_clock::time_point::max();
 }
 /*
 * Output configuration
@@ -621,6 +875,10 @@ int wflambda_extend_match(
         if (f != alignments.end()) {
             is_a_match = (alignments[k] != nullptr);
         } else {
+            if (extend_data->timed_out || std::chrono::steady_clock::now() > wflign.deadline) {
+                extend_data->timed_out = true;
+                return false;
+            }
             const int64_t query_begin = v * step_size;
             const int64_t target_begin = h * step_size;
 
@@ -858,11 +1116,11 @@ void WFlign::wflign_affine_wavefront(
     } else {
     }*/
 
-    // override erosion if not given on input
-    if (erode_k < 0) {
+    // override erosion if not given on input (kept per record, so the instance can be reused)
+    const int record_erode_k = erode_k < 0
         // heuristic setting of erosion
-        erode_k = std::min(127.0,std::round(1.0/(1.0-mashmap_estimated_identity)));
-    }
+        ? (int)std::min(127.0,std::round(1.0/(1.0-mashmap_estimated_identity)))
+        : erode_k;
 
     // override max mash dist if given on input
     if (wflign_max_mash_dist > 0) {
@@ -985,12 +1243,15 @@ void WFlign::wflign_affine_wavefront(
                 mashmap_estimated_identity,
                 wflign_max_len_major,
                 wflign_max_len_minor,
-                erode_k,
+                record_erode_k,
                 chain_gap,
                 max_patching_score,
                 min_inversion_length,
                 MIN_WF_LENGTH,
-                wf_max_dist_threshold
+                wf_max_dist_threshold,
+                min_concurrent_probe_length,
+                probe_executor,
+                patch_orientation_filter
 #ifdef WFA_PNG_TSV_TIMING
                 ,
                 prefix_wavefront_plot_in_png,
@@ -1109,6 +1370,7 @@ void WFlign::wflign_affine_wavefront(
         extend_data.num_alignments_performed = 0;
 #endif
         extend_data.num_sketches_allocated = 0;
+        extend_data.timed_out = false;
         // 128 MB of memory for sketches
         extend_data.max_num_sketches_in_memory = 128 * 1024 * 1024
             / (sizeof(std::vector<rkmh::hash_t>) + mash_sketch_rate * segment_length_to_use * sizeof(rkmh::hash_t));
@@ -1279,6 +1541,15 @@ void WFlign::wflign_affine_wavefront(
         // todo: implement alignment identifier based on hash of the input, params,
         // and commit annotate each PAF record with it and the full alignment score
 
+        // Past the deadline the wflambda layer is incomplete and patching it would take longer
+        // still: write nothing and let the caller fall back
+        if (extend_data.timed_out || std::chrono::steady_clock::now() > deadline) {
+            for (auto* aln : trace) {
+                delete aln;
+            }
+            trace.clear();
+        }
+
         // Trim alignments that overlap in the query
         if (!trace.empty()) {
     #ifdef VALIDATE_WFA_WFLIGN
@@ -1454,12 +1725,15 @@ void WFlign::wflign_affine_wavefront(
                         mashmap_estimated_identity,
                         wflign_max_len_major,
                         wflign_max_len_minor,
-                        erode_k,
+                        record_erode_k,
                         chain_gap,
                         max_patching_score,
                         min_inversion_length,
                         MIN_WF_LENGTH,
-                        wf_max_dist_threshold
+                        wf_max_dist_threshold,
+                        min_concurrent_probe_length,
+                        probe_executor,
+                        patch_orientation_filter
 #ifdef WFA_PNG_TSV_TIMING
                         ,
                         prefix_wavefront_plot_in_png,
@@ -4,6 +4,7 @@
 #include <algorithm>
 #include <cctype>
 #include <charconv>
+#include <chrono>
 #include <cmath>
 #include <cstring>
 #include <iostream>
@@ -27,6 +28,9 @@
 #include "atomic_image.hpp"
 #include "lodepng/lodepng.h"
 
+namespace tf {
+    class Executor;
+}
 
 /*
  * Namespaces
@@ -34,7 +38,52 @@
 namespace wflign {
     namespace wavefront {
 
-        void do_biwfa_alignment(
+        // Heuristic requested for the main biWFA alignment (automatic lets the policy decide per record)
+        enum class wfa_heuristic_t { automatic, none, adaptive, xdrop };
+
+        // Per-record WFA configuration chosen from lengths, estimated identity and memory budget
+        struct wfa_policy_t {
+            wfa::WFAligner::MemoryModel memory_model;
+            wfa_heuristic_t heuristic;      // never automatic once selected
+            int min_wavefront_length;       // adaptive: wavefront length that triggers reduction
+            int max_distance_threshold;     // adaptive: max lag behind the best diagonal
+            int xdrop;                      // xdrop: score drop that terminates the alignment
+            bool exact_fallback;            // true if the heuristic result was discarded
+        };
+
+        // Where do_biwfa_alignment spent its time on one record, filled when the caller asks for it
+        struct biwfa_profile_t {
+            double main_seconds = 0;        // main end-to-end alignment, including the exact fallback
+            double patch_seconds = 0;       // head and tail patching
+            double swizzle_seconds = 0;     // CIGAR end swizzling
+            double format_seconds = 0;      // writing the PAF/SAM record
+            int wfa_score = -1;             // score of the main alignment (-1 if it failed)
+            wfa_policy_t policy;            // policy of the main alignment
+        };
+
+        wfa_policy_t select_wfa_policy(
+            const uint64_t query_length,
+            const uint64_t target_length,
+            const float mashmap_estimated_identity,
+            const wflign_penalties_t& penalties,
+            const uint64_t max_memory_bytes,
+            const wfa_heuristic_t requested_heuristic);
+
+        // Compact description of a policy for the wp:Z: output tag, e.g. "high,none" or "ultralow,adaptive,fallback"
+        std::string wfa_policy_to_string(const wfa_policy_t& policy);
+
+        // Highest score at which an alignment of these lengths can still reach min_identity (see wflign.cpp)
+        int min_identity_score_bound(
+            const uint64_t query_length,
+            const uint64_t target_length,
+            const float min_identity,
+            const wflign_penalties_t& penalties);
+
+        // Returns false if WFA gave up on the record (e.g. max_alignment_steps was reached) and nothing was written.
+        // With identity_prepass, records whose score rules out min_identity are dropped early (returning true
+        // with *rejected_by_prepass set). A non-null profile receives per-phase timings of the record,
+        // and emit_policy_tag appends the policy as a wp:Z: tag
+        bool do_biwfa_alignment(
             const std::string& query_name,
             char* const query,
             const uint64_t query_total_length,
@@ -57,7 +106,14 @@ namespace wflign {
             const float mashmap_estimated_identity,
             const int32_t chain_id,
             const int32_t chain_length,
-            const int32_t chain_pos);
+            const int32_t chain_pos,
+            const uint64_t max_memory_bytes = 1000000000,
+            const wfa_heuristic_t requested_heuristic = wfa_heuristic_t::automatic,
+            const int max_alignment_steps = 0,
+            const bool identity_prepass = false,
+            bool* const rejected_by_prepass = nullptr,
+            biwfa_profile_t* const profile = nullptr,
+            const bool emit_policy_tag = false);
 
         class WFlign {
         public:
@@ -120,6 +176,10 @@ namespace wflign {
             bool no_seq_in_sam;
             bool disable_chain_patching;
             bool force_biwfa_alignment;
+            uint64_t min_concurrent_probe_length; // patches this long run fwd/rev probes concurrently (0=never)
+            bool patch_orientation_filter;        // skip inverted probes when the patch k-mers favour the forward strand
+            tf::Executor* probe_executor;         // executor whose idle workers may run those probes
+            std::chrono::steady_clock::time_point deadline; // give up on the record, writing nothing, once this passes
             // Setup
             WFlign(
                     const uint16_t segment_length,
@@ -214,6 +274,8 @@ typedef struct {
     // For performance improvements
     uint64_t max_num_sketches_in_memory;
     uint64_t num_sketches_allocated;
+    // Set once the deadline passed; later cells are mismatches without being aligned
+    bool timed_out;
 #ifdef WFA_PNG_TSV_TIMING
     // wfplot
     bool emit_png;
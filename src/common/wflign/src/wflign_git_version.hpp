@@ -0,0 +1 @@
+#define WFLIGN_GIT_VERSION "a14e221"
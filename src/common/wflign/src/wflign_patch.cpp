@@ -1,11 +1,14 @@
 #include <cstddef>
 #include <chrono>
 #include <cstdlib>
+#include <future>
 #include <string>
 #include <atomic_image.hpp>
 #include "rkmh.hpp"
 #include "wflign_patch.hpp"
 #include "wflign_git_version.hpp"
+#include "../../perf_counters.hpp"
+#include "../../taskflow/taskflow.hpp"
 
 namespace wflign {
 
@@ -402,6 +405,76 @@ bool do_wfa_segment_alignment(
     }
 }
 
+// k-mer size and minimum patch length for the orientation test run before reverse-complement probes
+#define PATCH_ORIENTATION_K 12
+#define PATCH_ORIENTATION_MIN_LENGTH 128
+
+// Count the query k-mers found in the target in forward and in reverse-complement orientation
+static void count_patch_orientation_hits(
+        const char* query,
+        const uint64_t& query_length,
+        const char* target,
+        const uint64_t& target_length,
+        uint64_t& fwd_hits,
+        uint64_t& rev_hits) {
+    auto encode = [](const char c) -> int {
+        switch (c) {
+            case 'A': return 0;
+            case 'C': return 1;
+            case 'G': return 2;
+            case 'T': return 3;
+            default: return -1;
+        }
+    };
+    const uint32_t mask = (1u << (2 * PATCH_ORIENTATION_K)) - 1;
+
+    thread_local robin_hood::unordered_flat_set<uint32_t> target_kmers;
+    target_kmers.clear();
+    uint32_t fw = 0;
+    int valid = 0;
+    for (uint64_t p = 0; p < target_length; ++p) {
+        const int code = encode(target[p]);
+        if (code < 0) { valid = 0; continue; }
+        fw = ((fw << 2) | code) & mask;
+        if (++valid >= PATCH_ORIENTATION_K) target_kmers.insert(fw);
+    }
+
+    fwd_hits = 0;
+    rev_hits = 0;
+    uint32_t rc = 0;
+    fw = 0;
+    valid = 0;
+    for (uint64_t p = 0; p < query_length; ++p) {
+        const int code = encode(query[p]);
+        if (code < 0) { valid = 0; continue; }
+        fw = ((fw << 2) | code) & mask;
+        rc = (rc >> 2) | ((uint32_t)(3 - code) << (2 * (PATCH_ORIENTATION_K - 1)));
+        if (++valid >= PATCH_ORIENTATION_K) {
+            fwd_hits += target_kmers.count(fw);
+            rev_hits += target_kmers.count(rc);
+        }
+    }
+}
+
+// A reverse probe offered to other workers: the first thread to claim it runs it, and done is set once it finished
+struct concurrent_probe_t {
+    std::atomic<bool> claimed{false};
+    std::promise<void> done;
+    std::function<void()> run;
+
+    void claim_and_run() {
+        if (claimed.exchange(true)) {
+            return;
+        }
+        try {
+            run();
+            done.set_value();
+        } catch (...) {
+            done.set_exception(std::current_exception());
+        }
+    }
+};
+
 void do_wfa_patch_alignment(
         const char* query,
         const uint64_t& j,
@@ -415,7 +488,10 @@ void do_wfa_patch_alignment(
         alignment_t& rev_aln,
         const int64_t& chain_gap,
         const int& max_patching_score,
-        const uint64_t& min_inversion_length) {
+        const uint64_t& min_inversion_length,
+        const uint64_t& min_concurrent_probe_length,
+        tf::Executor* const probe_executor,
+        const bool& orientation_filter) {
 
     const int max_score =
         max_patching_score ? max_patching_score :
@@ -438,17 +514,85 @@ void do_wfa_patch_alignment(
               << std::endl;
     */
 
+    const bool inversion_candidate =
+        query_length >= min_inversion_length && target_length >= min_inversion_length;
+
+    // With the orientation filter, only probe the reverse complement when the k-mer content does not
+    // clearly favour the forward strand (a failed forward alignment is always followed by a probe)
+    bool rev_plausible = true;
+    if (orientation_filter && inversion_candidate && std::min(query_length, target_length) >= PATCH_ORIENTATION_MIN_LENGTH) {
+        uint64_t fwd_hits = 0, rev_hits = 0;
+        count_patch_orientation_hits(query + j, query_length, target + i, target_length, fwd_hits, rev_hits);
+        rev_plausible = rev_hits > 0 && rev_hits * 2 >= fwd_hits;
+    }
+
+    rev_aln.ok = false;
+    rev_aln.is_rev = true;
+    std::string rev_comp_query;
+    auto reverse_probe = [&](wfa::WFAlignerGapAffine2Pieces& aligner) {
+        const int rev_status = aligner.alignEnd2End(target + i, target_length, rev_comp_query.c_str(), query_length);
+        rev_aln.ok = (rev_status == WF_STATUS_ALG_COMPLETED);
+        if (rev_aln.ok) {
+            wflign_edit_cigar_copy(aligner, &rev_aln.edit_cigar);
+#ifdef VALIDATE_WFA_WFLIGN
+            if (!validate_cigar(rev_aln.edit_cigar, rev_comp_query.c_str(), target + i, query_length,
+                                target_length, 0, 0)) {
+                std::cerr << "cigar failure at reverse complement alignment " << j << " " << i << std::endl;
+                unpack_display_cigar(rev_aln.edit_cigar, rev_comp_query.c_str(), target + i, query_length,
+                                     target_length, 0, 0);
+                std::cerr << ">query (reverse complement)" << std::endl
+                          << rev_comp_query << std::endl;
+                std::cerr << ">target" << std::endl
+                          << std::string(target + i, target_length) << std::endl;
+                assert(false);
+            }
+#endif
+            rev_aln.score = calculate_alignment_score(rev_aln.edit_cigar, convex_penalties);
+            rev_aln.j = j;
+            rev_aln.i = i;
+            rev_aln.query_length = query_length;
+            rev_aln.target_length = target_length;
+        }
+    };
+
+    // Large patches offer the reverse probe, on its own aligner, to the idle workers of the alignment
+    // executor while the forward one runs here. Whoever claims it first runs it, so the probes never
+    // need threads beyond -t. It cannot use the forward score as its cap, so that is applied once both are done
+    const bool concurrent_probes = probe_executor != nullptr
+        && inversion_candidate && rev_plausible
+        && min_concurrent_probe_length > 0
+        && query_length >= min_concurrent_probe_length
+        && target_length >= min_concurrent_probe_length;
+    std::shared_ptr<concurrent_probe_t> concurrent_probe;
+    std::future<void> concurrent_probe_done;
+    if (concurrent_probes) {
+        concurrent_probe = std::make_shared<concurrent_probe_t>();
+        concurrent_probe_done = concurrent_probe->done.get_future();
+        rev_comp_query = reverse_complement(std::string(query + j, query_length));
+        concurrent_probe->run = [&]() {
+            wfa::WFAlignerGapAffine2Pieces rev_aligner(
+                0,
+                convex_penalties.mismatch,
+                convex_penalties.gap_opening1,
+                convex_penalties.gap_extension1,
+                convex_penalties.gap_opening2,
+                convex_penalties.gap_extension2,
+                wfa::WFAligner::Alignment,
+                wfa::WFAligner::MemoryUltralow);
+            rev_aligner.setHeuristicNone();
+            rev_aligner.setMaxAlignmentSteps(max_score);
+            reverse_probe(rev_aligner);
+        };
+        // The task only holds the shared state: if this thread claims the probe first, it is a no-op
+        probe_executor->silent_async([concurrent_probe]() { concurrent_probe->claim_and_run(); });
+    }
+
     wf_aligner.setMaxAlignmentSteps(max_score);
 
-    //int fwd_score = std::numeric_limits<int>::max();
-    //int rev_score = std::numeric_limits<int>::max();
-    
     const int status = wf_aligner.alignEnd2End(target + i, target_length, query + j, query_length);
     aln.ok = (status == WF_STATUS_ALG_COMPLETED);
     aln.is_rev = false;
 
-    //std::cerr << "score is " << wf_aligner.getAlignmentScore() << std::endl;
-
     if (aln.ok) {
 #ifdef VALIDATE_WFA_WFLIGN
         if (!validate_cigar(wf_aligner.cigar, query + j, target + i, query_length,
@@ -466,48 +610,21 @@ void do_wfa_patch_alignment(
 
         wflign_edit_cigar_copy(wf_aligner, &aln.edit_cigar);
         aln.score = calculate_alignment_score(aln.edit_cigar, convex_penalties);
-        //std::cerr << "forward score is " << fwd_score << std::endl;
     }
 
-    if (query_length >= min_inversion_length && target_length >= min_inversion_length) {
-        if (aln.ok) {
-            wf_aligner.setMaxAlignmentSteps(std::ceil((double)aln.score * 0.9));
+    // The reverse probe only matters if it beats the forward score by a margin
+    const int rev_max_score = aln.ok ? (int)std::ceil((double)aln.score * 0.9) : max_score;
+    if (concurrent_probes) {
+        // Run the probe here if no worker picked it up, otherwise wait for the one running it
+        concurrent_probe->claim_and_run();
+        concurrent_probe_done.get();
+        if (rev_aln.ok && rev_aln.score > rev_max_score) {
+            rev_aln.ok = false;
         }
-        // Try reverse complement alignment
-        std::string rev_comp_query = reverse_complement(std::string(query + j, query_length));
-        const int rev_status = wf_aligner.alignEnd2End(target + i, target_length, rev_comp_query.c_str(), query_length);
-
-        //auto rev_score = wf_aligner.getAlignmentScore();
-        //rev_aln.ok = (rev_score > fwd_score && rev_status == WF_STATUS_ALG_COMPLETED);
-        rev_aln.ok = (rev_status == WF_STATUS_ALG_COMPLETED);
-        rev_aln.is_rev = true;
-
-        if (rev_aln.ok) {
-            wflign_edit_cigar_copy(wf_aligner, &rev_aln.edit_cigar);
-            //std::cerr << "reverse complement alignment worked!" << std::endl;
-#ifdef VALIDATE_WFA_WFLIGN
-            if (!validate_cigar(rev_aln.edit_cigar, rev_comp_query.c_str(), target + i, query_length,
-                                target_length, 0, 0)) {
-                std::cerr << "cigar failure at reverse complement alignment " << j << " " << i << std::endl;
-                unpack_display_cigar(rev_aln.edit_cigar, rev_comp_query.c_str(), target + i, query_length,
-                                     target_length, 0, 0);
-                std::cerr << ">query (reverse complement)" << std::endl
-                          << rev_comp_query << std::endl;
-                std::cerr << ">target" << std::endl
-                          << std::string(target + i, target_length) << std::endl;
-                assert(false);
-            }
-#endif
-
-            rev_aln.score = calculate_alignment_score(rev_aln.edit_cigar, convex_penalties);
-            //std::cerr << "reverse score is " << rev_score << std::endl;
-            rev_aln.j = j;
-            rev_aln.i = i;
-            rev_aln.query_length = query_length;
-            rev_aln.target_length = target_length;
-        }
-    } else {
-        rev_aln.ok = false;
+    } else if (inversion_candidate && (!aln.ok || rev_plausible)) {
+        wf_aligner.setMaxAlignmentSteps(rev_max_score);
+        rev_comp_query = reverse_complement(std::string(query + j, query_length));
+        reverse_probe(wf_aligner);
     }
 
     if (rev_aln.ok && rev_aln.score < aln.score) {
@@ -866,7 +983,10 @@ std::vector<alignment_t> do_progressive_wfa_patch_alignment(
     const int64_t& chain_gap,
     const int& max_patching_score,
     const uint64_t& min_inversion_length,
-    const int& erode_k) {
+    const int& erode_k,
+    const uint64_t& min_concurrent_probe_length,
+    tf::Executor* const probe_executor,
+    const bool& orientation_filter) {
 
     std::vector<alignment_t> alignments;
     uint64_t current_query_start = query_start;
@@ -898,7 +1018,10 @@ std::vector<alignment_t> do_progressive_wfa_patch_alignment(
             rev_aln,
             chain_gap,
             max_patching_score,
-            min_inversion_length);
+            min_inversion_length,
+            min_concurrent_probe_length,
+            probe_executor,
+            orientation_filter);
 
         //std::cerr << "WFA fwd alignment: " << aln << std::endl;
         //std::cerr << "WFA rev alignment: " << rev_aln << std::endl;
@@ -1106,6 +1229,9 @@ void write_merged_alignment(
         const uint64_t& min_inversion_length,
         const int& min_wf_length,
         const int& max_dist_threshold,
+        const uint64_t& min_concurrent_probe_length,
+        tf::Executor* const probe_executor,
+        const bool& orientation_filter,
 #ifdef WFA_PNG_TSV_TIMING
         const std::string* prefix_wavefront_plot_in_png,
         const uint64_t& wfplot_max_size,
@@ -1229,6 +1355,7 @@ void write_merged_alignment(
                          &multi_patch_alns,
                          &convex_penalties,
                          &chain_gap, &max_patching_score, &min_inversion_length, &erode_k,
+                         &min_concurrent_probe_length, &probe_executor, &orientation_filter,
                          &query_total_length  // Add this line to capture query_total_length
 #ifdef WFA_PNG_TSV_TIMING
                          ,&emit_patching_tsv,
@@ -1292,7 +1419,10 @@ void write_merged_alignment(
                     head_rev_aln,
                     chain_gap,
                     max_patching_score,
-                    min_inversion_length);
+                    min_inversion_length,
+                    min_concurrent_probe_length,
+                    probe_executor,
+                    orientation_filter);
                 
                 if (head_aln.ok) {
                     //std::cerr << "head_aln: " << head_aln.score << std::endl;
@@ -1582,7 +1712,10 @@ void write_merged_alignment(
                                         chain_gap,
                                         max_patching_score,
                                         min_inversion_length,
-                                        erode_k);
+                                        erode_k,
+                                        min_concurrent_probe_length,
+                                        probe_executor,
+                                        orientation_filter);
                                 if (patch_alignments.size() == 1
                                     && patch_alignments.front().ok
                                     && !patch_alignments.front().is_rev) {
@@ -1676,7 +1809,10 @@ void write_merged_alignment(
                     tail_rev_aln,
                     chain_gap,
                     max_patching_score,
-                    min_inversion_length);
+                    min_inversion_length,
+                    min_concurrent_probe_length,
+                    probe_executor,
+                    orientation_filter);
 
                 if (tail_aln.ok) {
                     // Append the tail alignment to the main alignment
@@ -1866,7 +2002,10 @@ void write_merged_alignment(
 
             //std::cerr << "FIRST PATCH ROUND" << std::endl;
             // +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++\n";
-            patching(erodev, tracev, 4096, 8, 512, true);
+            {
+                perf_counters::Scope scope(perf_counters::patching);
+                patching(erodev, tracev, 4096, 8, 512, true);
+            }
 
 #ifdef VALIDATE_WFA_WFLIGN
             if (!validate_trace(tracev, query,
@@ -2084,6 +2223,8 @@ query_start : query_end)
     }
 #endif
 
+    perf_counters::Scope output_scope(perf_counters::output);
+
     // convert trace to cigar, get correct start and end coordinates
     char *cigarv = alignment_to_cigar(
             tracev, begin_offset, end_offset,
@@ -2124,74 +2265,10 @@ query_start : query_end)
 
         auto write_tag_and_md_string = [&](std::ostream &out, const char *c,
                                            const int target_start) {
-            out << "MD:Z:";
-
-            char last_op = '\0';
-            int last_len = 0;
-            int t_off = target_start, l_MD = 0;
-            int l = 0;
-            int x = 0;
-            while (c[x] != '\0') {
-                while (isdigit(c[x]))
-                    ++x;
-                char op = c[x];
-                int len = 0;
-                std::from_chars(c + l, c + x, len);
-                l = ++x;
-                if (last_len) {
-                    if (last_op == op) {
-                        len += last_len;
-                    } else {
-                        // std::cerr << t_off << "   " << last_len << last_op <<
-                        // std::endl;
-
-                        if (last_op == '=') {
-                            l_MD += last_len;
-                            t_off += last_len;
-                        } else if (last_op == 'X') {
-                            for (uint64_t ii = 0; ii < last_len; ++ii) {
-                                out << l_MD
-                                    << target[t_off + ii - target_pointer_shift];
-                                l_MD = 0;
-                            }
-
-                            t_off += last_len;
-                        } else if (last_op == 'D') {
-                            out << l_MD << "^";
-                            for (uint64_t ii = 0; ii < last_len; ++ii) {
-                                out << target[t_off + ii - target_pointer_shift];
-                            }
-
-                            l_MD = 0;
-                            t_off += last_len;
-                        }
-                    }
-                }
-                last_op = op;
-                last_len = len;
-            }
-
-            if (last_len) {
-                // std::cerr << t_off << "   " << last_len << last_op << std::endl;
-
-                if (last_op == '=') {
-                    out << last_len + l_MD;
-                } else if (last_op == 'X') {
-                    for (uint64_t ii = 0; ii < last_len; ++ii) {
-                        out << l_MD << target[t_off + ii - target_pointer_shift];
-                        l_MD = 0;
-                    }
-                    out << "0";
-                } else if (last_op == 'I') {
-                    out << l_MD;
-                } else if (last_op == 'D') {
-                    out << l_MD << "^";
-                    for (uint64_t ii = 0; ii < last_len; ++ii) {
-                        out << target[t_off + ii - target_pointer_shift];
-                    }
-                    out << "0";
-                }
-            }
+            thread_local std::string buf;
+            buf.clear();
+            append_md_tag(buf, c, 0, strlen(c), target_start, target - target_pointer_shift);
+            out.write(buf.data(), buf.size());
         };
 
 #ifdef WFA_PNG_TSV_TIMING
@@ -2249,8 +2326,7 @@ query_start : query_end)
             out << "\t" << "cg:Z:" << cigarv << "\n";
 #endif
         } else {
-            out << "@PG\tID:wfmash\tPN:wfmash\tVN:" << WFLIGN_GIT_VERSION << "\tCL:wfmash\n"
-                << query_name                          // Query template NAME
+            out << query_name                          // Query template NAME
                 << "\t" << (query_is_rev ? "16" : "0") // bitwise FLAG
                 << "\t" << target_name // Reference sequence NAME
                 << "\t"
@@ -2289,9 +2365,7 @@ query_start : query_end)
             if (no_seq_in_sam) {
                 out << "*";
             } else {
-                for (uint64_t p = query_start; p < query_end; ++p) {
-                    out << query[p];
-                }
+                out.write(query + query_start, query_end - query_start);
             }
 
             out << "\t"
@@ -2386,7 +2460,6 @@ query_start : query_end)
             }
         }
     }
-    out << std::flush;
 }
 
 void write_tag_and_md_string(
@@ -2396,83 +2469,13 @@ void write_tag_and_md_string(
     const int cigar_end,
     const int target_start,
     const char *target) {
-
-    out << "MD:Z:";
-
-    char last_op = '\0';
-    int last_len = 0;
-    int t_off = target_start, l_MD = 0;
-    int l = cigar_start;
-    int x = cigar_start;
-
-    while (x < cigar_end) {
-        // Parse the length digits
-        while (x < cigar_end && isdigit(cigar_ops[x]))
-            ++x;
-
-        char op = cigar_ops[x];
-        int len = 0;
-
-        // Convert the substring [l, x) to an integer
-        auto result = std::from_chars(cigar_ops + l, cigar_ops + x, len);
-        l = ++x;
-
-        // Process the previous operation if there was one
-        if (last_len) {
-            if (last_op == op) {
-                len += last_len;
-            } else {
-                // Handle the previous operation based on its type
-                if (last_op == '=' || last_op == 'M') {
-                    l_MD += last_len;
-                    t_off += last_len;
-                } else if (last_op == 'X') {
-                    for (uint64_t ii = 0; ii < last_len; ++ii) {
-                        int64_t idx = t_off + ii ;
-                        out << l_MD << target[idx];
-                        l_MD = 0;
-                    }
-                    t_off += last_len;
-                } else if (last_op == 'D') {
-                    out << l_MD << "^";
-                    for (uint64_t ii = 0; ii < last_len; ++ii) {
-                        int64_t idx = t_off + ii;
-                        out << target[idx];
-                    }
-                    l_MD = 0;
-                    t_off += last_len;
-                }
-            }
-        }
-        last_op = op;
-        last_len = len;
-    }
-
-    // Process the last operation
-    if (last_len) {
-        if (last_op == '=' || last_op == 'M') {
-            out << last_len + l_MD;
-        } else if (last_op == 'X') {
-            for (uint64_t ii = 0; ii < last_len; ++ii) {
-                int64_t idx = t_off + ii;
-                out << l_MD << target[idx];
-                l_MD = 0;
-            }
-            out << "0";
-        } else if (last_op == 'I') {
-            out << l_MD;
-        } else if (last_op == 'D') {
-            out << l_MD << "^";
-            for (uint64_t ii = 0; ii < last_len; ++ii) {
-                int64_t idx = t_off + ii;
-                out << target[idx];
-            }
-            out << "0";
-        }
-    }
+    thread_local std::string buf;
+    buf.clear();
+    append_md_tag(buf, cigar_ops, cigar_start, cigar_end, target_start, target);
+    out.write(buf.data(), buf.size());
 }
 
-void write_alignment_sam(
+bool write_alignment_sam(
     std::ostream &out,
     const alignment_t& patch_aln,
     const std::string& cigar_str,
@@ -2494,9 +2497,10 @@ void write_alignment_sam(
     const int64_t& target_pointer_shift,
     const int32_t& chain_id,
     const int32_t& chain_length,
-    const int32_t& chain_pos
+    const int32_t& chain_pos,
+    const bool& with_endline
 ) {
-
+    bool ret = false;  // return true if we wrote the alignment
     if (cigar_str == "") { std::cerr << "[wflign_patch] unsupported codepath" << std::endl; exit(1); }
 
     uint64_t patch_matches = 0;
@@ -2563,17 +2567,11 @@ void write_alignment_sam(
         if (no_seq_in_sam) {
             out << "*";
         } else {
-            std::stringstream seq;
             // The new patch_aln.j is "new_query_start - query_offset"
-            for (uint64_t p = (new_query_start - query_offset); p < (new_query_start - query_offset) + patch_qAlignedLength; ++p) {
-                seq << query[p];
-            }
-            if (patch_aln.is_rev) {
-                // reverse complement
-                out << reverse_complement(seq.str());
-            } else {
-                out << seq.str();
-            }
+            thread_local std::string seq;
+            seq.clear();
+            append_seq(seq, query + (new_query_start - query_offset), patch_qAlignedLength, patch_aln.is_rev);
+            out.write(seq.data(), seq.size());
         }
         out << "\t*\t"
             << "NM:i:" << (patch_mismatches + patch_inserted_bp + patch_deleted_bp) << "\t"
@@ -2594,10 +2592,14 @@ void write_alignment_sam(
                                     target);
         }
 
-        out << "\n";
+        if (with_endline) {
+            out << "\n";
+        }
+        ret = true;
     }
 
     free(patch_cigar);
+    return ret;
 }
 
 bool write_alignment_paf(
@@ -2701,9 +2703,9 @@ bool write_alignment_paf(
                 //<< "\t" << "bi:i:" << inserted_bp
                 //<< "\t" << "nd:i:" << deletions
                 //<< "\t" << "bd:i:" << deleted_bp
-                << "cg:Z:" << cigar << "\t";
+                << "cg:Z:" << cigar;
             if (with_endline) {
-                out << std::endl;
+                out << "\n";
             }
             ret = true;
         }
@@ -61,7 +61,10 @@ namespace wflign {
             alignment_t& rev_aln,
             const int64_t& chain_gap,
             const int& max_patching_score,
-            const uint64_t& min_inversion_length);
+            const uint64_t& min_inversion_length,
+            const uint64_t& min_concurrent_probe_length = 0,
+            tf::Executor* const probe_executor = nullptr,
+            const bool& orientation_filter = false);
 
         void trim_alignment(alignment_t& aln);
         
@@ -77,13 +80,27 @@ namespace wflign {
             const int64_t& chain_gap,
             const int& max_patching_score,
             const uint64_t& min_inversion_length,
-            const int& erode_k);
+            const int& erode_k,
+            const uint64_t& min_concurrent_probe_length = 0,
+            tf::Executor* const probe_executor = nullptr,
+            const bool& orientation_filter = false);
 
         double float2phred(const double& prob);
         void sort_indels(std::vector<char>& v);
 
     } /* namespace wavefront */
 
+    void process_compressed_cigar(
+            const std::string& cigar_str,
+            uint64_t& matches,
+            uint64_t& mismatches,
+            uint64_t& insertions,
+            uint64_t& inserted_bp,
+            uint64_t& deletions,
+            uint64_t& deleted_bp,
+            uint64_t& refAlignedLength,
+            uint64_t& qAlignedLength);
+
     void encodeOneStep(const char *filename, std::vector<unsigned char> &image, unsigned width, unsigned height);
 } /* namespace wflign */
 
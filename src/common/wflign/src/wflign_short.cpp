@@ -0,0 +1,270 @@
+#include "wflign_short.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#include "alignment_printer.hpp"
+#include "wflign_swizzle.hpp"
+
+namespace wflign {
+namespace wavefront {
+
+/*
+* Configuration
+*/
+#define SHORT_BAND_MIN      32  // diagonals kept on each side of the pairs' main diagonals
+#define SHORT_BAND_RATIO    8   // plus one diagonal per SHORT_BAND_RATIO bp of the longest sequence
+#define SHORT_INF           (std::numeric_limits<int32_t>::max() / 2)
+#define SHORT_MAX_TRACE     (64ULL << 20) // traceback bytes per batch, beyond which the batch goes to WFA
+
+// Traceback byte: low bits give the source of H, high bits whether each gap state was extended
+#define SHORT_SRC_DIAG      0
+#define SHORT_SRC_E1        1
+#define SHORT_SRC_E2        2
+#define SHORT_SRC_F1        3
+#define SHORT_SRC_F2        4
+#define SHORT_SRC_MASK      7
+#define SHORT_E1_EXT        8
+#define SHORT_E2_EXT        16
+#define SHORT_F1_EXT        32
+#define SHORT_F2_EXT        64
+
+static inline int32_t short_gap_cost(const wflign_penalties_t& p, const int64_t len) {
+    return (int32_t)std::min(p.gap_opening1 + len * p.gap_extension1, p.gap_opening2 + len * p.gap_extension2);
+}
+
+void align_short_batch(
+    const short_pair_t* pairs,
+    const size_t num_pairs,
+    const wflign_penalties_t& penalties,
+    std::vector<std::string>& cigars,
+    std::vector<bool>& ok) {
+    constexpr int L = SHORT_BATCH_LANES;
+    cigars.assign(num_pairs, std::string());
+    ok.assign(num_pairs, false);
+    if (num_pairs == 0) return;
+
+    // Band over diagonals k = j - i covering every pair's main diagonals plus a margin
+    int64_t max_q = 0, max_t = 0, min_diag = 0, max_diag = 0;
+    for (size_t l = 0; l < num_pairs; ++l) {
+        max_q = std::max(max_q, (int64_t)pairs[l].query_length);
+        max_t = std::max(max_t, (int64_t)pairs[l].target_length);
+        const int64_t diag = (int64_t)pairs[l].target_length - (int64_t)pairs[l].query_length;
+        min_diag = std::min(min_diag, diag);
+        max_diag = std::max(max_diag, diag);
+    }
+    const int64_t band = SHORT_BAND_MIN + std::max(max_q, max_t) / SHORT_BAND_RATIO;
+    const int64_t k_min = min_diag - band;
+    const int64_t width = (max_diag + band) - k_min + 1;
+    if ((uint64_t)(max_q + 1) * width * L > SHORT_MAX_TRACE) return;
+
+    // Lane-interleaved sequences; padding never matches, and is only read by cells outside a pair
+    thread_local std::vector<char> q_lanes, t_lanes;
+    q_lanes.assign(max_q * L, '$');
+    t_lanes.assign(max_t * L, '#');
+    for (size_t l = 0; l < num_pairs; ++l) {
+        for (uint64_t p = 0; p < pairs[l].query_length; ++p) q_lanes[p * L + l] = pairs[l].query[p];
+        for (uint64_t p = 0; p < pairs[l].target_length; ++p) t_lanes[p * L + l] = pairs[l].target[p];
+    }
+
+    // Two rolling rows of the five DP components, plus the traceback matrix
+    thread_local std::vector<int32_t> rows;
+    thread_local std::vector<uint8_t> trace;
+    rows.assign(2 * 5 * (width + 1) * L, SHORT_INF);
+    trace.assign((max_q + 1) * width * L, 0);
+    auto row = [&](const int r, const int comp) { return &rows[((r * 5 + comp) * (width + 1)) * L]; };
+
+    const int32_t x = penalties.mismatch;
+    const int32_t o1 = penalties.gap_opening1 + penalties.gap_extension1, e1 = penalties.gap_extension1;
+    const int32_t o2 = penalties.gap_opening2 + penalties.gap_extension2, e2 = penalties.gap_extension2;
+    int32_t final_score[L];
+    std::fill(final_score, final_score + L, SHORT_INF);
+
+    for (int64_t i = 0; i <= max_q; ++i) {
+        const int cur = i & 1, prev = cur ^ 1;
+        int32_t *H = row(cur, 0), *E1 = row(cur, 1), *E2 = row(cur, 2), *F1 = row(cur, 3), *F2 = row(cur, 4);
+        const int32_t *pH = row(prev, 0), *pF1 = row(prev, 3), *pF2 = row(prev, 4);
+        uint8_t* tr = &trace[i * width * L];
+        for (int64_t c = 0; c < width; ++c) {
+            const int64_t j = i + k_min + c;
+            int32_t* h = H + c * L;
+            int32_t* ee1 = E1 + c * L;
+            int32_t* ee2 = E2 + c * L;
+            int32_t* ff1 = F1 + c * L;
+            int32_t* ff2 = F2 + c * L;
+            uint8_t* t = tr + c * L;
+            if (j < 0 || j > max_t) {
+                for (int l = 0; l < L; ++l) { h[l] = ee1[l] = ee2[l] = ff1[l] = ff2[l] = SHORT_INF; }
+                continue;
+            }
+            if (i == 0 && j == 0) {
+                for (int l = 0; l < L; ++l) { h[l] = 0; ee1[l] = ee2[l] = ff1[l] = ff2[l] = SHORT_INF; t[l] = 0; }
+                continue;
+            }
+            // Left (same row, c - 1), up (previous row, c + 1) and diagonal (previous row, c)
+            const int32_t* lh = c > 0 ? H + (c - 1) * L : nullptr;
+            const int32_t* le1 = c > 0 ? E1 + (c - 1) * L : nullptr;
+            const int32_t* le2 = c > 0 ? E2 + (c - 1) * L : nullptr;
+            const int32_t* uh = pH + (c + 1) * L;
+            const int32_t* uf1 = pF1 + (c + 1) * L;
+            const int32_t* uf2 = pF2 + (c + 1) * L;
+            const int32_t* dh = pH + c * L;
+            const char* qc = i > 0 ? &q_lanes[(i - 1) * L] : nullptr;
+            const char* tc = j > 0 ? &t_lanes[(j - 1) * L] : nullptr;
+            for (int l = 0; l < L; ++l) {
+                const int32_t left_h = lh ? lh[l] : SHORT_INF;
+                const int32_t left_e1 = le1 ? le1[l] : SHORT_INF;
+                const int32_t left_e2 = le2 ? le2[l] : SHORT_INF;
+                const int32_t e1_open = left_h + o1, e1_ext = left_e1 + e1;
+                const int32_t e2_open = left_h + o2, e2_ext = left_e2 + e2;
+                const int32_t f1_open = uh[l] + o1, f1_ext = uf1[l] + e1;
+                const int32_t f2_open = uh[l] + o2, f2_ext = uf2[l] + e2;
+                const int32_t ve1 = std::min(SHORT_INF, std::min(e1_open, e1_ext));
+                const int32_t ve2 = std::min(SHORT_INF, std::min(e2_open, e2_ext));
+                const int32_t vf1 = std::min(SHORT_INF, std::min(f1_open, f1_ext));
+                const int32_t vf2 = std::min(SHORT_INF, std::min(f2_open, f2_ext));
+                const int32_t vd = (qc && tc) ? std::min(SHORT_INF, dh[l] + (qc[l] == tc[l] ? 0 : x)) : SHORT_INF;
+                int32_t best = vd;
+                uint8_t src = SHORT_SRC_DIAG;
+                if (ve1 < best) { best = ve1; src = SHORT_SRC_E1; }
+                if (ve2 < best) { best = ve2; src = SHORT_SRC_E2; }
+                if (vf1 < best) { best = vf1; src = SHORT_SRC_F1; }
+                if (vf2 < best) { best = vf2; src = SHORT_SRC_F2; }
+                h[l] = best;
+                ee1[l] = ve1;
+                ee2[l] = ve2;
+                ff1[l] = vf1;
+                ff2[l] = vf2;
+                t[l] = src
+                    | (e1_ext < e1_open ? SHORT_E1_EXT : 0)
+                    | (e2_ext < e2_open ? SHORT_E2_EXT : 0)
+                    | (f1_ext < f1_open ? SHORT_F1_EXT : 0)
+                    | (f2_ext < f2_open ? SHORT_F2_EXT : 0);
+            }
+        }
+        // Sentinel column beyond the band, read as "up" by the last cell of the next row
+        for (int comp = 0; comp < 5; ++comp) {
+            std::fill(row(cur, comp) + width * L, row(cur, comp) + (width + 1) * L, SHORT_INF);
+        }
+        for (size_t l = 0; l < num_pairs; ++l) {
+            if ((int64_t)pairs[l].query_length == i) {
+                final_score[l] = H[((int64_t)pairs[l].target_length - i - k_min) * L + l];
+            }
+        }
+    }
+
+    std::string ops;
+    for (size_t l = 0; l < num_pairs; ++l) {
+        // A path from diagonal 0 to diagonal d that crosses diagonal k_min - 1 needs at least
+        // 1 - k_min inserted and d - k_min + 1 deleted bases; one crossing k_max + 1 needs k_max + 1
+        // deleted and k_max + 1 - d inserted. Gap costs are subadditive, so either costs at least
+        // the two merged gaps, and any score below that is the unrestricted optimum
+        const int64_t d = (int64_t)pairs[l].target_length - (int64_t)pairs[l].query_length;
+        const int64_t k_max = k_min + width - 1;
+        const int64_t out_of_band_cost = std::min(
+            (int64_t)short_gap_cost(penalties, 1 - k_min) + short_gap_cost(penalties, d - k_min + 1),
+            (int64_t)short_gap_cost(penalties, k_max + 1) + short_gap_cost(penalties, k_max + 1 - d));
+        if (final_score[l] >= out_of_band_cost) continue;
+        ops.clear();
+        int64_t i = pairs[l].query_length, j = pairs[l].target_length;
+        int state = SHORT_SRC_DIAG;
+        while (i > 0 || j > 0) {
+            const uint8_t t = trace[(i * width + (j - i - k_min)) * L + l];
+            switch (state) {
+                case SHORT_SRC_DIAG:
+                    state = t & SHORT_SRC_MASK;
+                    if (state == SHORT_SRC_DIAG) {
+                        ops.push_back(pairs[l].query[i - 1] == pairs[l].target[j - 1] ? '=' : 'X');
+                        --i; --j;
+                    }
+                    break;
+                case SHORT_SRC_E1:
+                    ops.push_back('D'); --j;
+                    state = (t & SHORT_E1_EXT) ? SHORT_SRC_E1 : SHORT_SRC_DIAG;
+                    break;
+                case SHORT_SRC_E2:
+                    ops.push_back('D'); --j;
+                    state = (t & SHORT_E2_EXT) ? SHORT_SRC_E2 : SHORT_SRC_DIAG;
+                    break;
+                case SHORT_SRC_F1:
+                    ops.push_back('I'); --i;
+                    state = (t & SHORT_F1_EXT) ? SHORT_SRC_F1 : SHORT_SRC_DIAG;
+                    break;
+                default:
+                    ops.push_back('I'); --i;
+                    state = (t & SHORT_F2_EXT) ? SHORT_SRC_F2 : SHORT_SRC_DIAG;
+                    break;
+            }
+        }
+
+        // Run-length encode in forward order
+        std::string& cigar = cigars[l];
+        for (auto it = ops.rbegin(); it != ops.rend();) {
+            auto run_end = it;
+            while (run_end != ops.rend() && *run_end == *it) ++run_end;
+            cigar += std::to_string(run_end - it);
+            cigar.push_back(*it);
+            it = run_end;
+        }
+        ok[l] = true;
+    }
+}
+
+void do_short_batch_alignment(
+    const short_pair_t* pairs,
+    const size_t num_pairs,
+    std::ostream& out,
+    const wflign_penalties_t& penalties,
+    const bool emit_md_tag,
+    const bool paf_format_else_sam,
+    const bool no_seq_in_sam,
+    const float min_identity,
+    const bool emit_policy_tag,
+    std::vector<bool>& aligned) {
+    thread_local std::vector<std::string> cigars;
+    align_short_batch(pairs, num_pairs, penalties, cigars, aligned);
+
+    for (size_t k = 0; k < num_pairs; ++k) {
+        if (!aligned[k]) continue;
+        const short_pair_t& p = pairs[k];
+        alignment_t aln;
+        aln.ok = true;
+        aln.j = 0;
+        aln.i = 0;
+        aln.query_length = p.query_length;
+        aln.target_length = p.target_length;
+        aln.is_rev = false;
+        // Same end normalization as the biWFA path
+        const std::string query_seq(p.query, p.query_length), target_seq(p.target, p.target_length);
+        std::string cigar = try_swap_start_pattern(cigars[k], query_seq, target_seq, 0, 0);
+        cigar = try_swap_end_pattern(cigar, query_seq, target_seq, 0, 0);
+        bool wrote;
+        if (paf_format_else_sam) {
+            wrote = write_alignment_paf(
+                out, aln, cigar,
+                *p.query_name, p.query_total_length, p.query_offset, p.query_length, p.query_is_rev,
+                *p.target_name, p.target_total_length, p.target_offset, p.target_length,
+                min_identity, p.mashmap_estimated_identity,
+                p.chain_id, p.chain_length, p.chain_pos,
+                false);
+        } else {
+            wrote = write_alignment_sam(
+                out, aln, cigar,
+                *p.query_name, p.query_total_length, p.query_offset, p.query_length, p.query_is_rev,
+                *p.target_name, p.target_total_length, p.target_offset, p.target_length,
+                min_identity, p.mashmap_estimated_identity,
+                no_seq_in_sam, emit_md_tag, p.query, p.target, 0,
+                p.chain_id, p.chain_length, p.chain_pos,
+                false);
+        }
+        if (wrote) {
+            if (emit_policy_tag) {
+                out << "\twp:Z:batch";
+            }
+            out << "\n";
+        }
+    }
+}
+
+} // namespace wavefront
+} // namespace wflign
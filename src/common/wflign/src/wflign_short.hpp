@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "wflign_alignment.hpp"
+
+/*
+ * Batched alignment of short (read-sized) pairs.
+ * Up to SHORT_BATCH_LANES pairs are aligned in lockstep with a banded two-piece gap-affine DP, one pair
+ * per vector lane, so that the per-record cost of building a WFA aligner and patching disappears.
+ */
+#define SHORT_BATCH_LANES 16
+
+namespace wflign {
+namespace wavefront {
+
+// One (query, target) pair of a short batch, with what the writers need to report it
+struct short_pair_t {
+    const std::string* query_name;
+    const char* query;               // already in the orientation of the mapping
+    uint64_t query_total_length;
+    uint64_t query_offset;
+    uint64_t query_length;
+    bool query_is_rev;
+    const std::string* target_name;
+    const char* target;
+    uint64_t target_total_length;
+    uint64_t target_offset;
+    uint64_t target_length;
+    float mashmap_estimated_identity;
+    int32_t chain_id;
+    int32_t chain_length;
+    int32_t chain_pos;
+};
+
+// Align up to SHORT_BATCH_LANES pairs in lockstep; cigars[k] receives the compressed CIGAR of pair k
+// and ok[k] whether it is guaranteed optimal (the path could not have left the band)
+void align_short_batch(
+    const short_pair_t* pairs,
+    const size_t num_pairs,
+    const wflign_penalties_t& penalties,
+    std::vector<std::string>& cigars,
+    std::vector<bool>& ok);
+
+// Align a batch and write the records of the pairs it could align optimally; aligned[k] is false
+// for pairs the caller must align on the regular WFA path
+void do_short_batch_alignment(
+    const short_pair_t* pairs,
+    const size_t num_pairs,
+    std::ostream& out,
+    const wflign_penalties_t& penalties,
+    const bool emit_md_tag,
+    const bool paf_format_else_sam,
+    const bool no_seq_in_sam,
+    const float min_identity,
+    const bool emit_policy_tag,
+    std::vector<bool>& aligned);
+
+} // namespace wavefront
+} // namespace wflign
@@ -27,6 +27,7 @@
 // External includes
 #include "common/args.hxx"
 #include "common/ALeS.hpp"
+#include "common/perf_counters.hpp"
 
 int main(int argc, char** argv) {
     /*
@@ -40,6 +41,9 @@ int main(int argc, char** argv) {
     align::Parameters align_parameters;
     yeet::Parameters yeet_parameters;
     yeet::parse_args(argc, argv, map_parameters, align_parameters, yeet_parameters);
+    if (!yeet_parameters.perf_counters_file.empty()) {
+        perf_counters::enable(yeet_parameters.perf_counters_file);
+    }
 
     //parameters.refSequences.push_back(ref);
 
@@ -56,12 +60,16 @@ int main(int argc, char** argv) {
           float similarity = map_parameters.spaced_seed_params.similarity;
           uint32_t region_length = map_parameters.spaced_seed_params.region_length;
 
-          ales::spaced_seeds sps = ales::generate_spaced_seeds(seed_weight, seed_count, similarity, region_length);
+          ales::spaced_seeds sps = ales::generate_spaced_seeds(seed_weight, seed_count, similarity, region_length,
+                                                               map_parameters.threads, ales::default_cache_dir());
           std::chrono::duration<double> time_spaced_seeds = skch::Time::now() - t0;
           map_parameters.spaced_seed_sensitivity = sps.sensitivity;
           map_parameters.spaced_seeds =  sps.seeds;
           ales::printSpacedSeeds(map_parameters.spaced_seeds);
           std::cerr << "[wfmash::mashmap] Generated spaced seeds in " << time_spaced_seeds.count() << "s (sensitivity: " << sps.sensitivity << ")" << std::endl;
+        } else if (!map_parameters.spaced_seeds.empty()) {
+          std::cerr << "[wfmash::mashmap] Using spaced seeds:" << std::endl;
+          ales::printSpacedSeeds(map_parameters.spaced_seeds);
         }
 
         //Map the sequences in query file
@@ -73,6 +81,10 @@ int main(int argc, char** argv) {
         std::cerr << "[wfmash::mashmap] Mapped query in " << timeMapQuery.count() << "s, results saved to: " << map_parameters.outFileName << std::endl;
 
         if (yeet_parameters.approx_mapping) {
+            if (align_parameters.sort_by_target) {
+                align::Aligner sortObj(align_parameters);
+                sortObj.sortMappings(map_parameters.outFileName);
+            }
             return 0;
         }
      }
@@ -84,6 +96,11 @@ int main(int argc, char** argv) {
     std::chrono::duration<double> timeRefRead = skch::Time::now() - t0;
     std::cerr << "[wfmash::align] time spent loading the reference index: " << timeRefRead.count() << " sec" << std::endl;
 
+    if (align_parameters.replay) {
+        alignObj.replay();
+        return 0;
+    }
+
     //Compute the alignments
     alignObj.compute();
 
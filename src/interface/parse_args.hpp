@@ -26,6 +26,7 @@ namespace yeet {
 struct Parameters {
     bool approx_mapping = false;
     bool remapping = false;
+    std::string perf_counters_file;       //TSV of hardware counters and timings per stage (empty=off)
 };
 
 void parse_args(int argc,
@@ -53,6 +54,9 @@ void parse_args(int argc,
     args::ValueFlag<std::string> index_by(indexing_opts, "SIZE", "target batch size for indexing [4G]", {'b', "batch"});
     args::ValueFlag<int64_t> sketch_size(indexing_opts, "INT", "sketch size for MinHash [auto]", {'w', "sketch-size"});
     args::ValueFlag<int> kmer_size(indexing_opts, "INT", "k-mer size [15]", {'k', "kmer-size"});
+    args::ValueFlag<std::string> spaced_seeds(indexing_opts, "SPEC", "spaced seeds: W,N,P,L to generate N seeds of weight W with ALeS (similarity P, region L), or comma-separated 0/1 patterns", {"spaced-seeds"});
+    args::ValueFlag<int> syncmers(indexing_opts, "INT", "consider only open syncmers with INT-mers as minimizer candidates, ~1/(k-INT+1) of all k-mers [0, off]", {"syncmers"});
+    args::ValueFlag<double> index_sampling(indexing_opts, "FLOAT", "keep this fraction of minimizers, chosen by hash, in index and query sketches [1.0]", {"index-sampling"});
 
     args::Group mapping_opts(options_group, "Mapping:");
     args::Flag approx_mapping(mapping_opts, "", "output approximate mappings (no alignment)", {'m', "approx-mapping"});
@@ -78,6 +82,13 @@ void parse_args(int argc,
     args::Flag no_filter(mapping_opts, "", "disable mapping filtering", {'f', "no-filter"});
     args::Flag no_merge(mapping_opts, "", "disable merging of consecutive mappings", {'M', "no-merge"});
     args::ValueFlag<double> kmer_complexity(mapping_opts, "FLOAT", "minimum k-mer complexity threshold", {'J', "kmer-cmplx"});
+    args::ValueFlag<std::string> save_raw_mappings(mapping_opts, "FILE", "save unfiltered mappings to FILE for re-filtering", {"save-raw-mappings"});
+    args::ValueFlag<std::string> from_raw_mappings(mapping_opts, "FILE", "re-run only filtering, chaining and scaffolding on mappings saved in FILE", {"from-raw-mappings"});
+    args::ValueFlag<std::string> sweep(mapping_opts, "SPEC", "also write one output per filter configuration, mapping once; SPEC is ';'-separated lists of p=,n=,l=,c=,o= overrides", {"sweep"});
+    args::ValueFlag<std::string> sweep_prefix(mapping_opts, "PREFIX", "sweep outputs are PREFIX.<config>.paf, or .tsv with --ani-matrix [wfmash.sweep]", {"sweep-prefix"});
+    args::ValueFlag<double> heavy_posting_ratio(mapping_opts, "FLOAT", "walk posting lists longer than FLOAT x the fragment median only near hits of rarer minimizers, lossy, 0 = off [0]", {"heavy-posting-ratio"});
+    args::ValueFlag<std::string> rare_seed_first(mapping_opts, "INT", "walk the longest posting lists only near hits of the rarest minimizers when a fragment's lists hold > INT points, 0 = never [100k]", {"rare-seed-first"});
+    args::ValueFlag<double> map_sparsification(mapping_opts, "FLOAT", "map only this fraction of query fragments, chosen deterministically [1.0]", {"sparsification"});
     args::ValueFlag<std::string> hg_filter(mapping_opts, "numer,ani-Δ,conf", "hypergeometric filter params [1.0,0.0,99.9]", {"hg-filter"});
     args::ValueFlag<int> min_hits(mapping_opts, "INT", "minimum number of hits for L1 filtering [auto]", {'H', "l1-hits"});
     args::ValueFlag<double> max_kmer_freq(mapping_opts, "FLOAT", "filter minimizers occurring > FLOAT of total [0.0002]", {'F', "filter-freq"});
@@ -89,19 +100,43 @@ void parse_args(int argc,
     args::ValueFlag<std::string> wfa_params(alignment_opts, "vals", 
         "scoring: mismatch, gap1(o,e), gap2(o,e) [5,8,2,24,1]", {'g', "wfa-params"});
     args::Flag disable_chain_patching(alignment_opts, "", "disable alignment patching at chain boundaries", {"disable-chain-patching"});
+    args::ValueFlag<std::string> wfa_heuristic(alignment_opts, "MODE", "WFA heuristic: auto, none, adaptive, xdrop [auto: adaptive when the exact backtrace exceeds --wfa-max-memory, else none]", {"wfa-heuristic"});
+    args::ValueFlag<std::string> wfa_max_memory(alignment_opts, "SIZE", "memory budget per alignment for WFA mode selection [1G]", {"wfa-max-memory"});
+    args::ValueFlag<std::string> max_align_steps(alignment_opts, "INT", "max WFA steps per record before escalating to WFlign [0=unlimited]", {"max-align-steps"});
+    args::ValueFlag<double> max_align_time(alignment_opts, "SECS", "time budget per record, checked when biWFA stops at --max-align-steps and during WFlign, before emitting an approximate mapping (an unmapped record in SAM) [0=unlimited]", {"max-align-time"});
+    args::ValueFlag<float> min_align_identity(alignment_opts, "FLOAT", "drop alignments below this gap-compressed identity, in percent [0=keep all]", {"min-identity"});
+    args::Flag identity_prepass(alignment_opts, "", "abort alignments whose score already rules out --min-identity (lossless unless a WFA heuristic is in use, see --wfa-heuristic)", {"identity-prepass"});
+    args::Flag force_wflign(alignment_opts, "", "force WFlign alignment", {"force-wflign"});
+    args::ValueFlag<int> wflambda_segment_length(alignment_opts, "N", "WFlambda segment length [256]", {"wflambda-segment"});
+    args::ValueFlag<std::string> wflign_min_length(alignment_opts, "INT", "align mappings at least this long with WFlign when below --wflign-max-identity [25k, 0=never]", {"wflign-min-length"});
+    args::ValueFlag<double> wflign_max_identity(alignment_opts, "FLOAT", "estimated identity below which long mappings are aligned with WFlign [0.90]", {"wflign-max-identity"});
+    args::ValueFlag<std::string> short_align_max_len(alignment_opts, "INT", "align records with queries up to this long in batches of 16 [0, off]", {"short-align-max-len"});
+    args::Flag patch_orientation_filter(alignment_opts, "", "skip the inverted probe of WFlign patches whose 12-mers favour the forward strand (lossy)", {"patch-orientation-filter"});
+    args::ValueFlag<std::string> parallel_probe_len(alignment_opts, "INT", "run forward and inverted probes of WFlign patches at least this long concurrently, on idle -t workers [0=never]", {"parallel-probe-len"});
+    args::ValueFlag<std::string> replay_record(alignment_opts, "N", "align only record N of the input PAF ('-' reads one PAF line from stdin) and report per-phase timings", {"replay-record"});
+    args::ValueFlag<uint64_t> replay_repeats(alignment_opts, "INT", "times the replayed record is aligned [10]", {"replay-repeats"});
+    args::ValueFlag<std::string> replay_bundle(alignment_opts, "PREFIX", "write the replayed record as a test case: PREFIX.fa, PREFIX.paf and PREFIX.expected.paf", {"replay-bundle"});
 
     args::Group output_opts(options_group, "Output Format:");
     args::Flag sam_format(output_opts, "", "output in SAM format (PAF by default)", {'a', "sam"});
     args::Flag emit_md_tag(output_opts, "", "output MD tag", {'d', "md-tag"});
+    args::Flag emit_policy_tag(output_opts, "", "output the WFA policy of each alignment as a wp:Z: tag", {"policy-tag"});
     args::Flag no_seq_in_sam(output_opts, "", "omit sequence field in SAM output", {'q', "no-seq-sam"});
+    args::ValueFlag<std::string> sort_output(output_opts, "KEY", "sort the output by KEY ('target': reference order, then start)", {"sort-output"});
+    args::ValueFlag<std::string> sort_memory(output_opts, "SIZE", "memory for buffered records and the sorted run being spilled [1G, or 1/4 of --max-memory]", {"sort-memory"});
+    args::ValueFlag<std::string> output_shards(output_opts, "PREFIX", "write each target's sorted records to PREFIX.<target>.paf|sam", {"output-shards"});
+    args::ValueFlag<std::string> output_index(output_opts, "FILE", "write a coordinate index of the sorted output to FILE", {"output-index"});
+    args::Flag ani_matrix(output_opts, "", "output covered bases and mapping identity per query group and target group (see -Y) instead of mappings, implies -m", {"ani-matrix"});
 
 
 
     args::Group system_opts(options_group, "System:");
-    args::ValueFlag<int> thread_count(system_opts, "INT", "number of threads [1]", {'t', "threads"});
+    args::ValueFlag<std::string> thread_count(system_opts, "INT", "number of threads, 'auto' for the CPUs of the container or job [1]", {'t', "threads"});
+    args::ValueFlag<std::string> max_memory(system_opts, "SIZE", "memory budget for index batches and alignments, 'auto' for the container or job limit [none]", {"max-memory"});
     args::ValueFlag<std::string> tmp_base(system_opts, "PATH", "base directory for temporary files [pwd]", {'B', "tmp-base"});
     args::Flag keep_temp_files(system_opts, "", "retain temporary files", {'Z', "keep-temp"});
     args::Flag quiet(system_opts, "", "disable progress output", {"quiet"});
+    args::ValueFlag<std::string> perf_counters_file(system_opts, "FILE", "write hardware counters (perf_event_open) and timings per stage to FILE", {"perf-counters"});
 
 #ifdef WFA_PNG_TSV_TIMING
     args::Group debugging_opts(parser, "[ Debugging Options ]");
@@ -202,20 +237,6 @@ void parse_args(int argc,
         }
     }
 
-    args::ValueFlag<double> map_sparsification(parser, "FLOAT", "sparsification factor [1.0]", {"sparsification"});
-    if (map_sparsification) {
-        if (args::get(map_sparsification) == 1) {
-            // overflows
-            map_parameters.sparsity_hash_threshold = std::numeric_limits<uint64_t>::max();
-        } else {
-            map_parameters.sparsity_hash_threshold
-                = args::get(map_sparsification) * std::numeric_limits<uint64_t>::max();
-        }
-    } else {
-        map_parameters.sparsity_hash_threshold
-            = std::numeric_limits<uint64_t>::max();
-    }
-
     args::ValueFlag<std::string> wfa_score_params(alignment_opts, "MISMATCH,GAP,EXT", "WFA scoring parameters [2,3,1]", {"wfa-params"});
     if (!args::get(wfa_score_params).empty()) {
         const std::vector<std::string> params_str = skch::CommonFunc::split(args::get(wfa_score_params), ',');
@@ -272,11 +293,12 @@ void parse_args(int argc,
     align_parameters.wflign_max_distance_threshold = -1;
 
     align_parameters.emit_md_tag = args::get(emit_md_tag);
+    align_parameters.emit_policy_tag = args::get(emit_policy_tag);
     align_parameters.sam_format = args::get(sam_format);
     align_parameters.no_seq_in_sam = args::get(no_seq_in_sam);
     align_parameters.disable_chain_patching = args::get(disable_chain_patching);
-    args::Flag force_wflign(alignment_opts, "", "force WFlign alignment", {"force-wflign"});
     align_parameters.force_wflign = args::get(force_wflign);
+    align_parameters.identity_prepass = args::get(identity_prepass);
     map_parameters.split = !args::get(no_split);
     map_parameters.dropRand = false;//ToFix: !args::get(keep_ties);
     align_parameters.split = !args::get(no_split);
@@ -420,39 +442,39 @@ void parse_args(int argc,
         map_parameters.kmerSize = 15;
     }
 
-    //if (spaced_seed_params) {
-        //const std::string foobar = args::get(spaced_seed_params);
-
-        //// delimeters can be full colon (:) or a space
-        //char delimeter;
-        //if (foobar.find(' ') !=  std::string::npos) {
-            //delimeter = ' ';
-        //} else if (foobar.find(':') !=  std::string::npos) {
-            //delimeter = ':';
-        //} else {
-            //std::cerr << "[wfmash] ERROR, skch::parseandSave, wfmash expects either space or : for to seperate spaced seed params." << std::endl;
-            //exit(1);
-        //}
-
-        //const std::vector<std::string> p = skch::CommonFunc::split(foobar, delimeter);
-        //if (p.size() != 4) {
-            //std::cerr << "[wfmash] ERROR, skch::parseandSave, there should be four arguments for spaced seeds." << std::endl;
-            //exit(1);
-        //}
-
-        //const uint32_t seed_weight   = stoi(p[0]);
-        //const uint32_t seed_count    = stoi(p[1]);
-        //const float similarity       = stof(p[2]);
-        //const uint32_t region_length = stoi(p[3]);
-
-        //// Generate an ALeS params struct
-        //map_parameters.use_spaced_seeds = true;
-        //map_parameters.spaced_seed_params = skch::ales_params{seed_weight, seed_count, similarity, region_length};
-        //map_parameters.kmerSize = (int) seed_weight;
-    //} else {
-        //map_parameters.use_spaced_seeds = false;
-    //}
     map_parameters.use_spaced_seeds = false;
+    if (spaced_seeds) {
+        const std::vector<std::string> p = skch::CommonFunc::split(args::get(spaced_seeds), ',');
+        // An explicit seed set is read as patterns of 1 = compared position, 0 = wildcard,
+        // all starting and ending with 1 and sharing the same weight
+        const auto weight_of = [](const std::string& s) { return (uint32_t) std::count(s.begin(), s.end(), '1'); };
+        const bool patterns = std::all_of(p.begin(), p.end(), [&](const std::string& s) {
+            return s.size() > 1 && s.find_first_not_of("01") == std::string::npos
+                && s.front() == '1' && s.back() == '1' && weight_of(s) == weight_of(p[0]);
+        });
+        if (patterns) {
+            for (const auto& s : p) {
+                map_parameters.spaced_seeds.push_back(ales::spaced_seed{strdup(s.c_str()), s.size()});
+            }
+            const uint32_t weight = weight_of(p[0]);
+            map_parameters.kmerSize = weight;
+        } else if (p.size() == 4) {
+            const uint32_t seed_weight   = std::stoi(p[0]);
+            const uint32_t seed_count    = std::stoi(p[1]);
+            const float similarity       = std::stof(p[2]);
+            const uint32_t region_length = std::stoi(p[3]);
+            if (seed_weight < 2 || seed_count == 0 || similarity <= 0 || similarity > 1 || region_length < seed_weight) {
+                std::cerr << "[wfmash] ERROR: invalid --spaced-seeds parameters " << args::get(spaced_seeds) << "." << std::endl;
+                exit(1);
+            }
+            map_parameters.use_spaced_seeds = true;
+            map_parameters.spaced_seed_params = skch::ales_params{seed_weight, seed_count, similarity, region_length};
+            map_parameters.kmerSize = (int) seed_weight;
+        } else {
+            std::cerr << "[wfmash] ERROR: --spaced-seeds expects W,N,P,L or comma-separated 0/1 patterns of equal weight that start and end with 1." << std::endl;
+            exit(1);
+        }
+    }
 
     align_parameters.kmerSize = map_parameters.kmerSize;
 
@@ -473,9 +495,20 @@ void parse_args(int argc,
 //        std::cerr << "[wfmash] INFO, skch::parseandSave, read " << map_parameters.high_freq_kmers.size() << " high frequency kmers." << std::endl;
 //    }
 
-    align_parameters.min_identity = 0; // disabled
+    if (min_align_identity) {
+        if (args::get(min_align_identity) < 0 || args::get(min_align_identity) > 100) {
+            std::cerr << "[wfmash] ERROR: --min-identity must be between 0 and 100." << std::endl;
+            exit(1);
+        }
+        align_parameters.min_identity = args::get(min_align_identity) / 100.0; // scale to [0,1]
+    } else {
+        align_parameters.min_identity = 0; // disabled
+    }
+    if (align_parameters.identity_prepass && align_parameters.min_identity <= 0) {
+        std::cerr << "[wfmash] ERROR: --identity-prepass needs an identity threshold, set with --min-identity." << std::endl;
+        exit(1);
+    }
 
-    args::ValueFlag<int> wflambda_segment_length(alignment_opts, "N", "WFlambda segment length [256]", {"wflambda-segment"});
     if (wflambda_segment_length) {
         align_parameters.wflambda_segment_length = args::get(wflambda_segment_length);
     } else {
@@ -488,6 +521,106 @@ void parse_args(int argc,
     align_parameters.wflign_min_inv_patch_len = 23;
     align_parameters.wflign_max_patching_score = 0; // will trigger estimation based on gap penalties and sequence length
 
+    if (wfa_heuristic) {
+        const std::string h = args::get(wfa_heuristic);
+        if (h == "auto") {
+            align_parameters.wfa_heuristic = 0;
+        } else if (h == "none") {
+            align_parameters.wfa_heuristic = 1;
+        } else if (h == "adaptive") {
+            align_parameters.wfa_heuristic = 2;
+        } else if (h == "xdrop") {
+            align_parameters.wfa_heuristic = 3;
+        } else {
+            std::cerr << "[wfmash] ERROR: --wfa-heuristic must be one of auto, none, adaptive, xdrop." << std::endl;
+            exit(1);
+        }
+    } else {
+        align_parameters.wfa_heuristic = 0;
+    }
+
+    if (wfa_max_memory) {
+        const int64_t m = wfmash::handy_parameter(args::get(wfa_max_memory));
+        if (m <= 0) {
+            std::cerr << "[wfmash] ERROR: --wfa-max-memory must be greater than 0." << std::endl;
+            exit(1);
+        }
+        align_parameters.wfa_max_memory = m;
+    } else {
+        align_parameters.wfa_max_memory = 1000000000; // 1G
+    }
+
+    if (max_align_steps) {
+        const int64_t steps = wfmash::handy_parameter(args::get(max_align_steps));
+        if (steps < 0 || steps > std::numeric_limits<int>::max()) {
+            std::cerr << "[wfmash] ERROR: --max-align-steps must be between 0 and " << std::numeric_limits<int>::max() << "." << std::endl;
+            exit(1);
+        }
+        align_parameters.wfa_max_steps = (int)steps;
+    } else {
+        align_parameters.wfa_max_steps = 0;
+    }
+
+    if (max_align_time) {
+        if (args::get(max_align_time) < 0) {
+            std::cerr << "[wfmash] ERROR: --max-align-time must be >= 0." << std::endl;
+            exit(1);
+        }
+        align_parameters.align_max_seconds = args::get(max_align_time);
+        if (align_parameters.align_max_seconds > 0 && align_parameters.wfa_max_steps <= 0) {
+            std::cerr << "[wfmash] ERROR: --max-align-time needs --max-align-steps, as biWFA only stops at a step limit." << std::endl;
+            exit(1);
+        }
+    } else {
+        align_parameters.align_max_seconds = 0;
+    }
+
+    if (wflign_min_length) {
+        const int64_t len = wfmash::handy_parameter(args::get(wflign_min_length));
+        if (len < 0) {
+            std::cerr << "[wfmash] ERROR: --wflign-min-length must be >= 0." << std::endl;
+            exit(1);
+        }
+        align_parameters.wflign_min_length = len;
+    } else {
+        align_parameters.wflign_min_length = 25000;
+    }
+
+    if (wflign_max_identity) {
+        const double id = args::get(wflign_max_identity);
+        if (id < 0 || id > 1) {
+            std::cerr << "[wfmash] ERROR: --wflign-max-identity must be between 0 and 1." << std::endl;
+            exit(1);
+        }
+        align_parameters.wflign_max_identity = id;
+    } else {
+        align_parameters.wflign_max_identity = 0.90;
+    }
+
+    align_parameters.wflign_orientation_filter = patch_orientation_filter;
+
+    if (parallel_probe_len) {
+        const int64_t len = wfmash::handy_parameter(args::get(parallel_probe_len));
+        if (len < 0) {
+            std::cerr << "[wfmash] ERROR: --parallel-probe-len must be >= 0." << std::endl;
+            exit(1);
+        }
+        align_parameters.wflign_parallel_probe_len = len;
+    } else {
+        align_parameters.wflign_parallel_probe_len = 0;
+    }
+
+    if (short_align_max_len) {
+        const int64_t len = wfmash::handy_parameter(args::get(short_align_max_len));
+        if (len < 0) {
+            std::cerr << "[wfmash] ERROR: --short-align-max-len must be >= 0." << std::endl;
+            exit(1);
+        }
+        align_parameters.short_align_max_len = len;
+    } else {
+        align_parameters.short_align_max_len = 0;
+    }
+
     if (target_padding) {
         const int64_t p = wfmash::handy_parameter(args::get(target_padding));
         if (p < 0) {
@@ -512,19 +645,135 @@ void parse_args(int argc,
         align_parameters.query_padding = std::min(map_parameters.segLength, (int64_t)5000);
     }
 
-    if (thread_count) {
-        map_parameters.threads = args::get(thread_count);
-        align_parameters.threads = args::get(thread_count);
+    // Limits of the container or job, only looked up when asked for
+    const bool threads_auto = thread_count && args::get(thread_count) == "auto";
+    const bool max_memory_auto = max_memory && args::get(max_memory) == "auto";
+    wfmash::resource_limits_t limits;
+    if (threads_auto || max_memory_auto) {
+        limits = wfmash::detect_resource_limits();
+    }
+
+    if (threads_auto) {
+        map_parameters.threads = limits.cpus;
+        align_parameters.threads = limits.cpus;
+    } else if (thread_count) {
+        const int64_t t = wfmash::handy_parameter(args::get(thread_count));
+        if (t <= 0) {
+            std::cerr << "[wfmash] ERROR: -t/--threads must be a positive integer or 'auto'." << std::endl;
+            exit(1);
+        }
+        map_parameters.threads = t;
+        align_parameters.threads = t;
     } else {
         map_parameters.threads = 1;
         align_parameters.threads = 1;
     }
+
+    // Memory budget (0 = none): when set, it sizes whatever was not given explicitly
+    uint64_t memory_budget = 0;
+    if (max_memory_auto) {
+        memory_budget = limits.memory;
+    } else if (max_memory) {
+        const int64_t m = wfmash::handy_parameter(args::get(max_memory));
+        if (m <= 0) {
+            std::cerr << "[wfmash] ERROR: --max-memory must be a positive size or 'auto'." << std::endl;
+            exit(1);
+        }
+        memory_budget = m;
+    }
+    if (memory_budget > 0 && !wfa_max_memory) {
+        // Half of the budget for the alignments running at once, one per thread
+        align_parameters.wfa_max_memory = std::max<uint64_t>(1, memory_budget / (2 * align_parameters.threads));
+    }
     // disable multi-fasta processing due to the memory inefficiency of samtools faidx readers
     // which require us to duplicate the in-memory indexes of large files for each thread
     // if aligner exhaustion is a problem, we could enable this
     align_parameters.multithread_fasta_input = false;
 
-    // Compute optimal window size for sketching
+    if (num_mappings) {
+        if (args::get(num_mappings) > 0) {
+            map_parameters.numMappingsForSegment = args::get(num_mappings);
+        } else {
+            std::cerr << "[wfmash] ERROR: the number of mappings to retain (-n) must be greater than 0." << std::endl;
+            exit(1);
+        }
+    } else {
+        map_parameters.numMappingsForSegment = 1;
+    }
+
+    map_parameters.numMappingsForShortSequence = 1;
+
+    if (sweep) {
+        // The main output is the first configuration; mapping runs at the loosest identity of all
+        map_parameters.sweep.push_back({"", map_parameters.percentageIdentity, map_parameters.numMappingsForSegment,
+                                        map_parameters.block_length, map_parameters.chain_gap, map_parameters.filterMode});
+        map_parameters.sweep_prefix = sweep_prefix ? args::get(sweep_prefix) : "wfmash.sweep";
+        // A value that does not parse as a whole is an error, not a silent 0 or a prefix
+        auto sweep_number = [](const std::string& field, const std::string& value) {
+            size_t parsed = 0;
+            double number = 0;
+            try {
+                number = std::stod(value, &parsed);
+            } catch (const std::exception&) {
+                parsed = 0;
+            }
+            if (parsed != value.size()) {
+                std::cerr << "[wfmash] ERROR: --sweep entry '" << field << "' does not have a numeric value." << std::endl;
+                exit(1);
+            }
+            return number;
+        };
+        std::stringstream configs(args::get(sweep));
+        std::string spec;
+        while (std::getline(configs, spec, ';')) {
+            if (spec.empty()) continue;
+            skch::sweep_config_t config = map_parameters.sweep.front();
+            std::stringstream fields(spec);
+            std::string field;
+            while (std::getline(fields, field, ',')) {
+                const auto eq = field.find('=');
+                const std::string key = field.substr(0, eq);
+                const std::string value = eq == std::string::npos ? "" : field.substr(eq + 1);
+                if (value.empty()) {
+                    std::cerr << "[wfmash] ERROR: --sweep entry '" << field << "' is not KEY=VALUE." << std::endl;
+                    exit(1);
+                }
+                config.label += (config.label.empty() ? "" : ".") + key + value;
+                if (key == "p") {
+                    config.percentageIdentity = sweep_number(field, value) / 100.0;
+                } else if (key == "n") {
+                    const double n = sweep_number(field, value);
+                    if (n < 1 || n != std::floor(n) || n > std::numeric_limits<uint32_t>::max()) {
+                        std::cerr << "[wfmash] ERROR: --sweep entry '" << field << "' must be a positive integer." << std::endl;
+                        exit(1);
+                    }
+                    config.numMappingsForSegment = n;
+                } else if (key == "l") {
+                    config.block_length = wfmash::handy_parameter(value);
+                } else if (key == "c") {
+                    config.chain_gap = wfmash::handy_parameter(value);
+                } else if (key == "o") {
+                    if (map_parameters.filterMode != skch::filter::NONE) {
+                        config.filterMode = value == "1" ? skch::filter::ONETOONE : skch::filter::MAP;
+                    }
+                } else {
+                    std::cerr << "[wfmash] ERROR: --sweep key '" << key << "' is not one of p, n, l, c, o." << std::endl;
+                    exit(1);
+                }
+            }
+            if (config.percentageIdentity <= 0 || config.percentageIdentity > 1 || config.numMappingsForSegment == 0
+                || config.block_length < 0 || config.chain_gap < 0) {
+                std::cerr << "[wfmash] ERROR: invalid --sweep configuration '" << spec << "'." << std::endl;
+                exit(1);
+            }
+            map_parameters.sweep.push_back(config);
+        }
+        for (const auto& config : map_parameters.sweep) {
+            map_parameters.percentageIdentity = std::min(map_parameters.percentageIdentity, config.percentageIdentity);
+        }
+    }
+
+    // Compute optimal window size for sketching, from the loosest identity of a sweep
     {
         const int64_t ss = sketch_size && args::get(sketch_size) >= 0 ? args::get(sketch_size) : -1;
         if (ss > 0) {
@@ -543,6 +792,20 @@ void parse_args(int argc,
         map_parameters.kmerComplexityThreshold = 0;
     }
 
+    if (map_sparsification) {
+        const double f = args::get(map_sparsification);
+        if (f <= 0 || f > 1) {
+            std::cerr << "[wfmash] ERROR: --sparsification must be in (0,1]." << std::endl;
+            exit(1);
+        }
+        // 1 would overflow
+        map_parameters.sparsity_hash_threshold = f == 1
+            ? std::numeric_limits<uint64_t>::max()
+            : (uint64_t)(f * (long double)std::numeric_limits<uint64_t>::max());
+    } else {
+        map_parameters.sparsity_hash_threshold = std::numeric_limits<uint64_t>::max();
+    }
+
     args::ValueFlag<double> hg_numerator(mapping_opts, "FLOAT", "hypergeometric filter numerator [1.0]", {"hg-numerator"});
     if (hg_numerator) {
         double value = args::get(hg_numerator);
@@ -645,6 +908,56 @@ void parse_args(int argc,
         map_parameters.create_index_only = false;
     }
 
+    map_parameters.save_raw_mappings = save_raw_mappings ? args::get(save_raw_mappings) : "";
+    map_parameters.from_raw_mappings = from_raw_mappings ? args::get(from_raw_mappings) : "";
+    if (from_raw_mappings && (save_raw_mappings || write_index)) {
+        std::cerr << "[wfmash] ERROR: --from-raw-mappings cannot be combined with --save-raw-mappings or --write-index." << std::endl;
+        exit(1);
+    }
+
+    if (rare_seed_first) {
+        const int64_t n = wfmash::handy_parameter(args::get(rare_seed_first));
+        if (n < 0) {
+            std::cerr << "[wfmash] ERROR: --rare-seed-first must be a non-negative integer." << std::endl;
+            exit(1);
+        }
+        map_parameters.rare_seed_first_postings = n;
+    }
+
+    if (heavy_posting_ratio) {
+        map_parameters.heavy_posting_ratio = args::get(heavy_posting_ratio);
+        if (map_parameters.heavy_posting_ratio < 0) {
+            std::cerr << "[wfmash] ERROR: --heavy-posting-ratio must be >= 0." << std::endl;
+            exit(1);
+        }
+    }
+
+    if (index_sampling) {
+        const double f = args::get(index_sampling);
+        if (f <= 0 || f > 1) {
+            std::cerr << "[wfmash] ERROR: --index-sampling must be in (0, 1]." << std::endl;
+            exit(1);
+        }
+        map_parameters.index_sampling = f;
+    } else {
+        map_parameters.index_sampling = 1.0;
+    }
+
+    if (syncmers) {
+        const int s = args::get(syncmers);
+        if (s <= 0 || s >= map_parameters.kmerSize) {
+            std::cerr << "[wfmash] ERROR: --syncmers must be in [1, k-1]." << std::endl;
+            exit(1);
+        }
+        if (!map_parameters.spaced_seeds.empty() || map_parameters.use_spaced_seeds) {
+            std::cerr << "[wfmash] ERROR: --syncmers cannot be combined with --spaced-seeds." << std::endl;
+            exit(1);
+        }
+        map_parameters.syncmerSize = s;
+    } else {
+        map_parameters.syncmerSize = 0;
+    }
+
     if (index_by) {
         const int64_t index_size = wfmash::handy_parameter(args::get(index_by));
         if (index_size < 0) {
@@ -652,11 +965,24 @@ void parse_args(int argc,
             exit(1);
         }
         map_parameters.index_by_size = static_cast<int64_t>(index_size);
+    } else if (memory_budget > 0) {
+        // Each indexed window costs a MinmerInfo plus its two interval points and a hash table slot;
+        // windows come at about 2*w/s per bp, and the build holds each of them about twice
+        const double bytes_per_bp = 2.0 * map_parameters.sketchSize / map_parameters.segLength * map_parameters.index_sampling
+            * (sizeof(skch::MinmerInfo) + 2 * sizeof(skch::IntervalPoint) + 16) * 2;
+        // Half of the budget for the index of a batch
+        map_parameters.index_by_size = std::max<int64_t>(map_parameters.segLength, memory_budget / 2 / bytes_per_bp);
     } else {
         map_parameters.index_by_size = std::numeric_limits<int64_t>::max(); // Default to indexing all sequences
     }
 
-    if (approx_mapping) {
+    map_parameters.ani_matrix = ani_matrix;
+    if (ani_matrix && (sort_output || output_shards || input_mapping)) {
+        std::cerr << "[wfmash] ERROR: --ani-matrix cannot be combined with --sort-output, --output-shards or -i/--align-paf." << std::endl;
+        exit(1);
+    }
+
+    if (approx_mapping || ani_matrix) {
         map_parameters.outFileName = "/dev/stdout";
         yeet_parameters.approx_mapping = true;
     } else {
@@ -688,6 +1014,66 @@ void parse_args(int argc,
         align_parameters.pafOutputFile = "/dev/stdout";
     }
 
+    align_parameters.replay = replay_record;
+    align_parameters.replay_record = 0;
+    if (replay_record) {
+        if (approx_mapping || ani_matrix) {
+            std::cerr << "[wfmash] ERROR: --replay-record cannot be used with -m/--approx-mapping or --ani-matrix." << std::endl;
+            exit(1);
+        }
+        const std::string record = args::get(replay_record);
+        if (record != "-") {
+            if (record.empty() || record.find_first_not_of("0123456789") != std::string::npos || std::stoull(record) < 1) {
+                std::cerr << "[wfmash] ERROR: --replay-record must be a record number >= 1 or '-'." << std::endl;
+                exit(1);
+            }
+            if (!input_mapping) {
+                std::cerr << "[wfmash] ERROR: --replay-record N requires the input PAF (-i/--align-paf)." << std::endl;
+                exit(1);
+            }
+            align_parameters.replay_record = std::stoull(record);
+        }
+        // The record comes from the given mappings: skip the mapping step
+        yeet_parameters.remapping = true;
+    } else if (replay_repeats || replay_bundle) {
+        std::cerr << "[wfmash] ERROR: --replay-repeats and --replay-bundle require --replay-record." << std::endl;
+        exit(1);
+    }
+    if (replay_repeats && args::get(replay_repeats) == 0) {
+        std::cerr << "[wfmash] ERROR: --replay-repeats must be > 0." << std::endl;
+        exit(1);
+    }
+    align_parameters.replay_repeats = replay_repeats ? args::get(replay_repeats) : 10;
+    align_parameters.replay_bundle = replay_bundle ? args::get(replay_bundle) : "";
+
+    align_parameters.sort_by_target = sort_output || output_shards;
+    if (sort_output && args::get(sort_output) != "target") {
+        std::cerr << "[wfmash] ERROR: --sort-output only supports 'target'." << std::endl;
+        exit(1);
+    }
+    if (output_index && !align_parameters.sort_by_target) {
+        std::cerr << "[wfmash] ERROR: --output-index requires --sort-output target or --output-shards." << std::endl;
+        exit(1);
+    }
+    if (sort_memory) {
+        const int64_t m = wfmash::handy_parameter(args::get(sort_memory));
+        if (m <= 0) {
+            std::cerr << "[wfmash] ERROR: --sort-memory must be a positive size." << std::endl;
+            exit(1);
+        }
+        align_parameters.sort_memory = m;
+    } else {
+        align_parameters.sort_memory = memory_budget > 0 ? memory_budget / 4 : 1000000000; // 1G
+    }
+    align_parameters.output_shards = output_shards ? args::get(output_shards) : "";
+    align_parameters.output_index = output_index ? args::get(output_index) : "";
+    align_parameters.sort_temp_prefix = temp_file::get_dir() + "/wfmash-sort-";
+    if (approx_mapping && align_parameters.sort_by_target) {
+        // Mappings go to a temporary file and are sorted into the output afterwards
+        map_parameters.outFileName = temp_file::create();
+        align_parameters.pafOutputFile = "/dev/stdout";
+    }
+
 #ifdef WFA_PNG_TSV_TIMING
     align_parameters.tsvOutputPrefix = (prefix_wavefront_info_in_tsv && !args::get(prefix_wavefront_info_in_tsv).empty())
             ? args::get(prefix_wavefront_info_in_tsv)
@@ -708,19 +1094,6 @@ void parse_args(int argc,
     }
 #endif
 
-    if (num_mappings) {
-        if (args::get(num_mappings) > 0) {
-            map_parameters.numMappingsForSegment = args::get(num_mappings);
-        } else {
-            std::cerr << "[wfmash] ERROR: the number of mappings to retain (-n) must be greater than 0." << std::endl;
-            exit(1);
-        }
-    } else {
-        map_parameters.numMappingsForSegment = 1;
-    }
-
-    map_parameters.numMappingsForShortSequence = 1;
-
 	map_parameters.legacy_output = false;
 
     //Check if files are valid
@@ -739,12 +1112,33 @@ void parse_args(int argc,
               << ", p=" << std::fixed << std::setprecision(0) << map_parameters.percentageIdentity * 100 << "%"
               << ", t=" << map_parameters.threads
               << ", b=" << map_parameters.index_by_size << std::endl;
+    if (threads_auto || memory_budget > 0) {
+        std::cerr << "[wfmash] Resources: t=" << map_parameters.threads;
+        if (threads_auto) {
+            std::cerr << " (" << limits.cpus_source << ")";
+        }
+        if (memory_budget > 0) {
+            std::cerr << ", max-memory=" << memory_budget;
+            if (max_memory_auto) {
+                std::cerr << " (" << limits.memory_source << ")";
+            }
+            std::cerr << ", b=" << map_parameters.index_by_size
+                      << ", wfa-max-memory=" << align_parameters.wfa_max_memory;
+        }
+        std::cerr << std::endl;
+    }
     std::cerr << "[wfmash] Filters: " << (map_parameters.skip_self ? "skip-self" : "no-skip-self")
               << ", hg(Δ=" << map_parameters.ANIDiff << ",conf=" << map_parameters.ANIDiffConf << ")"
               << ", mode=" << map_parameters.filterMode << " (1=map,2=1-to-1,3=none)" << std::endl;
     std::cerr << "[wfmash] Output: " << map_parameters.outFileName << std::endl;
+    if (!map_parameters.sweep.empty()) {
+        std::cerr << "[wfmash] Sweep: " << map_parameters.sweep.size() - 1 << " extra configurations to "
+                  << map_parameters.sweep_prefix << ".*.paf, mapping at p=" << std::fixed << std::setprecision(0)
+                  << map_parameters.percentageIdentity * 100 << "%" << std::endl;
+    }
 
     temp_file::set_keep_temp(args::get(keep_temp_files));
+    yeet_parameters.perf_counters_file = perf_counters_file ? args::get(perf_counters_file) : "";
 }
 
 }
@@ -180,6 +180,43 @@ Test project /export/local/home/wrk/iwrk/opensource/code/pangenome/wfmash/build
             return hash;
         }
 
+        /**
+         * @brief       hash the compared ('1') positions of a spaced seed laid over seq, on both strands
+         * @details     the reverse hash applies the same pattern to the reverse complement of the
+         *              seed span, so min(fwd, bwd) does not depend on the strand; each seed of a set
+         *              hashes with its own Murmur seed so that different patterns never share values
+         * @param[in]   rc, buf     scratch space of at least sp.length chars
+         */
+        inline void getSpacedHashes(const char *seq, const ales::spaced_seed& sp, int seedIdx, bool nucleotide,
+                                    char *rc, char *buf, hash_t& hashFwd, hash_t& hashBwd) {
+            char data[16];
+            int w = 0;
+            for (size_t k = 0; k < sp.length; k++)
+                if (sp.seed[k] == '1') buf[w++] = seq[k];
+            MurmurHash3_x64_128(buf, w, seed + seedIdx, data);
+            hashFwd = *((hash_t *) data);
+
+            if (!nucleotide) {
+                hashBwd = std::numeric_limits<hash_t>::max();
+                return;
+            }
+            reverseComplement(seq, rc, sp.length);
+            w = 0;
+            for (size_t k = 0; k < sp.length; k++)
+                if (sp.seed[k] == '1') buf[w++] = rc[k];
+            MurmurHash3_x64_128(buf, w, seed + seedIdx, data);
+            hashBwd = *((hash_t *) data);
+        }
+
+        /**
+         * @brief       longest span of a spaced seed set, the positions it hashes behave like k-mers of this length
+         */
+        inline int spacedSeedSpan(const std::vector<ales::spaced_seed>& spacedSeeds) {
+            size_t span = 0;
+            for (const auto& sp : spacedSeeds) span = std::max(span, sp.length);
+            return span;
+        }
+
         /**
          * @brief		takes hash value of kmer and adjusts it based on kmer's weight
          *					this value will determine its order for minimizer selection
@@ -204,6 +241,90 @@ Test project /export/local/home/wrk/iwrk/opensource/code/pangenome/wfmash/build
 //        }
 
 
+        /**
+         * @brief       splitmix64 finalizer, spreads any 64-bit key uniformly over the hash space
+         */
+        inline uint64_t mixHash(uint64_t hash) {
+          hash += 0x9e3779b97f4a7c15ULL;
+          hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+          hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+          return hash ^ (hash >> 31);
+        }
+
+        /**
+         * @brief       Whether a minimizer survives index sampling
+         * @details     The decision depends only on the hash, remixed so that it is independent of
+         *              the minimizer's rank in its sketch; the index and the query sketches thus keep
+         *              the same subset of k-mers and shared/sketch ratios stay unbiased
+         * @param[in]   hash        minimizer hash
+         * @param[in]   sampling    fraction of the hash space to keep
+         */
+        inline bool keepSampledHash(hash_t hash, double sampling) {
+          if (sampling >= 1.0) return true;
+          return (long double)mixHash(hash) < sampling * (long double)std::numeric_limits<hash_t>::max();
+        }
+
+        /**
+         * @brief       Expected sketch size once index sampling is applied
+         */
+        inline int sampledSketchSize(int sketchSize, double sampling) {
+          return sampling >= 1.0 ? sketchSize : std::max(1, (int)std::lround(sketchSize * sampling));
+        }
+
+        /**
+         * @brief       Expected sketch size of a segment, capped by the open syncmers it holds and
+         *              thinned by index sampling
+         */
+        inline int expectedSketchSize(const Parameters& p) {
+          int sketchSize = p.sketchSize;
+          if (p.syncmerSize > 0) {
+            const int n = p.kmerSize - p.syncmerSize + 1;
+            const double density = (n % 2 ? 1.0 : 2.0) / n;
+            sketchSize = std::min<int>(sketchSize, std::max<long>(1, std::lround((p.segLength - p.kmerSize + 1) * density)));
+          }
+          return sampledSketchSize(sketchSize, p.index_sampling);
+        }
+
+        /**
+         * @brief       Open syncmer test over consecutive k-mer positions of a sequence
+         * @details     A k-mer is kept when its smallest canonical s-mer starts in its middle (at either
+         *              middle offset when k-s is odd). The s-mer hashes of the reverse strand are the same
+         *              values in reverse order, so both strands keep the same k-mers. Index and query
+         *              sketches then draw minimizers from the same ~1/(k-s+1) of all k-mers.
+         */
+        class OpenSyncmers {
+          int kmerSize, syncmerSize, offset;
+          std::vector<hash_t> smers;            // canonical s-mer hashes of the current k-mer, ring buffer
+          std::unique_ptr<char[]> smerRev;
+
+          hash_t smerHash(const char* smer) {
+            reverseComplement(smer, smerRev.get(), syncmerSize);
+            return std::min(getHash(smer, syncmerSize), getHash(smerRev.get(), syncmerSize));
+          }
+
+          public:
+          OpenSyncmers(int kmerSize, int syncmerSize)
+            : kmerSize(kmerSize), syncmerSize(syncmerSize), offset((kmerSize - syncmerSize) / 2),
+              smers(kmerSize - syncmerSize + 1), smerRev(new char[syncmerSize]) {}
+
+          /**
+           * @brief     whether the k-mer at seq[i] is a syncmer; must be called for i = 0, 1, 2, ... in turn
+           */
+          bool keep(const char* seq, offset_t i) {
+            const int n = smers.size();
+            if (i == 0) {
+              for (int j = 0; j < n; j++) smers[j] = smerHash(seq + j);
+            } else {
+              smers[(i + n - 1) % n] = smerHash(seq + i + n - 1);
+            }
+            int minPos = 0;
+            for (int j = 1; j < n; j++) {
+              if (smers[(i + j) % n] < smers[(i + minPos) % n]) minPos = j;
+            }
+            return minPos == offset || minPos == n - 1 - offset;
+          }
+        };
+
         /**
          * @brief       Compute the minimum s kmers for a string.
          * @param[out]  minmerIndex     container storing sketched Kmers
@@ -212,6 +333,8 @@ Test project /export/local/home/wrk/iwrk/opensource/code/pangenome/wfmash/build
          * @param[in]   kmerSize
          * @param[in]   s                   sketch size.
          * @param[in]   seqCounter          current sequence number, used while saving the position of minimizer
+         * @param[in]   spacedSeeds         if not empty, each position is hashed once per seed instead of as a k-mer
+         * @param[in]   syncmerSize         if not 0, only open syncmers with s-mers of this length are considered
          */
         template <typename T>
           inline void sketchSequence(
@@ -221,9 +344,16 @@ Test project /export/local/home/wrk/iwrk/opensource/code/pangenome/wfmash/build
               int kmerSize,
               int alphabetSize,
               int sketchSize,
-              seqno_t seqCounter)
+              seqno_t seqCounter,
+              const std::vector<ales::spaced_seed>& spacedSeeds = {},
+              int syncmerSize = 0)
         {
           makeUpperCaseAndValidDNA(seq, len);
+          std::unique_ptr<OpenSyncmers> syncmers(syncmerSize > 0 ? new OpenSyncmers(kmerSize, syncmerSize) : nullptr);
+
+          if (!spacedSeeds.empty())
+            kmerSize = spacedSeedSpan(spacedSeeds);
+          std::unique_ptr<char[]> spacedBuf(new char[2 * kmerSize]);
 
           //Compute reverse complement of seq
           std::unique_ptr<char[]> seqRev(new char[len]);
@@ -255,52 +385,74 @@ Test project /export/local/home/wrk/iwrk/opensource/code/pangenome/wfmash/build
             {
               ambig_kmer_count = kmerSize;
             }
-            //Hash kmers
-            hash_t hashFwd = CommonFunc::getHash(seq + i, kmerSize);
-            hash_t hashBwd;
-
-            if(alphabetSize == 4)
-              hashBwd = CommonFunc::getHash(seqRev.get() + len - i - kmerSize, kmerSize);
-            else  //proteins
-              hashBwd = std::numeric_limits<hash_t>::max();   //Pick a dummy high value so that it is ignored later
-
-            //Consider non-symmetric kmers only
-            if(hashBwd != hashFwd && ambig_kmer_count == 0)
+            const auto sketchKmer = [&](hash_t hashFwd, hash_t hashBwd)
             {
-              //Take minimum value of kmer and its reverse complement
-              hash_t currentKmer = std::min(hashFwd, hashBwd);
+              //Consider non-symmetric kmers only
+              if(hashBwd != hashFwd && ambig_kmer_count == 0)
+              {
+                //Take minimum value of kmer and its reverse complement
+                hash_t currentKmer = std::min(hashFwd, hashBwd);
 
-              //Check the strand of this minimizer hash value
-              auto currentStrand = hashFwd < hashBwd ? strnd::FWD : strnd::REV;
+                //Check the strand of this minimizer hash value
+                auto currentStrand = hashFwd < hashBwd ? strnd::FWD : strnd::REV;
 
-              if (sketched_heap.size() < sketchSize || currentKmer <= sketched_heap.front())
-              {
-                if (sketched_heap.empty() || sketched_vals.find(currentKmer) == sketched_vals.end())
+                if (sketched_heap.size() < sketchSize || currentKmer <= sketched_heap.front())
                 {
-
-                  // Add current hash to heap
-                  if (sketched_vals.size() < sketchSize || currentKmer < sketched_heap.front())
+                  if (sketched_heap.empty() || sketched_vals.find(currentKmer) == sketched_vals.end())
                   {
-                      sketched_vals[currentKmer] = MinmerInfo{currentKmer, i, i, seqCounter, currentStrand};
-                      sketched_heap.push_back(currentKmer);
-                      std::push_heap(sketched_heap.begin(), sketched_heap.end());
-                  }
 
-                  // Remove one if too large
-                  if (sketched_vals.size() > sketchSize)
+                    // Add current hash to heap
+                    if (sketched_vals.size() < sketchSize || currentKmer < sketched_heap.front())
+                    {
+                        sketched_vals[currentKmer] = MinmerInfo{currentKmer, i, i, seqCounter, currentStrand};
+                        sketched_heap.push_back(currentKmer);
+                        std::push_heap(sketched_heap.begin(), sketched_heap.end());
+                    }
+
+                    // Remove one if too large
+                    if (sketched_vals.size() > sketchSize)
+                    {
+                        sketched_vals.erase(sketched_heap[0]);
+                        std::pop_heap(sketched_heap.begin(), sketched_heap.end());
+                        sketched_heap.pop_back();
+                    }
+                  }
+                  else
                   {
-                      sketched_vals.erase(sketched_heap[0]);
-                      std::pop_heap(sketched_heap.begin(), sketched_heap.end());
-                      sketched_heap.pop_back();
+                    // TODO these sketched values might never be useful, might save memory by deleting
+                    // extend the length of the window
+                    sketched_vals[currentKmer].wpos_end = i;
+                    sketched_vals[currentKmer].strand += currentStrand == strnd::FWD ? 1 : -1;
                   }
                 }
-                else
-                {
-                  // TODO these sketched values might never be useful, might save memory by deleting
-                  // extend the length of the window
-                  sketched_vals[currentKmer].wpos_end = i;
-                  sketched_vals[currentKmer].strand += currentStrand == strnd::FWD ? 1 : -1;
-                }
+              }
+            };
+
+            if (syncmers && !syncmers->keep(seq, i))
+            {
+              // Not a syncmer, never a minimizer candidate
+            }
+            else if (spacedSeeds.empty())
+            {
+              //Hash kmers
+              hash_t hashFwd = CommonFunc::getHash(seq + i, kmerSize);
+              hash_t hashBwd;
+
+              if(alphabetSize == 4)
+                hashBwd = CommonFunc::getHash(seqRev.get() + len - i - kmerSize, kmerSize);
+              else  //proteins
+                hashBwd = std::numeric_limits<hash_t>::max();   //Pick a dummy high value so that it is ignored later
+
+              sketchKmer(hashFwd, hashBwd);
+            }
+            else
+            {
+              for (int j = 0; j < spacedSeeds.size(); j++)
+              {
+                hash_t hashFwd, hashBwd;
+                CommonFunc::getSpacedHashes(seq + i, spacedSeeds[j], j, alphabetSize == 4,
+                                            spacedBuf.get(), spacedBuf.get() + kmerSize, hashFwd, hashBwd);
+                sketchKmer(hashFwd, hashBwd);
               }
             }
             if (ambig_kmer_count > 0)
@@ -331,6 +483,8 @@ Test project /export/local/home/wrk/iwrk/opensource/code/pangenome/wfmash/build
          * @param[in]   windowSize
          * @param[in]   sketchSize      sketch size.
          * @param[in]   seqCounter      current sequence number, used while saving the position of minimizer
+         * @param[in]   spacedSeeds     if not empty, each position is hashed once per seed instead of as a k-mer
+         * @param[in]   syncmerSize     if not 0, only open syncmers with s-mers of this length are considered
          */
         template <typename T>
           inline void addMinmers(std::vector<T> &minmerIndex,
@@ -340,8 +494,15 @@ Test project /export/local/home/wrk/iwrk/opensource/code/pangenome/wfmash/build
               int alphabetSize,
               int sketchSize,
               seqno_t seqCounter,
-              progress_meter::ProgressMeter* progress)
+              progress_meter::ProgressMeter* progress,
+              const std::vector<ales::spaced_seed>& spacedSeeds = {},
+              int syncmerSize = 0)
           {
+            // Positions carry one hash per seed, windows are laid out over the longest seed span
+            const int hashesPerPos = spacedSeeds.empty() ? 1 : spacedSeeds.size();
+            if (!spacedSeeds.empty())
+              kmerSize = spacedSeedSpan(spacedSeeds);
+
             /**
              * Double-ended queue (saves minimum at front end)
              * Saves pair of the minimizer and the position of hashed kmer in the sequence
@@ -358,9 +519,10 @@ Test project /export/local/home/wrk/iwrk/opensource/code/pangenome/wfmash/build
             std::vector<KmerInfo> heapWindow;
 
             makeUpperCaseAndValidDNA(seq, len);
+            std::unique_ptr<OpenSyncmers> syncmers(syncmerSize > 0 ? new OpenSyncmers(kmerSize, syncmerSize) : nullptr);
 
             //Compute reverse complement of seq
-            std::unique_ptr<char[]> seqRev(new char[kmerSize]);
+            std::unique_ptr<char[]> seqRev(new char[2 * kmerSize]);
 
             //if(alphabetSize == 4) //not protein
               //CommonFunc::reverseComplement(seq, seqRev.get(), len);
@@ -378,7 +540,7 @@ Test project /export/local/home/wrk/iwrk/opensource/code/pangenome/wfmash/build
               offset_t currentWindowId = i + kmerSize - windowSize;
 
               // Remove expired kmers from heap
-              if (heapWindow.size() > 2*windowSize)
+              if (heapWindow.size() > 2*windowSize*hashesPerPos)
               {
                 heapWindow.erase(
                     std::remove_if(
@@ -390,34 +552,17 @@ Test project /export/local/home/wrk/iwrk/opensource/code/pangenome/wfmash/build
                 std::make_heap(heapWindow.begin(), heapWindow.end(), KIHeap_cmp);
               }
 
-              //Hash kmers
-              hash_t hashFwd = CommonFunc::getHash(seq + i, kmerSize);
-              hash_t hashBwd;
-
-              if(alphabetSize == 4)
-              {
-                  CommonFunc::reverseComplement(seq + i, seqRev.get(), kmerSize);
-                hashBwd = CommonFunc::getHash(seqRev.get(), kmerSize);
-              }
-              else  //proteins
-                hashBwd = std::numeric_limits<hash_t>::max();   //Pick a dummy high value so that it is ignored later
-
-              //Take minimum value of kmer and its reverse complement
-              hash_t currentKmer = std::min(hashFwd, hashBwd);
-
-
-              //Check the strand of this minimizer hash value
-              auto currentStrand = hashFwd < hashBwd ? strnd::FWD : strnd::REV;
-
               //If front minimum is not in the current window, remove it
-              if (!Q.empty() && std::get<2>(Q.front()) <  currentWindowId)
+              while (!Q.empty() && std::get<2>(Q.front()) <  currentWindowId)
               {
                 const auto [leaving_hash, leaving_strand, _] = Q.front();
 
-                if (sortedWindow.size() > 0 && leaving_hash <= std::prev(sortedWindow.end())->first)
+                auto leaving_it = sortedWindow.size() > 0 && leaving_hash <= std::prev(sortedWindow.end())->first
+                                  ? sortedWindow.find(leaving_hash) : sortedWindow.end();
+                if (leaving_it != sortedWindow.end())
                 {
 
-                  auto& leaving_pair = sortedWindow.find(leaving_hash)->second;
+                  auto& leaving_pair = leaving_it->second;
 
                   // Check if this is the only occurence of this hash in the window
                   if (leaving_pair.second.size() == 1)
@@ -450,34 +595,75 @@ Test project /export/local/home/wrk/iwrk/opensource/code/pangenome/wfmash/build
               {
                 ambig_kmer_count = kmerSize;
               }
-              //Consider non-symmetric kmers only
-              if(hashBwd != hashFwd && ambig_kmer_count == 0)
+              const auto windowKmer = [&](hash_t hashFwd, hash_t hashBwd)
               {
-                // Add current hash to window
-                Q.push_back(std::make_tuple(currentKmer, currentStrand, i));
+                //Take minimum value of kmer and its reverse complement
+                hash_t currentKmer = std::min(hashFwd, hashBwd);
+
 
-                // Check if current kmer is already in the map
-                auto kmer_it = sortedWindow.find(currentKmer);
-                if (kmer_it != sortedWindow.end())
+                //Check the strand of this minimizer hash value
+                auto currentStrand = hashFwd < hashBwd ? strnd::FWD : strnd::REV;
+
+                //Consider non-symmetric kmers only
+                if(hashBwd != hashFwd && ambig_kmer_count == 0)
                 {
-                  auto& current_pair = kmer_it->second;
-                  current_pair.second.emplace_back(KmerInfo {currentKmer, seqCounter, i, currentStrand});
-                  // Not removing hash, but need to adjust the strand
-                  if (current_pair.first.strand + currentStrand == 0
-                          || current_pair.first.strand == 0)
+                  // Add current hash to window
+                  Q.push_back(std::make_tuple(currentKmer, currentStrand, i));
+
+                  // Check if current kmer is already in the map
+                  auto kmer_it = sortedWindow.find(currentKmer);
+                  if (kmer_it != sortedWindow.end())
                   {
-                    current_pair.first.wpos_end = currentWindowId;
-                    minmerIndex.push_back(current_pair.first);
-                    current_pair.first.wpos = currentWindowId;
-                    current_pair.first.wpos_end = -1;
+                    auto& current_pair = kmer_it->second;
+                    current_pair.second.emplace_back(KmerInfo {currentKmer, seqCounter, i, currentStrand});
+                    // Not removing hash, but need to adjust the strand
+                    if (current_pair.first.strand + currentStrand == 0
+                            || current_pair.first.strand == 0)
+                    {
+                      current_pair.first.wpos_end = currentWindowId;
+                      minmerIndex.push_back(current_pair.first);
+                      current_pair.first.wpos = currentWindowId;
+                      current_pair.first.wpos_end = -1;
+                    }
+                    current_pair.first.strand += currentStrand;
+                  }
+                  // Going in the heap
+                  else
+                  {
+                    heapWindow.emplace_back(KmerInfo {currentKmer, seqCounter, i, currentStrand});
+                    std::push_heap(heapWindow.begin(), heapWindow.end(), KIHeap_cmp);
                   }
-                  current_pair.first.strand += currentStrand;
                 }
-                // Going in the heap
-                else
+              };
+
+              if (syncmers && !syncmers->keep(seq, i))
+              {
+                // Not a syncmer, never a minimizer candidate
+              }
+              else if (spacedSeeds.empty())
+              {
+                //Hash kmers
+                hash_t hashFwd = CommonFunc::getHash(seq + i, kmerSize);
+                hash_t hashBwd;
+
+                if(alphabetSize == 4)
+                {
+                    CommonFunc::reverseComplement(seq + i, seqRev.get(), kmerSize);
+                  hashBwd = CommonFunc::getHash(seqRev.get(), kmerSize);
+                }
+                else  //proteins
+                  hashBwd = std::numeric_limits<hash_t>::max();   //Pick a dummy high value so that it is ignored later
+
+                windowKmer(hashFwd, hashBwd);
+              }
+              else
+              {
+                for (int j = 0; j < spacedSeeds.size(); j++)
                 {
-                  heapWindow.emplace_back(KmerInfo {currentKmer, seqCounter, i, currentStrand});
-                  std::push_heap(heapWindow.begin(), heapWindow.end(), KIHeap_cmp);
+                  hash_t hashFwd, hashBwd;
+                  CommonFunc::getSpacedHashes(seq + i, spacedSeeds[j], j, alphabetSize == 4,
+                                              seqRev.get(), seqRev.get() + kmerSize, hashFwd, hashBwd);
+                  windowKmer(hashFwd, hashBwd);
                 }
               }
               if (ambig_kmer_count > 0)
@@ -485,57 +671,64 @@ Test project /export/local/home/wrk/iwrk/opensource/code/pangenome/wfmash/build
                 ambig_kmer_count--;
               }
 
-              // Add kmers from heap to window until full
+              // Add kmers from heap to window until full. With spaced seeds a position adds several
+              // hashes, so several may undercut the window: swap until none does
               if(currentWindowId >= 0)
               {
-                // Ignore expired kmers
-                while (!heapWindow.empty() && heapWindow.front().pos < currentWindowId)
+                bool evicted;
+                do
                 {
-                  std::pop_heap(heapWindow.begin(), heapWindow.end(), KIHeap_cmp);
-                  heapWindow.pop_back();
-                }
-
-                //TODO leq?
-                if (sortedWindow.size() > 0 && heapWindow.size() > 0
-                    && sortedWindow.size() == sketchSize
-                    && (heapWindow.front().hash < std::prev(sortedWindow.end())->first))
-                {
-                  auto& largest = std::prev(sortedWindow.end())->second;
-                  // Add largest to index
-                  largest.first.wpos_end = currentWindowId;
-                  minmerIndex.push_back(largest.first);
-
-                  // Add kmers back to heap
-                  for (KmerInfo& kmer : largest.second)
+                  evicted = false;
+                  // Ignore expired kmers
+                  while (!heapWindow.empty() && heapWindow.front().pos < currentWindowId)
                   {
-                    if (kmer.pos > currentWindowId) {
-                        heapWindow.push_back(kmer);
-                        std::push_heap(heapWindow.begin(), heapWindow.end(), KIHeap_cmp);
-                    }
+                    std::pop_heap(heapWindow.begin(), heapWindow.end(), KIHeap_cmp);
+                    heapWindow.pop_back();
                   }
 
-                  // Remove from window
-                  sortedWindow.erase(largest.first.hash);
-                }
-
-                while (!heapWindow.empty() && sortedWindow.size() < sketchSize)
-                {
-                  if (heapWindow.front().pos < currentWindowId)
+                  //TODO leq?
+                  if (sortedWindow.size() > 0 && heapWindow.size() > 0
+                      && sortedWindow.size() == sketchSize
+                      && (heapWindow.front().hash < std::prev(sortedWindow.end())->first))
                   {
-                    std::pop_heap(heapWindow.begin(), heapWindow.end(), KIHeap_cmp);
-                    heapWindow.pop_back();
+                    auto& largest = std::prev(sortedWindow.end())->second;
+                    // Add largest to index
+                    largest.first.wpos_end = currentWindowId;
+                    minmerIndex.push_back(largest.first);
+
+                    // Add kmers back to heap
+                    for (KmerInfo& kmer : largest.second)
+                    {
+                      if (kmer.pos > currentWindowId) {
+                          heapWindow.push_back(kmer);
+                          std::push_heap(heapWindow.begin(), heapWindow.end(), KIHeap_cmp);
+                      }
+                    }
+
+                    // Remove from window
+                    sortedWindow.erase(largest.first.hash);
+                    evicted = true;
                   }
-                  // Add kmers of same value
-                  const KmerInfo newKmer = heapWindow.front();
-                  sortedWindow[newKmer.hash].first = MinmerInfo{newKmer.hash, currentWindowId, -1, seqCounter, 0};
-                  while (!heapWindow.empty() && heapWindow.front().hash == newKmer.hash)
+
+                  while (!heapWindow.empty() && sortedWindow.size() < sketchSize)
                   {
-                    sortedWindow[newKmer.hash].second.push_back(heapWindow.front());
-                    sortedWindow[newKmer.hash].first.strand += heapWindow.front().strand;
-                    std::pop_heap(heapWindow.begin(), heapWindow.end(), KIHeap_cmp);
-                    heapWindow.pop_back();
+                    if (heapWindow.front().pos < currentWindowId)
+                    {
+                      std::pop_heap(heapWindow.begin(), heapWindow.end(), KIHeap_cmp);
+                      heapWindow.pop_back();
+                    }
+                    // Add kmers of same value
+                    const KmerInfo newKmer = heapWindow.front();
+                    sortedWindow[newKmer.hash].first = MinmerInfo{newKmer.hash, currentWindowId, -1, seqCounter, 0};
+                    while (!heapWindow.empty() && heapWindow.front().hash == newKmer.hash)
+                    {
+                      sortedWindow[newKmer.hash].second.push_back(heapWindow.front());
+                      sortedWindow[newKmer.hash].first.strand += heapWindow.front().strand;
+                      std::pop_heap(heapWindow.begin(), heapWindow.end(), KIHeap_cmp);
+                      heapWindow.pop_back();
+                    }
                   }
-                }
+                } while (evicted);
               }
             }
 
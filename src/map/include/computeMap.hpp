@@ -24,6 +24,7 @@ namespace fs = std::filesystem;
 #include <unordered_set>
 #include <mutex>
 #include <thread>
+#include <type_traits>
 #include <sstream>
 #include "taskflow/taskflow.hpp"
 
@@ -44,6 +45,7 @@ namespace fs = std::filesystem;
 //External includes
 #include "common/seqiter.hpp"
 #include "common/progress.hpp"
+#include "common/perf_counters.hpp"
 #include "map_stats.hpp"
 #include "robin-hood-hashing/robin_hood.h"
 // if we ever want to do the union-find chaining in parallel
@@ -185,6 +187,32 @@ namespace skch
       // Track maximum chain ID seen across all subsets
       std::atomic<offset_t> maxChainIdSeen{0};
 
+      // Seed hits over all sketched fragments, reported to compare k-mer selection schemes
+      std::atomic<uint64_t> seedHitCount{0};
+      std::atomic<uint64_t> seedLookupCount{0};
+      // Heavy posting lists deferred to the second seed lookup round, and the points it did not walk
+      std::atomic<uint64_t> heavyListsDeferred{0};
+      std::atomic<uint64_t> heavyPointsSkipped{0};
+      std::atomic<uint64_t> rareFirstFragments{0};
+
+      // Unfiltered per-query L2 mappings, saved with --save-raw-mappings or replayed with --from-raw-mappings
+      std::ofstream rawMappingsOut;
+      std::mutex rawMappingsOut_mutex;
+      std::vector<std::vector<std::pair<seqno_t, MappingResultsVector_t>>> rawSubsetMappings;
+      bool collectingRawMappings = false;               // keep raw mappings in memory instead of filtering them
+      bool replayingRawMappings = false;                // filter rawSubsetMappings instead of mapping
+
+      // --ani-matrix totals per (query group, target group), filled instead of writing mappings
+      struct AniPairTotals {
+        uint64_t blocks = 0;                            // number of mappings
+        uint64_t mappedBases = 0;                       // query bases of all mappings, overlaps counted again
+        double identityBases = 0;                       // sum of identity x query bases of the mappings
+      };
+      std::map<std::pair<int, int>, AniPairTotals> aniTotals;
+      // Merged query intervals covered by mappings, per query sequence (high 32 bits) and target group
+      std::unordered_map<uint64_t, std::vector<std::pair<offset_t, offset_t>>> aniCovered;
+      std::mutex aniMutex;
+
 
     void processFragment(const FragmentData& fragment, 
                          std::vector<IntervalPoint>& intervalPoints,
@@ -205,7 +233,14 @@ namespace skch
         Q.seqName = fragment.seqName;
         Q.refGroup = fragment.refGroup;
 
-        mapSingleQueryFrag(Q, intervalPoints, l1Mappings, l2Mappings);
+        // Decide whether the fragment is worth mapping before touching the index:
+        // sparsified-out fragments are never sketched, low-complexity ones never reach L1
+        if (keepFragment(fragment)) {
+            getSeedHits(Q);
+            if (Q.sketchSize > 0 && Q.kmerComplexity >= param.kmerComplexityThreshold) {
+                mapSingleQueryFrag(Q, intervalPoints, l1Mappings, l2Mappings);
+            }
+        }
 
         std::for_each(l2Mappings.begin(), l2Mappings.end(), [&](MappingResult &e){
             e.queryLen = fragment.fullLen;
@@ -236,7 +271,7 @@ namespace skch
           PostProcessResultsFn_t f = nullptr) :
         param(p),
         processMappingResults(f),
-        sketchCutoffs(std::min<double>(p.sketchSize, skch::fixed::ss_table_max) + 1, 1),
+        sketchCutoffs(std::min<double>(CommonFunc::expectedSketchSize(p), skch::fixed::ss_table_max) + 1, 1),
         idManager(std::make_unique<SequenceIdManager>(
             p.querySequences,
             p.refSequences,
@@ -246,7 +281,7 @@ namespace skch
             p.query_list,
             p.target_list)),
         cached_segment_length(p.segLength),
-        cached_minimum_hits(p.minimum_hits > 0 ? p.minimum_hits : Stat::estimateMinimumHitsRelaxed(p.sketchSize, p.kmerSize, p.percentageIdentity, skch::fixed::confidence_interval))
+        cached_minimum_hits(p.minimum_hits > 0 ? p.minimum_hits : Stat::estimateMinimumHitsRelaxed(CommonFunc::expectedSketchSize(p), p.kmerSize, p.percentageIdentity, skch::fixed::confidence_interval))
           {
               // Initialize sequence names right after creating idManager
               // Important: Apply any prefix filters here to ensure consistent query/target list
@@ -318,10 +353,18 @@ namespace skch
                         << target_groups.size() << " groups (≈" << std::fixed << std::setprecision(0) << avg_target_size_per_group << "bp/group)" 
                         << std::endl;
 
+              if (p.index_sampling < 1.0) {
+                  logSamplingSensitivity();
+              }
+
               if (p.stage1_topANI_filter) {
                   this->setProbs();
               }
-              this->mapQuery();
+              if (param.sweep.empty()) {
+                  this->mapQuery();
+              } else {
+                  this->mapSweep();
+              }
           }
 
       // Removed populateIdManager() function
@@ -357,12 +400,33 @@ namespace skch
 
     private:
 
+      /**
+       * @brief   log the sketch size left by index sampling and the predicted loss of L1 sensitivity,
+       *          i.e. of the chance that a segment at the identity threshold gets enough seed hits
+       */
+      void logSamplingSensitivity()
+      {
+        const int s = param.sketchSize;
+        const int s_sampled = CommonFunc::expectedSketchSize(param);
+        const float jaccard = Stat::md2j(1 - param.percentageIdentity, param.kmerSize);
+        auto sensitivity = [&](int size) {
+          const int hits = param.minimum_hits > 0 ? param.minimum_hits
+              : Stat::estimateMinimumHitsRelaxed(size, param.kmerSize, param.percentageIdentity, skch::fixed::confidence_interval);
+          return hits <= 0 ? 1.0 : gsl_cdf_binomial_Q(hits - 1, jaccard, size);
+        };
+        std::cerr << "[wfmash::mashmap] Index sampling " << std::setprecision(3) << param.index_sampling
+                  << ": sketch size " << s << " -> " << s_sampled
+                  << ", predicted L1 sensitivity at " << std::setprecision(0) << param.percentageIdentity * 100 << "% identity "
+                  << std::setprecision(3) << sensitivity(s) << " -> " << sensitivity(s_sampled)
+                  << std::fixed << std::setprecision(0) << std::endl;
+      }
+
       void setProbs()
       {
 
         float deltaANI = param.ANIDiff;
         float min_p = 1 - param.ANIDiffConf;
-        int ss = std::min<double>(param.sketchSize, skch::fixed::ss_table_max);
+        int ss = std::min<double>(CommonFunc::expectedSketchSize(param), skch::fixed::ss_table_max);
 
         // Cache hg pmf results
         std::vector<std::vector<double>> sketchProbs(
@@ -496,11 +560,10 @@ namespace skch
                   exit(1);
               }
               
-              // Read the magic number to verify it's a valid index
-              uint64_t magic_number = 0;
-              indexStream.read(reinterpret_cast<char*>(&magic_number), sizeof(magic_number));
-              if (magic_number != 0xDEADBEEFCAFEBABE) {
-                  std::cerr << "Error: Invalid index file format (wrong magic number)" << std::endl;
+              // Read the magic number and format version to verify it's a valid index
+              const std::string format_error = Sketch::readIndexFormat(indexStream);
+              if (!format_error.empty()) {
+                  std::cerr << "[wfmash::mashmap] ERROR: " << format_error << std::endl;
                   exit(1);
               }
               
@@ -520,8 +583,25 @@ namespace skch
               indexStream.close();
           }
 
+          // Replayed mappings fix the subset size they were made with
+          if (!param.from_raw_mappings.empty() && !replayingRawMappings) {
+              readRawMappings();
+              replayingRawMappings = true;
+          }
+
           // Create the index subsets
           auto target_subsets = createTargetSubsets(targetSequenceNames);
+          if (replayingRawMappings && target_subsets.size() != rawSubsetMappings.size()) {
+              std::cerr << "[wfmash::mashmap] ERROR: raw mappings cover " << rawSubsetMappings.size()
+                        << " target subsets but the targets split into " << target_subsets.size() << std::endl;
+              exit(1);
+          }
+          if (!param.save_raw_mappings.empty() && !replayingRawMappings) {
+              writeRawMappingsHeader(target_subsets.size());
+          }
+          if (collectingRawMappings) {
+              rawSubsetMappings.assign(target_subsets.size(), {});
+          }
 
           // Calculate average subset size and log
           uint64_t total_target_subset_size = 0;
@@ -558,7 +638,7 @@ namespace skch
                             << "/" << target_subsets.size() << " (indexing): " << indexFilename << std::endl;
     
                   // Build the index directly
-                  refSketch = new skch::Sketch(param, *idManager, target_subset);
+                  refSketch = new skch::Sketch(param, *idManager, target_subset, nullptr, nullptr, &executor);
     
                   // Append to the same file for all but the first subset
                   bool append = (subset_idx > 0);
@@ -592,8 +672,10 @@ namespace skch
                   );
 
               // Build or load index task
-              auto buildIndex_task = subset_flow->emplace([this, target_subset=target_subset, subset_idx, total_subsets=target_subsets.size(), &target_subsets]() {
-                  if (!param.indexFilename.empty()) {
+              auto buildIndex_task = subset_flow->emplace([this, target_subset=target_subset, subset_idx, total_subsets=target_subsets.size(), &target_subsets, &executor]() {
+                  if (replayingRawMappings) {
+                      // Mappings are replayed, no index needed
+                  } else if (!param.indexFilename.empty()) {
                       // Load existing index
                       std::string indexFilename = param.indexFilename.string();
                       
@@ -610,11 +692,10 @@ namespace skch
                               exit(1);
                           }
                           
-                          // Read the magic number to verify it's a valid index
-                          uint64_t magic_number = 0;
-                          indexStream.read(reinterpret_cast<char*>(&magic_number), sizeof(magic_number));
-                          if (magic_number != 0xDEADBEEFCAFEBABE) {
-                              std::cerr << "Error: Invalid index file format (wrong magic number)" << std::endl;
+                          // Read the magic number and format version to verify it's a valid index
+                          const std::string format_error = Sketch::readIndexFormat(indexStream);
+                          if (!format_error.empty()) {
+                              std::cerr << "[wfmash::mashmap] ERROR: " << format_error << std::endl;
                               exit(1);
                           }
                           
@@ -660,7 +741,7 @@ namespace skch
                       }
                       
                       // Build index in memory with progress meter
-                      refSketch = new skch::Sketch(param, *idManager, target_subset, nullptr, sketch_index_progress);
+                      refSketch = new skch::Sketch(param, *idManager, target_subset, nullptr, sketch_index_progress, &executor);
                       
                       // Second stage: building index data structures
                       // Instead of just updating the banner, print a clear message that indexing is done
@@ -678,7 +759,7 @@ namespace skch
               auto outstream_mutex = std::make_shared<std::mutex>();
               
               // Open output file if we're not in ONETOONE mode (for immediate output)
-              if (param.filterMode != filter::ONETOONE) {
+              if (param.filterMode != filter::ONETOONE && !collectingRawMappings) {
                   bool append = subset_idx > 0;  // Append for all but first subset
                   outstream->open(param.outFileName, append ? std::ios::app : std::ios::out);
                   if (!outstream->is_open()) {
@@ -689,7 +770,24 @@ namespace skch
 
               // Process queries using subflows for parallelism
               auto processQueries_task = subset_flow->emplace([this, progress, subsetMappings, subsetMappings_mutex, 
-                                                           outstream, outstream_mutex, subset_flow](tf::Subflow& sf) {
+                                                           outstream, outstream_mutex, subset_flow, subset_idx](tf::Subflow& sf) {
+                  // Re-filter cached raw mappings instead of mapping
+                  if (replayingRawMappings) {
+                      for (const auto& raw : rawSubsetMappings[subset_idx]) {
+                          sf.emplace([&]() {
+                              const seqno_t seqId = raw.first;
+                              // Copy, as a sweep replays the same mappings once per configuration
+                              MappingResultsVector_t mappings = raw.second;
+                              filterByIdentity(mappings);
+                              finalizeQueryMappings(seqId, idManager->getSequenceName(seqId), mappings, *progress,
+                                                    *subsetMappings, *subsetMappings_mutex,
+                                                    *outstream, *outstream_mutex);
+                              progress->increment(idManager->getSequenceLength(seqId));
+                          });
+                      }
+                      return;
+                  }
+
                   const auto& fileName = param.querySequences[0];
     
                   // Load the query file index once and share it
@@ -831,27 +929,17 @@ namespace skch
 
                               // After all fragments are processed, set the output results
                               mappingBoundarySanityCheck(input.get(), output->results);
-                              auto [nonMergedMappings, mergedMappings] = 
-                                  filterSubsetMappings(output->results, output->progress);
-
-                              // Select the appropriate mappings
-                              auto& mappings = param.mergeMappings && param.split ?
-                                    mergedMappings : nonMergedMappings;
-
-                              // Handle based on filter mode
-                              if (param.filterMode == filter::ONETOONE) {
-                                  // For ONETOONE mode, store mappings for later merging across subsets
-                                  std::lock_guard<std::mutex> lock(*subsetMappings_mutex);
-                                  (*subsetMappings)[seqId].insert(
-                                      (*subsetMappings)[seqId].end(),
-                                      std::make_move_iterator(mappings.begin()),
-                                      std::make_move_iterator(mappings.end())
-                                  );
-                              } else {
-                                  // For non-ONETOONE modes, write mappings immediately
-                                  std::lock_guard<std::mutex> lock(*outstream_mutex);
-                                  reportReadMappings(mappings, queryName, *outstream);
+                              if (rawMappingsOut.is_open()) {
+                                  writeRawMappings(subset_idx, seqId, output->results);
+                              }
+                              if (collectingRawMappings) {
+                                  std::lock_guard<std::mutex> lock(rawMappingsOut_mutex);
+                                  rawSubsetMappings[subset_idx].emplace_back(seqId, std::move(output->results));
+                                  return;
                               }
+                              finalizeQueryMappings(seqId, queryName, output->results, output->progress,
+                                                    *subsetMappings, *subsetMappings_mutex,
+                                                    *outstream, *outstream_mutex);
                           }).name("query_" + queryName);
                   }
                   
@@ -899,6 +987,23 @@ namespace skch
               progress->finish();
           }
 
+          if (seedLookupCount > 0) {
+              std::cerr << "[wfmash::mashmap] " << seedHitCount << " seed hits in " << seedLookupCount
+                        << " sketched fragments (" << std::fixed << std::setprecision(1)
+                        << (double)seedHitCount / seedLookupCount << " per fragment)"
+                        << std::setprecision(0) << std::endl;
+          }
+          if (heavyListsDeferred > 0) {
+              std::cerr << "[wfmash::mashmap] Deferred " << heavyListsDeferred << " heavy posting lists ("
+                        << rareFirstFragments << " fragments looked up rare seeds first), "
+                        << heavyPointsSkipped << " of their interval points fell outside supported regions" << std::endl;
+          }
+
+          if (rawMappingsOut.is_open()) {
+              rawMappingsOut.close();
+              std::cerr << "[wfmash::mashmap] Saved raw mappings to " << param.save_raw_mappings << std::endl;
+          }
+
           // If we're only creating indices, exit now
           if (exit_after_indices) {
               std::cerr << "[wfmash::mashmap] All indices created successfully. Exiting." << std::endl;
@@ -906,11 +1011,13 @@ namespace skch
           }
 
           // Final results processing (only needed for ONETOONE mode)
-          if (param.filterMode == filter::ONETOONE && !exit_after_indices) {
+          if (param.filterMode == filter::ONETOONE && !exit_after_indices && !collectingRawMappings) {
               tf::Taskflow final_flow;
               std::cerr << "[wfmash::mashmap] Processing final one-to-one filtering" << std::endl;
               
               auto final_task = final_flow.emplace([&]() {
+                  perf_counters::Scope scope(perf_counters::filtering);
+                  const auto final_start = skch::Time::now();
                   // Count total mappings for logging
                   size_t total_mappings = 0;
                   for (auto& [querySeqId, mappings] : combinedMappings) {
@@ -960,6 +1067,7 @@ namespace skch
                   
                   std::cerr << "[wfmash::mashmap] Wrote " << final_mapping_count 
                             << " mappings after one-to-one filtering" << std::endl;
+                  perf_counters::serial(perf_counters::one_to_one_filter, skch::Time::now() - final_start);
               });
               
               executor.run(final_flow).wait();
@@ -967,10 +1075,263 @@ namespace skch
               // For non-ONETOONE modes, we've already written all results
           }
           // Final flow execution is now handled inside the conditional block above
+
+          if (param.ani_matrix && !collectingRawMappings) {
+              writeAniMatrix();
+          }
       }
 
 
 
+      /**
+       * @brief       Map once at the loosest sweep settings, then filter the same raw mappings
+       *              once per --sweep configuration, each into its own output
+       */
+      void mapSweep()
+      {
+          if (param.from_raw_mappings.empty()) {
+              collectingRawMappings = true;
+              mapQuery();
+              collectingRawMappings = false;
+          } else {
+              readRawMappings();
+          }
+          replayingRawMappings = true;
+
+          const skch::Parameters base = param;
+          for (const auto& config : base.sweep) {
+              param = base;
+              param.percentageIdentity = config.percentageIdentity;
+              param.numMappingsForSegment = config.numMappingsForSegment;
+              param.block_length = config.block_length;
+              param.chain_gap = config.chain_gap;
+              param.filterMode = config.filterMode;
+              if (!config.label.empty()) {
+                  param.outFileName = base.sweep_prefix + "." + config.label + (base.ani_matrix ? ".tsv" : ".paf");
+              }
+              maxChainIdSeen = 0;
+              std::cerr << "[wfmash::mashmap] Sweep configuration " << (config.label.empty() ? "main" : config.label)
+                        << ": p=" << std::fixed << std::setprecision(0) << param.percentageIdentity * 100 << "%"
+                        << ", n=" << param.numMappingsForSegment
+                        << ", l=" << param.block_length
+                        << ", c=" << param.chain_gap
+                        << ", mode=" << param.filterMode
+                        << " -> " << param.outFileName << std::endl;
+              mapQuery();
+          }
+          param = base;
+      }
+
+      /**
+       * @brief       Drop replayed mappings that L2 would have rejected at the current identity threshold
+       */
+      void filterByIdentity(MappingResultsVector_t& readMappings)
+      {
+          readMappings.erase(
+              std::remove_if(readMappings.begin(), readMappings.end(), [&](const MappingResult& e) {
+                  return !((param.keep_low_pct_id && e.nucIdentityUpperBound >= param.percentageIdentity)
+                           || e.nucIdentity >= param.percentageIdentity);
+              }),
+              readMappings.end());
+      }
+
+      static constexpr uint64_t raw_mappings_magic = 0x50414d5741524657; // "WFRAWMAP"
+      static constexpr uint32_t raw_mappings_version = 2;
+
+      /**
+       * @brief       Visit the stored fields of a mapping, in file order
+       * @details     Fields are written one by one, so the file holds no struct padding and does
+       *              not depend on the layout of MappingResult; a field added there must be added
+       *              here (and the version bumped) to survive a save and reload
+       */
+      template <typename Mapping, typename Visit>
+      static void rawMappingFields(Mapping& m, Visit&& visit)
+      {
+          visit(m.queryLen); visit(m.refStartPos); visit(m.refEndPos);
+          visit(m.queryStartPos); visit(m.queryEndPos);
+          visit(m.refSeqId); visit(m.querySeqId);
+          visit(m.blockLength); visit(m.blockNucIdentity);
+          visit(m.nucIdentity); visit(m.nucIdentityUpperBound);
+          visit(m.sketchSize); visit(m.conservedSketches); visit(m.strand); visit(m.approxMatches);
+          visit(m.kmerComplexity); visit(m.n_merged); visit(m.splitMappingId);
+          visit(m.discard); visit(m.overlapped); visit(m.selfMapFilter);
+          visit(m.chainPairScore); visit(m.chainPairId);
+          visit(m.chain_id); visit(m.chain_length); visit(m.chain_pos);
+      }
+
+      static void writeRawMapping(std::ostream& out, const MappingResult& m)
+      {
+          rawMappingFields(m, [&](const auto& field) {
+              using field_t = std::decay_t<decltype(field)>;
+              static_assert(std::is_arithmetic_v<field_t>, "raw mapping fields must be plain numbers");
+              // long double differs between platforms, double holds the complexity estimate
+              if constexpr (std::is_same_v<field_t, long double>) {
+                  const double value = field;
+                  out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+              } else {
+                  out.write(reinterpret_cast<const char*>(&field), sizeof(field));
+              }
+          });
+      }
+
+      static void readRawMapping(std::istream& in, MappingResult& m)
+      {
+          rawMappingFields(m, [&](auto& field) {
+              using field_t = std::decay_t<decltype(field)>;
+              if constexpr (std::is_same_v<field_t, long double>) {
+                  double value = 0;
+                  in.read(reinterpret_cast<char*>(&value), sizeof(value));
+                  field = value;
+              } else {
+                  in.read(reinterpret_cast<char*>(&field), sizeof(field));
+              }
+          });
+      }
+
+      /**
+       * @brief       Write the header of a raw mappings file
+       * @details     Records what the stored L2 mappings depend on: the segment length fixes the
+       *              fragment coordinates, the sequence counts the internal ids, and the subset size
+       *              how targets were batched
+       */
+      void writeRawMappingsHeader(size_t total_subsets)
+      {
+          rawMappingsOut.open(param.save_raw_mappings, std::ios::binary);
+          if (!rawMappingsOut) {
+              std::cerr << "[wfmash::mashmap] ERROR: unable to open raw mappings file for writing: " << param.save_raw_mappings << std::endl;
+              exit(1);
+          }
+          const uint64_t query_count = querySequenceNames.size();
+          const uint64_t target_count = targetSequenceNames.size();
+          rawMappingsOut.write(reinterpret_cast<const char*>(&raw_mappings_magic), sizeof(raw_mappings_magic));
+          rawMappingsOut.write(reinterpret_cast<const char*>(&raw_mappings_version), sizeof(raw_mappings_version));
+          rawMappingsOut.write(reinterpret_cast<const char*>(&param.segLength), sizeof(param.segLength));
+          rawMappingsOut.write(reinterpret_cast<const char*>(&param.percentageIdentity), sizeof(param.percentageIdentity));
+          rawMappingsOut.write(reinterpret_cast<const char*>(&param.index_by_size), sizeof(param.index_by_size));
+          rawMappingsOut.write(reinterpret_cast<const char*>(&total_subsets), sizeof(total_subsets));
+          rawMappingsOut.write(reinterpret_cast<const char*>(&query_count), sizeof(query_count));
+          rawMappingsOut.write(reinterpret_cast<const char*>(&target_count), sizeof(target_count));
+      }
+
+      /**
+       * @brief       Append the unfiltered mappings of one query in one target subset
+       */
+      void writeRawMappings(uint64_t subset_idx, seqno_t seqId, const MappingResultsVector_t& mappings)
+      {
+          if (mappings.empty()) return;
+          const uint64_t count = mappings.size();
+          std::lock_guard<std::mutex> lock(rawMappingsOut_mutex);
+          rawMappingsOut.write(reinterpret_cast<const char*>(&subset_idx), sizeof(subset_idx));
+          rawMappingsOut.write(reinterpret_cast<const char*>(&seqId), sizeof(seqId));
+          rawMappingsOut.write(reinterpret_cast<const char*>(&count), sizeof(count));
+          for (const auto& m : mappings) {
+              writeRawMapping(rawMappingsOut, m);
+          }
+      }
+
+      /**
+       * @brief       Load a raw mappings file into rawSubsetMappings, adopting its subset size
+       */
+      void readRawMappings()
+      {
+          std::ifstream in(param.from_raw_mappings, std::ios::binary);
+          if (!in) {
+              std::cerr << "[wfmash::mashmap] ERROR: unable to open raw mappings file: " << param.from_raw_mappings << std::endl;
+              exit(1);
+          }
+          uint64_t magic = 0;
+          uint32_t version = 0;
+          decltype(param.segLength) segLength;
+          float percentageIdentity;
+          int64_t index_by_size;
+          size_t total_subsets;
+          uint64_t query_count, target_count;
+          in.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+          in.read(reinterpret_cast<char*>(&version), sizeof(version));
+          if (!in || magic != raw_mappings_magic || version != raw_mappings_version) {
+              std::cerr << "[wfmash::mashmap] ERROR: " << param.from_raw_mappings << " is not a raw mappings file of this version" << std::endl;
+              exit(1);
+          }
+          in.read(reinterpret_cast<char*>(&segLength), sizeof(segLength));
+          in.read(reinterpret_cast<char*>(&percentageIdentity), sizeof(percentageIdentity));
+          in.read(reinterpret_cast<char*>(&index_by_size), sizeof(index_by_size));
+          in.read(reinterpret_cast<char*>(&total_subsets), sizeof(total_subsets));
+          in.read(reinterpret_cast<char*>(&query_count), sizeof(query_count));
+          in.read(reinterpret_cast<char*>(&target_count), sizeof(target_count));
+          if (segLength != param.segLength) {
+              std::cerr << "[wfmash::mashmap] ERROR: raw mappings were made with segment length " << segLength
+                        << " but -s is " << param.segLength << std::endl;
+              exit(1);
+          }
+          if (query_count != querySequenceNames.size() || target_count != targetSequenceNames.size()) {
+              std::cerr << "[wfmash::mashmap] ERROR: raw mappings were made for " << query_count << " queries and "
+                        << target_count << " targets, not " << querySequenceNames.size() << " and "
+                        << targetSequenceNames.size() << std::endl;
+              exit(1);
+          }
+          if (param.percentageIdentity < percentageIdentity) {
+              std::cerr << "[wfmash::mashmap] WARNING: raw mappings were made with -p " << percentageIdentity * 100
+                        << ", mappings below it are not available for re-filtering" << std::endl;
+          }
+          param.index_by_size = index_by_size;
+
+          rawSubsetMappings.assign(total_subsets, {});
+          uint64_t subset_idx, count, total_mappings = 0;
+          seqno_t seqId;
+          while (in.read(reinterpret_cast<char*>(&subset_idx), sizeof(subset_idx))) {
+              in.read(reinterpret_cast<char*>(&seqId), sizeof(seqId));
+              in.read(reinterpret_cast<char*>(&count), sizeof(count));
+              MappingResultsVector_t mappings;
+              for (uint64_t i = 0; i < count && in; ++i) {
+                  mappings.emplace_back();
+                  readRawMapping(in, mappings.back());
+              }
+              if (!in || subset_idx >= total_subsets) {
+                  std::cerr << "[wfmash::mashmap] ERROR: truncated or corrupt raw mappings file: " << param.from_raw_mappings << std::endl;
+                  exit(1);
+              }
+              total_mappings += count;
+              rawSubsetMappings[subset_idx].emplace_back(seqId, std::move(mappings));
+          }
+          std::cerr << "[wfmash::mashmap] Re-filtering " << total_mappings << " raw mappings in "
+                    << total_subsets << " subsets from " << param.from_raw_mappings << std::endl;
+      }
+
+      /**
+       * @brief       Filter, chain and scaffold the raw mappings of one query within a target subset,
+       *              then write them or keep them for one-to-one filtering across subsets
+       */
+      void finalizeQueryMappings(seqno_t seqId,
+                                 const std::string& queryName,
+                                 MappingResultsVector_t& rawMappings,
+                                 progress_meter::ProgressMeter& progress,
+                                 std::unordered_map<seqno_t, MappingResultsVector_t>& subsetMappings,
+                                 std::mutex& subsetMappings_mutex,
+                                 std::ofstream& outstream,
+                                 std::mutex& outstream_mutex)
+      {
+          auto [nonMergedMappings, mergedMappings] = filterSubsetMappings(rawMappings, progress);
+
+          // Select the appropriate mappings
+          auto& mappings = param.mergeMappings && param.split ?
+                mergedMappings : nonMergedMappings;
+
+          // Handle based on filter mode
+          if (param.filterMode == filter::ONETOONE) {
+              // For ONETOONE mode, store mappings for later merging across subsets
+              std::lock_guard<std::mutex> lock(subsetMappings_mutex);
+              subsetMappings[seqId].insert(
+                  subsetMappings[seqId].end(),
+                  std::make_move_iterator(mappings.begin()),
+                  std::make_move_iterator(mappings.end())
+              );
+          } else {
+              // For non-ONETOONE modes, write mappings immediately
+              std::lock_guard<std::mutex> lock(outstream_mutex);
+              reportReadMappings(mappings, queryName, outstream);
+          }
+      }
+
       /**
        * @brief               helper to main mapping function
        * @details             filters mappings with fewer than the target number of merged base mappings
@@ -1044,23 +1405,21 @@ namespace skch
       }
 
       /**
-       * @brief               helper to main mapping function
-       * @details             filters mappings by hash value
-       * @param[in]   input   mappings
-       * @param[in]   input
-       * @return              void
+       * @brief               deterministic sparsification decision for a query fragment
+       * @details             fragments are sampled in blocks that span more than the chain gap,
+       *                      so the mappings of kept blocks are never merged across dropped ones
+       * @param[in]   fragment
+       * @return              true if the fragment should be mapped
        */
-      void sparsifyMappings(MappingResultsVector_t &readMappings)
+      bool keepFragment(const FragmentData& fragment) const
       {
-          if (param.sparsity_hash_threshold < std::numeric_limits<uint64_t>::max()) {
-              readMappings.erase(
-                  std::remove_if(readMappings.begin(),
-                                 readMappings.end(),
-                                 [&](MappingResult &e){
-                                     return e.hash() > param.sparsity_hash_threshold;
-                                 }),
-                  readMappings.end());
+          if (param.sparsity_hash_threshold == std::numeric_limits<uint64_t>::max()) {
+              return true;
           }
+          const int64_t fragments_per_block = param.chain_gap / param.segLength + 2;
+          std::size_t h = std::hash<std::string>{}(fragment.seqName);
+          hash_combine(h, fragment.fragmentIndex / fragments_per_block);
+          return CommonFunc::mixHash(h) <= param.sparsity_hash_threshold;
       }
 
       /**
@@ -1199,7 +1558,10 @@ namespace skch
           auto t0 = skch::Time::now();
 #endif
           //L1 Mapping
-          doL1Mapping(Q, intervalPoints, l1Mappings);
+          {
+            perf_counters::Scope scope(perf_counters::l1);
+            doL1Mapping(Q, intervalPoints, l1Mappings);
+          }
           if (l1Mappings.size() == 0) {
             return;
           }
@@ -1209,6 +1571,7 @@ namespace skch
           auto t1 = skch::Time::now();
 #endif
 
+          perf_counters::Scope l2_scope(perf_counters::l2);
           auto l1_begin = l1Mappings.begin();
           auto l1_end = l1Mappings.begin();
           while (l1_end != l1Mappings.end())
@@ -1268,8 +1631,9 @@ namespace skch
       template <typename Q_Info>
         void getSeedHits(Q_Info &Q)
         {
+          perf_counters::Scope scope(perf_counters::sketching);
           Q.minmerTableQuery.reserve(param.sketchSize + 1);
-          CommonFunc::sketchSequence(Q.minmerTableQuery, Q.seq, Q.len, param.kmerSize, param.alphabetSize, param.sketchSize, Q.seqId);
+          CommonFunc::sketchSequence(Q.minmerTableQuery, Q.seq, Q.len, param.kmerSize, param.alphabetSize, param.sketchSize, Q.seqId, param.spaced_seeds, param.syncmerSize);
           if(Q.minmerTableQuery.size() == 0) {
             Q.sketchSize = 0;
             return;
@@ -1281,6 +1645,15 @@ namespace skch
           const double max_hash_01 = (long double)(Q.minmerTableQuery.back().hash) / std::numeric_limits<hash_t>::max();
           Q.kmerComplexity = (double(Q.minmerTableQuery.size()) / max_hash_01) / ((Q.len - param.kmerSize + 1)*2);
 
+          // Subsample the query sketch exactly as the index was sampled
+          if (param.index_sampling < 1.0) {
+            Q.minmerTableQuery.erase(
+                std::remove_if(Q.minmerTableQuery.begin(), Q.minmerTableQuery.end(), [this](const auto& mi) {
+                    return !CommonFunc::keepSampledHash(mi.hash, param.index_sampling);
+                }),
+                Q.minmerTableQuery.end());
+          }
+
           // Removed frequent kmer filtering
 
           Q.sketchSize = Q.minmerTableQuery.size();
@@ -1301,7 +1674,7 @@ namespace skch
        * @param[out]  l1Mappings                all the read mapping locations
        */
       template <typename Q_Info, typename Vec>
-        void getSeedIntervalPoints(Q_Info &Q, Vec& intervalPoints)
+        void getSeedIntervalPoints(Q_Info &Q, Vec& intervalPoints, int minimumHits)
         {
 
 #ifdef DEBUG
@@ -1329,23 +1702,52 @@ namespace skch
               pq.emplace_back(boundPtr<IP_const_iterator> {seedFind->second.cbegin(), seedFind->second.cend()});
             }
           }
+
+          // Some posting lists are deferred: the rare ones are merged first and the deferred lists
+          // are then only walked inside the reference regions those hits support.
+          // - Rare-seed-first: when the lists are long in total, the minimumHits-1 longest are deferred.
+          //   Every window with minimumHits distinct minimizers holds a hit of the others, so the
+          //   L1 candidates do not change.
+          // - Heavy lists, far longer than the fragment's median, are deferred as well; this may
+          //   drop candidates made only of such minimizers
+          std::vector<boundPtr<IP_const_iterator>> heavy;
+          if (pq.size() > 1)
+          {
+            std::sort(pq.begin(), pq.end(), [](const auto& a, const auto& b) { return a.end - a.it < b.end - b.it; });
+            size_t total = 0;
+            for (const auto& list : pq) total += list.end - list.it;
+            size_t deferFrom = pq.size();
+            if (param.rare_seed_first_postings > 0 && total > param.rare_seed_first_postings && minimumHits > 1)
+            {
+              deferFrom = pq.size() - std::min<size_t>(pq.size() - 1, minimumHits - 1);
+              rareFirstFragments++;
+            }
+            if (param.heavy_posting_ratio > 0)
+            {
+              const size_t limit = std::max<size_t>(skch::fixed::heavy_posting_min,
+                                                    param.heavy_posting_ratio * (pq[pq.size() / 2].end - pq[pq.size() / 2].it));
+              auto firstHeavy = std::find_if(pq.begin(), pq.end(),
+                  [limit](const auto& list) { return size_t(list.end - list.it) > limit; });
+              deferFrom = std::min<size_t>(deferFrom, firstHeavy - pq.begin());
+            }
+            heavy.assign(pq.begin() + deferFrom, pq.end());
+            pq.erase(pq.begin() + deferFrom, pq.end());
+          }
           std::make_heap(pq.begin(), pq.end(), heap_cmp);
 
+          const int queryGroup = idManager->getRefGroup(Q.seqId);
+          auto keepPoint = [&](const IntervalPoint& ip) {
+            int targetGroup = idManager->getRefGroup(ip.seqId);
+            if (param.skip_self && queryGroup == targetGroup) return false;
+            if (param.skip_prefix && queryGroup == targetGroup) return false;
+            if (param.lower_triangular && Q.seqId <= ip.seqId) return false;
+            return true;
+          };
+
           while(!pq.empty())
           {
             const IP_const_iterator ip_it = pq.front().it;
-            //const auto& ref = this->sketch_metadata[ip_it->seqId];
-            const auto& ref_name = this->idManager->getSequenceName(ip_it->seqId);
-            //const auto& ref_len = this->idManager.getSeqLen(ip_it->seqId);
-            bool skip_mapping = false;
-            int queryGroup = idManager->getRefGroup(Q.seqId);
-            int targetGroup = idManager->getRefGroup(ip_it->seqId);
-
-            if (param.skip_self && queryGroup == targetGroup) skip_mapping = true;
-            if (param.skip_prefix && queryGroup == targetGroup) skip_mapping = true;
-            if (param.lower_triangular && Q.seqId <= ip_it->seqId) skip_mapping = true;
-    
-            if (!skip_mapping) {
+            if (keepPoint(*ip_it)) {
               intervalPoints.push_back(*ip_it);
             }
             std::pop_heap(pq.begin(), pq.end(), heap_cmp);
@@ -1360,6 +1762,53 @@ namespace skch
             }
           }
 
+          if (!heavy.empty())
+          {
+            heavyListsDeferred += heavy.size();
+
+            // Regions supported by rare hits, widened by twice a fragment and a window on each side
+            // so that the windows next to any candidate keep their counts as well
+            const offset_t margin = 2 * (Q.len + param.segLength);
+            std::vector<std::tuple<seqno_t, offset_t, offset_t>> regions;
+            for (const auto& ip : intervalPoints) {
+              if (!regions.empty() && std::get<0>(regions.back()) == ip.seqId
+                  && ip.pos - margin <= std::get<2>(regions.back())) {
+                std::get<2>(regions.back()) = std::max(std::get<2>(regions.back()), ip.pos + margin);
+              } else {
+                regions.emplace_back(ip.seqId, ip.pos - margin, ip.pos + margin);
+              }
+            }
+
+            // A minimizer's points alternate open/close in list order, so a walk starts on an
+            // open point and ends on a close point to keep its windows whole
+            std::vector<IntervalPoint> supported;
+            uint64_t skipped = 0;
+            for (const auto& list : heavy) {
+              auto walked = list.it;
+              for (const auto& [seqId, start, end] : regions) {
+                auto it = std::lower_bound(walked, list.end, IntervalPoint{start, 0, seqId, side::CLOSE});
+                if (it != walked && it != list.end && it->side == side::CLOSE) --it;
+                skipped += it - walked;
+                for (; it != list.end && it->seqId == seqId && (it->pos <= end || it->side == side::CLOSE); ++it) {
+                  if (keepPoint(*it)) supported.push_back(*it);
+                }
+                walked = it;
+              }
+              skipped += list.end - walked;
+            }
+            heavyPointsSkipped += skipped;
+
+            if (!supported.empty()) {
+              std::sort(supported.begin(), supported.end());
+              const auto mid = intervalPoints.size();
+              intervalPoints.insert(intervalPoints.end(), supported.begin(), supported.end());
+              std::inplace_merge(intervalPoints.begin(), intervalPoints.begin() + mid, intervalPoints.end());
+            }
+          }
+
+          seedHitCount += intervalPoints.size() / 2;
+          seedLookupCount++;
+
 #ifdef DEBUG
           std::cerr << "INFO, wfmash::mashmap, read id " << Q.seqId << ", Count of seed hits in the reference = " << intervalPoints.size() / 2 << "\n";
 #endif
@@ -1452,7 +1901,7 @@ namespace skch
               minimumHits = std::max(
                   sketchCutoffs[
                     int(std::min(bestIntersectionSize, Q.sketchSize) 
-                      / std::max<double>(1, param.sketchSize / skch::fixed::ss_table_max))
+                      / std::max<double>(1, CommonFunc::expectedSketchSize(param) / skch::fixed::ss_table_max))
                   ],
                   minIntersectionSize);
             }
@@ -1589,20 +2038,17 @@ namespace skch
       template <typename Q_Info, typename IPVec, typename L1Vec>
         void doL1Mapping(Q_Info &Q, IPVec& intervalPoints, L1Vec& l1Mappings)
         {
-          //1. Compute the minmers
-          getSeedHits(Q);
-
-          //Catch all NNNNNN case
-          if (Q.sketchSize == 0 || Q.kmerComplexity < param.kmerComplexityThreshold) {
-            /*std::cerr << "[DEBUG] Skipping " << Q.seqName 
-                      << " (sketchSize=" << Q.sketchSize
-                      << " kmerComplexity=" << Q.kmerComplexity 
-                      << " threshold=" << param.kmerComplexityThreshold << ")\n";*/
-            return;
-          }
+          //1. The minmers were computed and complexity-gated by processFragment
 
           //2. Compute windows and sort
-          getSeedIntervalPoints(Q, intervalPoints);
+          // Always respect the minimum hits parameter if set
+          int minimumHits = param.minimum_hits > 0 ? 
+              param.minimum_hits : 
+              (Q.len == cached_segment_length ? 
+                  cached_minimum_hits : 
+                  Stat::estimateMinimumHitsRelaxed(Q.sketchSize, param.kmerSize, param.percentageIdentity, skch::fixed::confidence_interval));
+
+          getSeedIntervalPoints(Q, intervalPoints, minimumHits);
 
           /*std::cerr << "[DEBUG] L1 found " << intervalPoints.size() 
                     << " interval points for " << Q.seqName 
@@ -1610,12 +2056,6 @@ namespace skch
                     << " kmerComplexity=" << Q.kmerComplexity << ")\n";*/
 
           //3. Compute L1 windows
-          // Always respect the minimum hits parameter if set
-          int minimumHits = param.minimum_hits > 0 ? 
-              param.minimum_hits : 
-              (Q.len == cached_segment_length ? 
-                  cached_minimum_hits : 
-                  Stat::estimateMinimumHitsRelaxed(Q.sketchSize, param.kmerSize, param.percentageIdentity, skch::fixed::confidence_interval));
 
           // For each "group"
           auto ip_begin = intervalPoints.begin();
@@ -2696,8 +3136,6 @@ namespace skch
           if (param.filterLengthMismatches) {
               filterFalseHighIdentity(readMappings);
           }
-          
-          sparsifyMappings(readMappings);
       }
 
 /**
@@ -2944,6 +3382,7 @@ VecIn mergeMappingsInRange(VecIn &readMappings,
        * @param param Algorithm parameters
        */
       std::pair<MappingResultsVector_t, MappingResultsVector_t> filterSubsetMappings(MappingResultsVector_t& mappings, progress_meter::ProgressMeter& progress) {
+          perf_counters::Scope scope(perf_counters::filtering);
           if (mappings.empty()) return {MappingResultsVector_t(), MappingResultsVector_t()};
 
           // Make a copy of the raw mappings for scaffolding
@@ -3092,6 +3531,13 @@ VecIn mergeMappingsInRange(VecIn &readMappings,
       void reportReadMappings(MappingResultsVector_t &readMappings, const std::string &queryName,
           std::ostream &outstrm)
       {
+        perf_counters::Scope scope(perf_counters::output);
+
+        if (param.ani_matrix) {
+          aggregateAniMatrix(readMappings);
+          return;
+        }
+
         // Sort mappings by chain ID and query position
         std::sort(readMappings.begin(), readMappings.end(),
             [](const MappingResult &a, const MappingResult &b) {
@@ -3175,6 +3621,100 @@ VecIn mergeMappingsInRange(VecIn &readMappings,
 
     private:
 
+      /**
+       * @brief     sort and merge overlapping or adjacent intervals in place
+       */
+      static void mergeAniIntervals(std::vector<std::pair<offset_t, offset_t>> &intervals)
+      {
+        std::sort(intervals.begin(), intervals.end());
+        size_t merged = 0;
+        for (size_t i = 1; i < intervals.size(); ++i) {
+          if (intervals[i].first <= intervals[merged].second) {
+            intervals[merged].second = std::max(intervals[merged].second, intervals[i].second);
+          } else {
+            intervals[++merged] = intervals[i];
+          }
+        }
+        intervals.resize(std::min(intervals.size(), merged + 1));
+      }
+
+      /**
+       * @brief     add the final mappings of a query to the --ani-matrix totals
+       */
+      void aggregateAniMatrix(const MappingResultsVector_t &readMappings)
+      {
+        std::lock_guard<std::mutex> lock(aniMutex);
+        std::vector<uint64_t> touched;
+        for (const auto &e : readMappings) {
+          const int targetGroup = idManager->getRefGroup(e.refSeqId);
+          const offset_t length = e.queryEndPos - e.queryStartPos;
+          AniPairTotals &t = aniTotals[{idManager->getRefGroup(e.querySeqId), targetGroup}];
+          t.blocks++;
+          t.mappedBases += length;
+          t.identityBases += static_cast<double>(e.nucIdentity) * length;
+
+          const uint64_t key = static_cast<uint64_t>(e.querySeqId) << 32 | static_cast<uint32_t>(targetGroup);
+          aniCovered[key].emplace_back(e.queryStartPos, e.queryEndPos);
+          touched.push_back(key);
+        }
+        // Merge right away so that memory follows the covered regions rather than the mapping count
+        std::sort(touched.begin(), touched.end());
+        touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+        for (const uint64_t key : touched) {
+          mergeAniIntervals(aniCovered[key]);
+        }
+      }
+
+      /**
+       * @brief     write the --ani-matrix table to the output file and reset the totals
+       * @details   one line per (query group, target group) pair with mappings: the length of the
+       *            query group, its bases covered by at least one mapping and their fraction, the
+       *            number of mappings, their query bases and their length-weighted identity
+       */
+      void writeAniMatrix()
+      {
+        std::lock_guard<std::mutex> lock(aniMutex);
+
+        std::map<std::pair<int, int>, uint64_t> coveredBases;
+        for (const auto &[key, intervals] : aniCovered) {
+          uint64_t &covered = coveredBases[{idManager->getRefGroup(key >> 32), static_cast<int>(key & 0xffffffff)}];
+          for (const auto &[start, end] : intervals) {
+            covered += end - start;
+          }
+        }
+
+        std::unordered_map<int, uint64_t> queryGroupLength;
+        for (const auto &name : idManager->getQuerySequenceNames()) {
+          const seqno_t seqId = idManager->getSequenceId(name);
+          queryGroupLength[idManager->getRefGroup(seqId)] += idManager->getSequenceLength(seqId);
+        }
+
+        std::ofstream out(param.outFileName);
+        if (!out.is_open()) {
+          std::cerr << "[wfmash::mashmap] ERROR: cannot write the ANI matrix to " << param.outFileName << std::endl;
+          exit(1);
+        }
+        out << "#query_group\ttarget_group\tquery_length\tcovered_bp\tcoverage\tblocks\tmapped_bp\tidentity\n";
+        for (const auto &[groups, t] : aniTotals) {
+          const uint64_t length = queryGroupLength[groups.first];
+          const uint64_t covered = coveredBases[groups];
+          out << idManager->getGroupName(groups.first)
+              << "\t" << idManager->getGroupName(groups.second)
+              << "\t" << length
+              << "\t" << covered
+              << "\t" << (length > 0 ? static_cast<double>(covered) / length : 0.0)
+              << "\t" << t.blocks
+              << "\t" << t.mappedBases
+              << "\t" << (t.mappedBases > 0 ? t.identityBases / t.mappedBases : 0.0)
+              << "\n";
+        }
+        std::cerr << "[wfmash::mashmap] Wrote identity and coverage of " << aniTotals.size()
+                  << " group pairs to " << param.outFileName << std::endl;
+
+        aniTotals.clear();
+        aniCovered.clear();
+      }
+
     public:
 
       /**
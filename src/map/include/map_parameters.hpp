@@ -6,6 +6,7 @@
 #ifndef SKETCH_CONFIG_HPP
 #define SKETCH_CONFIG_HPP
 
+#include <string>
 #include <vector>
 #include <unordered_set>
 #include <filesystem>
@@ -25,6 +26,16 @@ struct ales_params {
   uint32_t region_length{};
 };
 
+// One filter configuration of a --sweep, applied to mappings computed once at the loosest settings
+struct sweep_config_t {
+  std::string label;                                  // output name suffix, empty for the main output
+  float percentageIdentity;
+  uint32_t numMappingsForSegment;
+  offset_t block_length;
+  offset_t chain_gap;
+  int filterMode;
+};
+
 /**
  * @brief   configuration parameters for building sketch
  *          expected to be initialized using command line arguments
@@ -55,6 +66,10 @@ struct Parameters
     stdfs::path indexFilename;                        //output file name of index
     bool overwrite_index;                             //overwrite index if it exists
     bool create_index_only;                           //only create index and exit
+    std::string save_raw_mappings;                    //save unfiltered L2 mappings to this file
+    std::string from_raw_mappings;                    //re-filter saved L2 mappings instead of mapping
+    std::vector<sweep_config_t> sweep;                //filter configurations sharing one mapping pass, main output first
+    std::string sweep_prefix;                         //prefix of the per-configuration sweep outputs
     bool split;                                       //Split read mapping (done if this is true)
     bool lower_triangular;                            // set to true if we should filter out half of the mappings
     bool skip_self;                                   //skip self mappings
@@ -80,13 +95,18 @@ struct Parameters
     double spaced_seed_sensitivity;                   //
     std::vector<ales::spaced_seed> spaced_seeds;      //
     bool world_minimizers;
-    uint64_t sparsity_hash_threshold;                 // keep mappings that hash to <= this value
+    uint64_t sparsity_hash_threshold;                 // map only query fragment blocks that hash to <= this value
+    double index_sampling = 1.0;                      // fraction of minimizers kept, by hash, in the index and query sketches
+    int syncmerSize = 0;                              // s-mer length of the open syncmer k-mer selection, 0 to consider all k-mers
+    double heavy_posting_ratio = 0.0;                 // defer query minimizers whose posting list exceeds this multiple of the fragment's median, 0 (default) to walk all lists
+    uint64_t rare_seed_first_postings = 100000;       // look up the rarest minimizers first when a fragment's posting lists hold more points, 0 = never
     double overlap_threshold;                         // minimum overlap for a mapping to be considered
     int64_t scaffold_max_deviation;                  // max diagonal deviation from scaffold chains
     int64_t scaffold_gap;                           // gap threshold for scaffold chaining
     int64_t scaffold_min_length = 50000;            // minimum scaffold block length
     
     bool legacy_output;
+    bool ani_matrix = false;                          // aggregate mappings per (query group, target group) instead of writing them
     //std::unordered_set<std::string> high_freq_kmers;  //
     int64_t index_by_size = std::numeric_limits<int64_t>::max();  // Target total size of sequences for each index subset
     int minimum_hits = -1;  // Minimum number of hits required for L1 filtering (-1 means auto)
@@ -114,6 +134,7 @@ float confidence_interval = 0.95;                   // Confidence interval to re
 float percentage_identity = 0.70;                   // Percent identity in the mapping step
 float ANIDiff = 0.0;                                // Stage 1 ANI diff threshold
 float ANIDiffConf = 0.999;                          // ANI diff confidence
+size_t heavy_posting_min = 10000;                   // posting lists at most this long are never deferred
 std::string VERSION = "3.5.0";                      // Version of MashMap
 }
 }
@@ -21,6 +21,7 @@ private:
     std::vector<std::string> targetSequenceNames;
     std::vector<std::string> allPrefixes;
     std::string prefixDelim;
+    std::vector<std::string> groupNames;    // group key of each group, indexed by group id - 1
     seqno_t nextId = 0;
 
 public:
@@ -270,6 +271,11 @@ public:
         throw std::runtime_error("Invalid sequence ID: " + std::to_string(seqId));
     }
 
+    // The prefix or sequence name that defines a group
+    const std::string& getGroupName(int groupId) const {
+        return groupNames.at(groupId - 1);
+    }
+
 private:
 
     void buildRefGroups() {
@@ -284,6 +290,7 @@ private:
 
         int currentGroup = 0;
         std::unordered_map<std::string, int> groupMap;
+        groupNames.clear();
 
         for (const auto& [seqName, originalIndex] : seqInfoWithIndex) {
             std::string groupKey;
@@ -317,6 +324,7 @@ private:
 
             if (groupMap.find(groupKey) == groupMap.end()) {
                 groupMap[groupKey] = ++currentGroup;
+                groupNames.push_back(groupKey);
             }
             metadata[originalIndex].groupId = groupMap[groupKey];
         }
@@ -9,6 +9,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <deque>
 #include <map>
 #include <unordered_map>
 #include <unordered_set>
@@ -22,11 +23,11 @@ namespace fs = std::filesystem;
 #include "map/include/base_types.hpp"
 #include "map/include/map_parameters.hpp"
 #include "map/include/commonFunc.hpp"
-#include "map/include/ThreadPool.hpp"
 
 //External includes
 #include "common/murmur3.h"
 #include "common/prettyprint.hpp"
+#include "common/perf_counters.hpp"
 #include "csv.h"
 
 //#include "common/sparsehash/dense_hash_map"
@@ -43,6 +44,8 @@ namespace fs = std::filesystem;
 #include "common/progress.hpp"
 #include <thread>
 #include <atomic>
+#include "taskflow/taskflow.hpp"
+#include "taskflow/algorithm/for_each.hpp"
 
 //#include "assert.hpp"
 
@@ -142,21 +145,28 @@ namespace skch
              SequenceIdManager& idMgr,
              const std::vector<std::string>& targets = {},
              std::ifstream* indexStream = nullptr,
-             std::shared_ptr<progress_meter::ProgressMeter> progress = nullptr)
+             std::shared_ptr<progress_meter::ProgressMeter> progress = nullptr,
+             tf::Executor* executor = nullptr)
         : param(std::move(p)),
           idManager(idMgr)
       {
         if (indexStream) {
           readIndex(*indexStream, targets);
         } else {
-          initialize(targets, progress);
+          initialize(targets, progress, executor);
         }
       }
 
     public:
       void initialize(const std::vector<std::string>& targets = {}, 
-                     std::shared_ptr<progress_meter::ProgressMeter> progress = nullptr) {
-        this->build(true, targets, progress);
+                     std::shared_ptr<progress_meter::ProgressMeter> progress = nullptr,
+                     tf::Executor* executor = nullptr) {
+        if (executor == nullptr) {
+          tf::Executor local_executor(param.threads);
+          this->build(true, local_executor, targets, progress);
+        } else {
+          this->build(true, *executor, targets, progress);
+        }
         this->hgNumerator = param.hgNumerator;
         isInitialized = true;
       }
@@ -168,16 +178,50 @@ namespace skch
        *
        * @details   Iterate through ref sequences to get metadata and
        *            optionally compute and save minmers from the reference sequence(s)
-       *            assuming a fixed window size
+       *            assuming a fixed window size. All the work runs on the given executor,
+       *            which is shared with mapping so that sketching never adds threads to -t
        * @param     compute_seeds   Whether to compute seeds or just collect metadata
+       * @param     executor        Executor running the sketching and index building tasks
        * @param     target_ids      Set of target sequence IDs to sketch over
        */
-      void build(bool compute_seeds, const std::vector<std::string>& target_names = {}, 
+      void build(bool compute_seeds, tf::Executor& executor,
+                const std::vector<std::string>& target_names = {}, 
                 std::shared_ptr<progress_meter::ProgressMeter> external_progress = nullptr)
       {
         std::chrono::time_point<std::chrono::system_clock> t0 = skch::Time::now();
 
         if (compute_seeds) {
+          // The build waits on its own tasks with corun, which must be called from a worker
+          if (executor.this_worker_id() < 0) {
+              tf::Taskflow build_flow;
+              build_flow.emplace([&]() { buildSeeds(executor, target_names, external_progress); });
+              executor.run(build_flow).wait();
+          } else {
+              buildSeeds(executor, target_names, external_progress);
+          }
+        }
+
+        std::chrono::duration<double> timeRefSketch = skch::Time::now() - t0;
+        std::cerr << "[wfmash::mashmap] reference index computed in " << timeRefSketch.count() << "s" << std::endl;
+
+        if (this->minmerIndex.size() == 0)
+        {
+          std::cerr << "[wfmash::mashmap] ERROR, reference sketch is empty. "
+                    << "Reference sequences shorter than the kmer size are not indexed" << std::endl;
+          exit(1);
+        }
+      }
+
+      /**
+       * @brief     Compute the minmers of the target sequences and index them
+       * @details   Sequences are sketched by tasks spawned while the file is read, then the
+       *            k-mer frequencies and the index are computed over chunks of the sketches;
+       *            must be called from a worker of the executor
+       */
+      void buildSeeds(tf::Executor& executor,
+                      const std::vector<std::string>& target_names,
+                      std::shared_ptr<progress_meter::ProgressMeter> external_progress)
+      {
           // Calculate total sequence length from id manager
           uint64_t total_seq_length = 0;
           for (const auto& seqName : target_names) {
@@ -196,19 +240,16 @@ namespace skch
                   param.use_progress_bar);
           }
 
-          // Create the thread pool 
-          ThreadPool<InputSeqContainer, MI_Type> threadPool(
-              [this, sketch_progress](InputSeqContainer* e) { 
-                  return buildHelper(e, sketch_progress.get()); 
-              }, 
-              param.threads);
-
           size_t totalSeqProcessed = 0;
           size_t totalSeqSkipped = 0;
           size_t shortestSeqLength = std::numeric_limits<size_t>::max();
-          
-          // Vector to store all thread outputs
-          std::vector<MI_Type*> threadOutputs;
+
+          // Sketch of each sequence, in input order; a deque keeps the slots of running tasks valid
+          std::deque<MI_Type*> threadOutputs;
+
+          // Bound the sequences held in memory while the reader runs ahead of the sketching tasks
+          const size_t max_in_flight = 2 * executor.num_workers();
+          std::atomic<size_t> in_flight{0};
 
           for (const auto& fileName : param.refSequences) {
               seqiter::for_each_seq_in_file(
@@ -217,14 +258,18 @@ namespace skch
                   [&](const std::string& seq_name, const std::string& seq) {
                       if (seq.length() >= param.segLength) {
                           seqno_t seqId = idManager.getSequenceId(seq_name);
-                          threadPool.runWhenThreadAvailable(new InputSeqContainer(seq, seq_name, seqId));
+                          executor.corun_until([&]() { return in_flight.load() < max_in_flight; });
+                          InputSeqContainer* input = new InputSeqContainer(seq, seq_name, seqId);
+                          threadOutputs.push_back(nullptr);
+                          MI_Type** slot = &threadOutputs.back();
+                          in_flight.fetch_add(1);
+                          executor.silent_async([this, input, slot, &in_flight, sketch_progress]() {
+                              *slot = buildHelper(input, sketch_progress.get());
+                              delete input;
+                              in_flight.fetch_sub(1);
+                          });
                           totalSeqProcessed++;
                           shortestSeqLength = std::min(shortestSeqLength, seq.length());
-
-                          while (threadPool.outputAvailable()) {
-                              auto output = threadPool.popOutputWhenAvailable();
-                              threadOutputs.push_back(output);
-                          }
                       } else {
                           totalSeqSkipped++;
                           std::cerr << "WARNING, skch::Sketch::build, skipping short sequence: " << seq_name 
@@ -232,11 +277,7 @@ namespace skch
                       }
                   });
           }
-
-          while (threadPool.running()) {
-              auto output = threadPool.popOutputWhenAvailable();
-              threadOutputs.push_back(output);
-          }
+          executor.corun_until([&]() { return in_flight.load() == 0; });
 
           // Make sure to finish first progress meter if we created it
           if (!external_progress) {
@@ -261,104 +302,100 @@ namespace skch
                   param.use_progress_bar);
           }
 
-          // Parallel k-mer frequency counting
-          std::vector<HF_Map_t> thread_kmer_freqs(param.threads);
-          std::vector<std::thread> freq_threads;
-          
-          // Split outputs into chunks for parallel processing
-          size_t chunk_size = (threadOutputs.size() + param.threads - 1) / param.threads;
-          
-          for (size_t t = 0; t < param.threads; ++t) {
-              freq_threads.emplace_back([&, t]() {
-                  size_t start = t * chunk_size;
-                  size_t end = std::min(start + chunk_size, threadOutputs.size());
-                  
-                  for (size_t i = start; i < end; ++i) {
-                      for (const MinmerInfo& mi : *threadOutputs[i]) {
-                          thread_kmer_freqs[t][mi.hash]++;
-                      }
+          // Contiguous chunks of sketches, more than workers so that idle workers can steal chunks;
+          // chunk results are merged in chunk order, which keeps the index in input order
+          const size_t num_chunks = std::max<size_t>(1, std::min(threadOutputs.size(), 4 * executor.num_workers()));
+          const size_t chunk_size = (threadOutputs.size() + num_chunks - 1) / num_chunks;
+          auto run_chunks = [&](const size_t count, const std::function<void(size_t)>& f) {
+              tf::Taskflow flow;
+              flow.for_each_index(size_t(0), count, size_t(1), f, tf::DynamicPartitioner(1));
+              executor.corun(flow);
+          };
+
+          // Parallel k-mer frequency counting, sharded by hash so that shards can be merged in parallel
+          const size_t num_shards = num_chunks;
+          std::vector<std::vector<HF_Map_t>> chunk_kmer_freqs(num_chunks, std::vector<HF_Map_t>(num_shards));
+          run_chunks(num_chunks, [&](size_t c) {
+              size_t start = c * chunk_size;
+              size_t end = std::min(start + chunk_size, threadOutputs.size());
+              for (size_t i = start; i < end; ++i) {
+                  for (const MinmerInfo& mi : *threadOutputs[i]) {
+                      chunk_kmer_freqs[c][mi.hash % num_shards][mi.hash]++;
                   }
-              });
-          }
-          
-          for (auto& thread : freq_threads) {
-              thread.join();
-          }
-
-          // Merge frequency maps
-          HF_Map_t kmer_freqs;
-          for (const auto& thread_freq : thread_kmer_freqs) {
-              for (const auto& [hash, freq] : thread_freq) {
-                  kmer_freqs[hash] += freq;
               }
+          });
+
+          // Merge frequency maps, one task per hash shard
+          std::vector<HF_Map_t> kmer_freqs(num_shards);
+          run_chunks(num_shards, [&](size_t shard) {
+              for (auto& chunk_freqs : chunk_kmer_freqs) {
+                  for (const auto& [hash, freq] : chunk_freqs[shard]) {
+                      kmer_freqs[shard][hash] += freq;
+                  }
+                  HF_Map_t().swap(chunk_freqs[shard]);
+              }
+          });
+          chunk_kmer_freqs.clear();
+
+          uint64_t min_occ = 10;
+          uint64_t max_occ = std::numeric_limits<uint64_t>::max();
+          uint64_t count_threshold;
+          if (param.max_kmer_freq <= 1.0) {
+              count_threshold = std::min(max_occ, 
+                                       std::max(min_occ, 
+                                              (uint64_t)(total_windows * param.max_kmer_freq)));
+          } else {
+              count_threshold = std::min(max_occ,
+                                       std::max(min_occ,
+                                              (uint64_t)param.max_kmer_freq));
           }
 
           // Parallel index building
-          std::vector<MI_Map_t> thread_pos_indexes(param.threads);
-          std::vector<MI_Type> thread_minmer_indexes(param.threads);
-          std::vector<uint64_t> thread_total_kmers(param.threads, 0);
-          std::vector<uint64_t> thread_filtered_kmers(param.threads, 0);
-          std::vector<std::thread> index_threads;
-
-          for (size_t t = 0; t < param.threads; ++t) {
-              index_threads.emplace_back([&, t]() {
-                  size_t start = t * chunk_size;
-                  size_t end = std::min(start + chunk_size, threadOutputs.size());
-
-                  for (size_t i = start; i < end; ++i) {
-                      for (const MinmerInfo& mi : *threadOutputs[i]) {
-                          thread_total_kmers[t]++;
-                          
-                          auto freq_it = kmer_freqs.find(mi.hash);
-                          if (freq_it == kmer_freqs.end()) {
-                              continue;  // Should never happen
-                          }
-
-                          uint64_t freq = freq_it->second;
-                          uint64_t min_occ = 10;
-                          uint64_t max_occ = std::numeric_limits<uint64_t>::max();
-                          uint64_t count_threshold;
-                          
-                          if (param.max_kmer_freq <= 1.0) {
-                              count_threshold = std::min(max_occ, 
-                                                       std::max(min_occ, 
-                                                              (uint64_t)(total_windows * param.max_kmer_freq)));
-                          } else {
-                              count_threshold = std::min(max_occ,
-                                                       std::max(min_occ,
-                                                              (uint64_t)param.max_kmer_freq));
-                          }
-
-                          if (freq > count_threshold && freq > min_occ) {
-                              thread_filtered_kmers[t]++;
-                              continue;
-                          }
-
-                          auto& pos_list = thread_pos_indexes[t][mi.hash];
-                          if (pos_list.size() == 0 
-                                  || pos_list.back().hash != mi.hash 
-                                  || pos_list.back().pos != mi.wpos) {
-                              pos_list.push_back(IntervalPoint {mi.wpos, mi.hash, mi.seqId, side::OPEN});
-                              pos_list.push_back(IntervalPoint {mi.wpos_end, mi.hash, mi.seqId, side::CLOSE});
-                          } else {
-                              pos_list.back().pos = mi.wpos_end;
-                          }
-
-                          thread_minmer_indexes[t].push_back(mi);
-                          index_progress->increment(1);
+          std::vector<MI_Map_t> chunk_pos_indexes(num_chunks);
+          std::vector<MI_Type> chunk_minmer_indexes(num_chunks);
+          std::vector<uint64_t> chunk_total_kmers(num_chunks, 0);
+          std::vector<uint64_t> chunk_filtered_kmers(num_chunks, 0);
+          run_chunks(num_chunks, [&](size_t c) {
+              size_t start = c * chunk_size;
+              size_t end = std::min(start + chunk_size, threadOutputs.size());
+
+              for (size_t i = start; i < end; ++i) {
+                  for (const MinmerInfo& mi : *threadOutputs[i]) {
+                      chunk_total_kmers[c]++;
+
+                      const HF_Map_t& shard_freqs = kmer_freqs[mi.hash % num_shards];
+                      auto freq_it = shard_freqs.find(mi.hash);
+                      if (freq_it == shard_freqs.end()) {
+                          continue;  // Should never happen
                       }
-                      delete threadOutputs[i];
-                  }
-              });
-          }
 
-          for (auto& thread : index_threads) {
-              thread.join();
-          }
+                      uint64_t freq = freq_it->second;
+                      if (freq > count_threshold && freq > min_occ) {
+                          chunk_filtered_kmers[c]++;
+                          continue;
+                      }
+
+                      auto& pos_list = chunk_pos_indexes[c][mi.hash];
+                      if (pos_list.size() == 0 
+                              || pos_list.back().hash != mi.hash 
+                              || pos_list.back().pos != mi.wpos) {
+                          pos_list.push_back(IntervalPoint {mi.wpos, mi.hash, mi.seqId, side::OPEN});
+                          pos_list.push_back(IntervalPoint {mi.wpos_end, mi.hash, mi.seqId, side::CLOSE});
+                      } else {
+                          pos_list.back().pos = mi.wpos_end;
+                      }
+
+                      chunk_minmer_indexes[c].push_back(mi);
+                      index_progress->increment(1);
+                  }
+                  delete threadOutputs[i];
+              }
+          });
+          kmer_freqs.clear();
 
           // Merge results
-          uint64_t total_kmers = std::accumulate(thread_total_kmers.begin(), thread_total_kmers.end(), 0ULL);
-          uint64_t filtered_kmers = std::accumulate(thread_filtered_kmers.begin(), thread_filtered_kmers.end(), 0ULL);
+          uint64_t total_kmers = std::accumulate(chunk_total_kmers.begin(), chunk_total_kmers.end(), 0ULL);
+          uint64_t filtered_kmers = std::accumulate(chunk_filtered_kmers.begin(), chunk_filtered_kmers.end(), 0ULL);
 
           // Clear and resize main indexes
           minmerPosLookupIndex.clear();
@@ -366,26 +403,31 @@ namespace skch
           
           // Reserve approximate space
           size_t total_minmers = 0;
-          for (const auto& thread_index : thread_minmer_indexes) {
-              total_minmers += thread_index.size();
+          for (const auto& chunk_index : chunk_minmer_indexes) {
+              total_minmers += chunk_index.size();
           }
           minmerIndex.reserve(total_minmers);
 
+          // The merges below run on one thread
+          const auto merge_start = skch::Time::now();
+
           // Merge position lookup indexes
-          for (auto& thread_pos_index : thread_pos_indexes) {
-              for (auto& [hash, pos_list] : thread_pos_index) {
+          for (auto& chunk_pos_index : chunk_pos_indexes) {
+              for (auto& [hash, pos_list] : chunk_pos_index) {
                   auto& main_pos_list = minmerPosLookupIndex[hash];
                   main_pos_list.insert(main_pos_list.end(), pos_list.begin(), pos_list.end());
               }
+              MI_Map_t().swap(chunk_pos_index);
           }
 
           // Merge minmer indexes
-          for (auto& thread_index : thread_minmer_indexes) {
+          for (auto& chunk_index : chunk_minmer_indexes) {
               minmerIndex.insert(minmerIndex.end(), 
-                               std::make_move_iterator(thread_index.begin()),
-                               std::make_move_iterator(thread_index.end()));
+                               std::make_move_iterator(chunk_index.begin()),
+                               std::make_move_iterator(chunk_index.end()));
           }
-          
+          perf_counters::serial(perf_counters::index_merge, skch::Time::now() - merge_start);
+
           // Finish second progress meter if we created it
           if (!external_progress) {
               index_progress->finish();
@@ -409,17 +451,6 @@ namespace skch
                                       })() + "%" :
                                       ">" + std::to_string((int)param.max_kmer_freq) + " occurrences") 
                     << ")" << std::endl;
-        }
-
-        std::chrono::duration<double> timeRefSketch = skch::Time::now() - t0;
-        std::cerr << "[wfmash::mashmap] reference index computed in " << timeRefSketch.count() << "s" << std::endl;
-
-        if (this->minmerIndex.size() == 0)
-        {
-          std::cerr << "[wfmash::mashmap] ERROR, reference sketch is empty. "
-                    << "Reference sequences shorter than the kmer size are not indexed" << std::endl;
-          exit(1);
-        }
       }
 
       public:
@@ -433,6 +464,7 @@ namespace skch
       MI_Type* buildHelper(InputSeqContainer *input, progress_meter::ProgressMeter* progress = nullptr)
       {
         MI_Type* thread_output = new MI_Type();
+        perf_counters::Scope scope(perf_counters::sketching);
 
         //Compute minmers in reference sequence
         skch::CommonFunc::addMinmers(
@@ -444,7 +476,18 @@ namespace skch
                 param.alphabetSize, 
                 param.sketchSize,
                 input->seqId,
-                progress);
+                progress,
+                param.spaced_seeds,
+                param.syncmerSize);
+
+        // Sampled index: keep the minimizers whose hash falls in the sampled fraction
+        if (param.index_sampling < 1.0) {
+          thread_output->erase(
+              std::remove_if(thread_output->begin(), thread_output->end(), [this](const MinmerInfo& mi) {
+                  return !CommonFunc::keepSampledHash(mi.hash, param.index_sampling);
+              }),
+              thread_output->end());
+        }
 
         return thread_output;
       }
@@ -554,10 +597,33 @@ namespace skch
        */
       void writeParameters(std::ofstream& outStream)
       {
-        // Write segment length, sketch size, and kmer size
+        // Write segment length, sketch size, kmer size, sampling fraction and k-mer selection scheme
         outStream.write((char*) &param.segLength, sizeof(param.segLength));
         outStream.write((char*) &param.sketchSize, sizeof(param.sketchSize));
         outStream.write((char*) &param.kmerSize, sizeof(param.kmerSize));
+        outStream.write((char*) &param.index_sampling, sizeof(param.index_sampling));
+        outStream.write((char*) &param.syncmerSize, sizeof(param.syncmerSize));
+
+        // Write the spaced seed set, query sketches must hash with the same patterns
+        uint32_t num_seeds = param.spaced_seeds.size();
+        outStream.write((char*) &num_seeds, sizeof(num_seeds));
+        for (const auto& sp : param.spaced_seeds) {
+          uint32_t seed_length = sp.length;
+          outStream.write((char*) &seed_length, sizeof(seed_length));
+          outStream.write(sp.seed, seed_length);
+        }
+      }
+
+      /**
+       * @brief  Spaced seed set as passed to --spaced-seeds
+       */
+      static std::string spacedSeedString(const std::vector<std::string>& seeds)
+      {
+        std::string s;
+        for (const auto& seed : seeds) {
+          s += (s.empty() ? "" : ",") + seed;
+        }
+        return s.empty() ? "none" : s;
       }
 
 
@@ -585,10 +651,60 @@ namespace skch
         outStream.close();
       }
 
+      /**
+       * Every subset of an index file starts with INDEX_MAGIC and INDEX_FORMAT_VERSION.
+       * Bump the version whenever the header, parameter or sketch layout changes:
+       *  1: LEGACY_INDEX_MAGIC, no version field
+       *  2: sampling fraction, syncmer size and spaced seeds in the parameters
+       */
+      static constexpr uint64_t INDEX_MAGIC = 0x57464d4153484958; // "WFMASHIX"
+      static constexpr uint64_t LEGACY_INDEX_MAGIC = 0xDEADBEEFCAFEBABE;
+      static constexpr uint32_t INDEX_FORMAT_VERSION = 2;
+
+      // Sanity limits on the seed set read back from an index
+      static constexpr uint32_t INDEX_MAX_SPACED_SEEDS = 64;
+      static constexpr uint32_t INDEX_MAX_SEED_LENGTH = 1024;
+
+      static void writeIndexFormat(std::ostream& outStream)
+      {
+        outStream.write(reinterpret_cast<const char*>(&INDEX_MAGIC), sizeof(INDEX_MAGIC));
+        outStream.write(reinterpret_cast<const char*>(&INDEX_FORMAT_VERSION), sizeof(INDEX_FORMAT_VERSION));
+      }
+
+      /**
+       * @brief   Read the magic number and format version at the start of a subset
+       * @return  Empty if the index can be read, otherwise why not
+       */
+      static std::string readIndexFormat(std::istream& inStream)
+      {
+        uint64_t magic_number = 0;
+        inStream.read(reinterpret_cast<char*>(&magic_number), sizeof(magic_number));
+        if (!inStream) {
+          return "truncated index file";
+        }
+        if (magic_number == LEGACY_INDEX_MAGIC) {
+          return "index was written by an older wfmash without a format version, rebuild it with --write-index";
+        }
+        if (magic_number != INDEX_MAGIC) {
+          std::stringstream ss;
+          ss << "not a wfmash index (magic number 0x" << std::hex << magic_number << ")";
+          return ss.str();
+        }
+        uint32_t version = 0;
+        inStream.read(reinterpret_cast<char*>(&version), sizeof(version));
+        if (!inStream) {
+          return "truncated index file";
+        }
+        if (version != INDEX_FORMAT_VERSION) {
+          return "index format version " + std::to_string(version) + " differs from version "
+                 + std::to_string(INDEX_FORMAT_VERSION) + " of this wfmash, rebuild it with --write-index";
+        }
+        return "";
+      }
+
       void writeSubIndexHeader(std::ofstream& outStream, const std::vector<std::string>& target_subset, size_t batch_idx = 0, size_t total_batches = 1) 
       {
-        const uint64_t magic_number = 0xDEADBEEFCAFEBABE;
-        outStream.write(reinterpret_cast<const char*>(&magic_number), sizeof(magic_number));
+        writeIndexFormat(outStream);
   
         // Write batch information
         outStream.write(reinterpret_cast<const char*>(&batch_idx), sizeof(batch_idx));
@@ -668,20 +784,60 @@ namespace skch
         decltype(param.segLength) index_segLength;
         decltype(param.sketchSize) index_sketchSize;
         decltype(param.kmerSize) index_kmerSize;
+        decltype(param.index_sampling) index_sampling;
+        decltype(param.syncmerSize) index_syncmerSize;
 
         inStream.read((char*) &index_segLength, sizeof(index_segLength));
         inStream.read((char*) &index_sketchSize, sizeof(index_sketchSize));
         inStream.read((char*) &index_kmerSize, sizeof(index_kmerSize));
+        inStream.read((char*) &index_sampling, sizeof(index_sampling));
+        inStream.read((char*) &index_syncmerSize, sizeof(index_syncmerSize));
+
+        uint32_t num_seeds = 0;
+        inStream.read((char*) &num_seeds, sizeof(num_seeds));
+        if (!inStream || num_seeds > INDEX_MAX_SPACED_SEEDS) {
+          std::cerr << "[wfmash::mashmap] ERROR: corrupt index, " << num_seeds << " spaced seeds" << std::endl;
+          exit(1);
+        }
+        std::vector<std::string> index_seeds(num_seeds);
+        for (auto& seed : index_seeds) {
+          uint32_t seed_length = 0;
+          inStream.read((char*) &seed_length, sizeof(seed_length));
+          if (!inStream || seed_length > INDEX_MAX_SEED_LENGTH) {
+            std::cerr << "[wfmash::mashmap] ERROR: corrupt index, spaced seed of length " << seed_length << std::endl;
+            exit(1);
+          }
+          seed.resize(seed_length);
+          inStream.read(&seed[0], seed_length);
+        }
+        std::vector<std::string> current_seeds;
+        for (const auto& sp : param.spaced_seeds) {
+          current_seeds.emplace_back(sp.seed, sp.length);
+        }
+        if (index_seeds != current_seeds) {
+          std::cerr << "[wfmash::mashmap] ERROR: Spaced seeds of indexed sketch differ from current seeds" << std::endl;
+          std::cerr << "[wfmash::mashmap] Index --> " << spacedSeedString(index_seeds) << std::endl;
+          std::cerr << "[wfmash::mashmap] Current --> " << spacedSeedString(current_seeds) << std::endl;
+          if (!index_seeds.empty()) {
+            std::cerr << "[wfmash::mashmap] Pass --spaced-seeds " << spacedSeedString(index_seeds)
+                      << " to map against this index" << std::endl;
+          }
+          exit(1);
+        }
 
         if (param.segLength != index_segLength 
             || param.sketchSize != index_sketchSize
-            || param.kmerSize != index_kmerSize)
+            || param.kmerSize != index_kmerSize
+            || param.index_sampling != index_sampling
+            || param.syncmerSize != index_syncmerSize)
         {
           std::cerr << "[wfmash::mashmap] ERROR: Parameters of indexed sketch differ from current parameters" << std::endl;
           std::cerr << "[wfmash::mashmap] Index --> segLength=" << index_segLength
-                    << " sketchSize=" << index_sketchSize << " kmerSize=" << index_kmerSize << std::endl;
+                    << " sketchSize=" << index_sketchSize << " kmerSize=" << index_kmerSize
+                    << " sampling=" << index_sampling << " syncmers=" << index_syncmerSize << std::endl;
           std::cerr << "[wfmash::mashmap] Current --> segLength=" << param.segLength
-                    << " sketchSize=" << param.sketchSize << " kmerSize=" << param.kmerSize << std::endl;
+                    << " sketchSize=" << param.sketchSize << " kmerSize=" << param.kmerSize
+                    << " sampling=" << param.index_sampling << " syncmers=" << param.syncmerSize << std::endl;
           exit(1);
         }
       }
@@ -696,11 +852,9 @@ namespace skch
         // Save position for potential error recovery
         std::streampos startPos = inStream.tellg();
         
-        uint64_t magic_number = 0;
-        inStream.read(reinterpret_cast<char*>(&magic_number), sizeof(magic_number));
-        if (!inStream || magic_number != 0xDEADBEEFCAFEBABE) {
-            std::cerr << "Error: Invalid magic number (0x" << std::hex << magic_number 
-                      << std::dec << ") when skipping subset" << std::endl;
+        const std::string format_error = readIndexFormat(inStream);
+        if (!format_error.empty()) {
+            std::cerr << "Error: " << format_error << " when skipping subset" << std::endl;
             // Try to recover
             inStream.clear();
             inStream.seekg(startPos);
@@ -758,9 +912,20 @@ namespace skch
         decltype(param.segLength) segLength;
         decltype(param.sketchSize) sketchSize;
         decltype(param.kmerSize) kmerSize;
+        decltype(param.index_sampling) sampling;
+        decltype(param.syncmerSize) syncmerSize;
         inStream.read(reinterpret_cast<char*>(&segLength), sizeof(segLength));
         inStream.read(reinterpret_cast<char*>(&sketchSize), sizeof(sketchSize));
         inStream.read(reinterpret_cast<char*>(&kmerSize), sizeof(kmerSize));
+        inStream.read(reinterpret_cast<char*>(&sampling), sizeof(sampling));
+        inStream.read(reinterpret_cast<char*>(&syncmerSize), sizeof(syncmerSize));
+        uint32_t num_seeds = 0;
+        inStream.read(reinterpret_cast<char*>(&num_seeds), sizeof(num_seeds));
+        for (uint32_t i = 0; i < num_seeds; ++i) {
+            uint32_t seed_length = 0;
+            inStream.read(reinterpret_cast<char*>(&seed_length), sizeof(seed_length));
+            inStream.seekg(seed_length, std::ios::cur);
+        }
         
         // Skip minmer index
         typename MI_Type::size_type size = 0;
@@ -828,11 +993,9 @@ namespace skch
         // Save position for potential error recovery
         std::streampos headerStart = inStream.tellg();
         
-        uint64_t magic_number = 0;
-        inStream.read(reinterpret_cast<char*>(&magic_number), sizeof(magic_number));
-        if (!inStream || magic_number != 0xDEADBEEFCAFEBABE) {
-            std::cerr << "Error: Invalid magic number in index file: 0x" 
-                      << std::hex << magic_number << std::dec << std::endl;
+        const std::string format_error = readIndexFormat(inStream);
+        if (!format_error.empty()) {
+            std::cerr << "[wfmash::mashmap] ERROR: " << format_error << std::endl;
             // Try to recover from byte alignment issues
             inStream.clear();
             inStream.seekg(headerStart);
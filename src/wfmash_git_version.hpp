@@ -0,0 +1 @@
+#define WFMASH_GIT_VERSION "a14e221"
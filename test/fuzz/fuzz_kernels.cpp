@@ -0,0 +1,460 @@
+/**
+ * @file    fuzz_kernels.cpp
+ * @brief   differential fuzzer for the mapping and formatting kernels
+ * @details Runs the live kernels and their frozen copies in reference_kernels.hpp on random and
+ *          adversarial inputs (N runs, homopolymers, tandem repeats, reverse-complement
+ *          palindromes, lowercase and non-ACGT characters) and requires bit-for-bit equal output.
+ *          Spaced seeds and syncmers have no reference, their sketches are checked for the
+ *          invariants every sketch must hold. Also checks that a sketch does not depend on the
+ *          strand of its sequence, and parses compressed CIGARs against a plain parser.
+ *          Every case is derived from the seed, so a failure is reproduced with the printed
+ *          seed and iteration; a crash prints them too, along with the kernel that crashed.
+ *
+ *          Not covered: the L1/L2 sweeps and mergeMappingsInRange are skch::Map members that
+ *          need a loaded index and query, and process_compressed_cigar is compiled with the
+ *          WFA2-linked aligner; the integration tests exercise them on real data.
+ *
+ *          Usage: fuzz_kernels [-s seed] [-n iterations]
+ */
+
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "map/include/commonFunc.hpp"
+#include "map/include/sequenceIds.hpp"
+#include "map/include/filter.hpp"
+#include "common/wflign/src/alignment_formatter.hpp"
+#include "reference_kernels.hpp"
+
+namespace {
+
+using rng_t = std::mt19937_64;
+
+uint64_t cases = 0;
+uint64_t failures = 0;
+
+// What is running, for the crash handler
+const char* volatile current_kernel = "setup";
+volatile uint64_t current_seed = 0;
+volatile uint64_t current_iteration = 0;
+
+void appendNumber(char* buf, size_t& n, uint64_t v) {
+    char digits[20];
+    int d = 0;
+    do { digits[d++] = '0' + v % 10; v /= 10; } while (v);
+    while (d) buf[n++] = digits[--d];
+}
+
+void appendText(char* buf, size_t& n, const char* text) {
+    while (*text) buf[n++] = *text++;
+}
+
+// Report the case that crashed with async-signal-safe calls only, then exit
+extern "C" void onCrash(int sig) {
+    char buf[256];
+    size_t n = 0;
+    appendText(buf, n, "[wfmash::fuzz] CRASH (signal ");
+    appendNumber(buf, n, sig);
+    appendText(buf, n, ") in ");
+    const char* kernel = current_kernel;
+    for (size_t i = 0; kernel[i] && i < 64; ++i) buf[n++] = kernel[i];
+    appendText(buf, n, " (seed ");
+    appendNumber(buf, n, current_seed);
+    appendText(buf, n, ", iteration ");
+    appendNumber(buf, n, current_iteration);
+    appendText(buf, n, ")\n");
+    if (write(STDERR_FILENO, buf, n) < 0) {}
+    _exit(2);
+}
+
+int uniform(rng_t& rng, int lo, int hi) {
+    return std::uniform_int_distribution<int>(lo, hi)(rng);
+}
+
+std::string randomBases(rng_t& rng, int len, const char* alphabet = "ACGT") {
+    const int n = std::strlen(alphabet);
+    std::string s(len, 'A');
+    for (auto& c : s) c = alphabet[uniform(rng, 0, n - 1)];
+    return s;
+}
+
+std::string reverseComplement(const std::string& s) {
+    std::string rc(s.size(), 'N');
+    skch::CommonFunc::reverseComplement(s.data(), &rc[0], s.size());
+    return rc;
+}
+
+// A sequence of at least minLen characters stitched from random and adversarial segments
+std::string adversarialSequence(rng_t& rng, int minLen) {
+    const int len = minLen + uniform(rng, 0, uniform(rng, 0, 1) ? 64 : 3000);
+    std::string s;
+    while ((int)s.size() < len) {
+        const int seg = uniform(rng, 1, 200);
+        switch (uniform(rng, 0, 7)) {
+        case 0: // N run
+            s += std::string(uniform(rng, 1, 40), 'N');
+            break;
+        case 1: // homopolymer
+            s += std::string(seg, "ACGT"[uniform(rng, 0, 3)]);
+            break;
+        case 2: { // tandem repeat
+            const std::string unit = randomBases(rng, uniform(rng, 2, 30));
+            for (int r = uniform(rng, 2, 20); r > 0; --r) s += unit;
+            break;
+        }
+        case 3: { // reverse-complement palindrome
+            const std::string half = randomBases(rng, seg / 2 + 1);
+            s += half + reverseComplement(half);
+            break;
+        }
+        case 4: // soft-masked bases
+            s += randomBases(rng, seg, "acgt");
+            break;
+        case 5: // IUPAC codes and other characters that are not ACGT
+            s += randomBases(rng, uniform(rng, 1, 10), "RYKMSWBDHVN-.*");
+            break;
+        default:
+            s += randomBases(rng, seg);
+            break;
+        }
+    }
+    s.resize(len);
+    return s;
+}
+
+// A 0/1 pattern that starts and ends with a 1
+ales::spaced_seed randomSpacedSeed(rng_t& rng, std::vector<std::string>& storage) {
+    std::string p = randomBases(rng, uniform(rng, 6, 24), "01");
+    p.front() = p.back() = '1';
+    storage.push_back(p);
+    return ales::spaced_seed{&storage.back()[0], storage.back().size()};
+}
+
+struct SketchCase {
+    int kmerSize;
+    int windowSize;
+    int alphabetSize;
+    int sketchSize;
+    int syncmerSize;
+    std::vector<ales::spaced_seed> spacedSeeds;
+    std::vector<std::string> seedStorage;
+};
+
+SketchCase randomSketchCase(rng_t& rng) {
+    SketchCase c;
+    c.kmerSize = uniform(rng, 5, 21);
+    c.windowSize = uniform(rng, 1, 300);
+    c.alphabetSize = uniform(rng, 0, 9) == 0 ? 20 : 4;
+    c.sketchSize = uniform(rng, 1, 40);
+    c.syncmerSize = 0;
+    c.seedStorage.reserve(3);
+    switch (uniform(rng, 0, 3)) {
+    case 0:
+        c.syncmerSize = uniform(rng, 2, c.kmerSize - 2);
+        break;
+    case 1:
+        for (int n = uniform(rng, 1, 3); n > 0; --n) c.spacedSeeds.push_back(randomSpacedSeed(rng, c.seedStorage));
+        break;
+    default:
+        break;
+    }
+    return c;
+}
+
+int span(const SketchCase& c) {
+    return c.spacedSeeds.empty() ? c.kmerSize : skch::CommonFunc::spacedSeedSpan(c.spacedSeeds);
+}
+
+std::string describe(const SketchCase& c, const std::string& seq) {
+    std::stringstream ss;
+    ss << "k=" << c.kmerSize << " w=" << c.windowSize << " alphabet=" << c.alphabetSize
+       << " sketch=" << c.sketchSize << " syncmers=" << c.syncmerSize << " spaced=";
+    for (const auto& sp : c.spacedSeeds) ss << std::string(sp.seed, sp.length) << ",";
+    ss << " seq=" << seq;
+    return ss.str();
+}
+
+bool sameMinmers(const std::vector<skch::MinmerInfo>& a, const std::vector<skch::MinmerInfo>& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (std::tie(a[i].hash, a[i].wpos, a[i].wpos_end, a[i].seqId, a[i].strand)
+            != std::tie(b[i].hash, b[i].wpos, b[i].wpos_end, b[i].seqId, b[i].strand)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Invariants of any sketch, with or without a reference: windows inside the sequence and no
+// longer than windowSize for the index; distinct hashes in increasing order for a query sketch
+bool wellFormedIndex(const std::vector<skch::MinmerInfo>& index, int len, int span, int windowSize, skch::seqno_t seqId) {
+    for (size_t i = 0; i < index.size(); ++i) {
+        const auto& mi = index[i];
+        if (mi.wpos < 0 || mi.wpos >= mi.wpos_end || mi.wpos_end > len - span + 1
+            || mi.wpos_end - mi.wpos > windowSize || mi.seqId != seqId
+            || (mi.strand != skch::strnd::FWD && mi.strand != skch::strnd::REV && mi.strand != skch::strnd::AMBIG)) {
+            return false;
+        }
+        if (i > 0 && std::tie(index[i - 1].wpos, index[i - 1].wpos_end) > std::tie(mi.wpos, mi.wpos_end)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool wellFormedSketch(const std::vector<skch::MinmerInfo>& sketch, int len, int span, int sketchSize, skch::seqno_t seqId) {
+    if ((int)sketch.size() > sketchSize) return false;
+    for (size_t i = 0; i < sketch.size(); ++i) {
+        const auto& mi = sketch[i];
+        if (mi.wpos < 0 || mi.wpos > mi.wpos_end || mi.wpos_end > len - span || mi.seqId != seqId
+            || (i > 0 && sketch[i - 1].hash >= mi.hash)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void check(bool ok, const char* kernel, uint64_t seed, uint64_t iteration, const std::string& input) {
+    ++cases;
+    if (!ok) {
+        ++failures;
+        std::cerr << "[wfmash::fuzz] MISMATCH in " << kernel << " (seed " << seed << ", iteration "
+                  << iteration << "): " << input << std::endl;
+    }
+}
+
+void fuzzSketching(rng_t& rng, uint64_t seed, uint64_t iteration, progress_meter::ProgressMeter& progress) {
+    SketchCase c = randomSketchCase(rng);
+    const std::string seq = adversarialSequence(rng, span(c));
+    const skch::seqno_t seqId = uniform(rng, 0, 1000);
+
+    // The reference kernels hash plain k-mers only
+    const bool hasReference = c.spacedSeeds.empty() && c.syncmerSize == 0;
+
+    std::string live = seq, ref = seq;
+    std::vector<skch::MinmerInfo> liveIndex, refIndex;
+    current_kernel = "addMinmers";
+    skch::CommonFunc::addMinmers(liveIndex, &live[0], live.size(), c.kmerSize, c.windowSize, c.alphabetSize,
+                                 c.sketchSize, seqId, &progress, c.spacedSeeds, c.syncmerSize);
+    check(wellFormedIndex(liveIndex, seq.size(), span(c), c.windowSize, seqId), "addMinmers invariants",
+          seed, iteration, describe(c, seq));
+    if (hasReference) {
+        current_kernel = "reference addMinmers";
+        skch::Reference::addMinmers(refIndex, &ref[0], ref.size(), c.kmerSize, c.windowSize, c.alphabetSize,
+                                    c.sketchSize, seqId, &progress);
+        check(sameMinmers(liveIndex, refIndex), "addMinmers", seed, iteration, describe(c, seq));
+    }
+
+    live = seq, ref = seq;
+    std::vector<skch::MinmerInfo> liveSketch, refSketch;
+    current_kernel = "sketchSequence";
+    skch::CommonFunc::sketchSequence(liveSketch, &live[0], live.size(), c.kmerSize, c.alphabetSize,
+                                     c.sketchSize, seqId, c.spacedSeeds, c.syncmerSize);
+    check(wellFormedSketch(liveSketch, seq.size(), span(c), c.sketchSize, seqId), "sketchSequence invariants",
+          seed, iteration, describe(c, seq));
+    if (hasReference) {
+        current_kernel = "reference sketchSequence";
+        skch::Reference::sketchSequence(refSketch, &ref[0], ref.size(), c.kmerSize, c.alphabetSize,
+                                        c.sketchSize, seqId);
+        check(sameMinmers(liveSketch, refSketch), "sketchSequence", seed, iteration, describe(c, seq));
+    }
+
+    // A sketch holds the smallest hashes: a larger sketch of the same sequence extends it
+    live = seq;
+    std::vector<skch::MinmerInfo> largerSketch;
+    current_kernel = "sketchSequence";
+    skch::CommonFunc::sketchSequence(largerSketch, &live[0], live.size(), c.kmerSize, c.alphabetSize,
+                                     c.sketchSize + 5, seqId, c.spacedSeeds, c.syncmerSize);
+    bool prefix = largerSketch.size() >= liveSketch.size();
+    for (size_t i = 0; prefix && i < liveSketch.size(); ++i) prefix = largerSketch[i].hash == liveSketch[i].hash;
+    check(prefix, "sketchSequence bottom-s", seed, iteration, describe(c, seq));
+
+    // Canonical hashing: both strands of a sequence have the same sketch hashes. Not checked for
+    // syncmers, where the first of equal s-mers wins and a repeat inside a k-mer breaks the tie
+    // differently on the two strands, nor for seed sets of different spans, which are aligned
+    // at the start of each position and so cover different bases at the sequence ends
+    bool sameSpans = true;
+    for (const auto& sp : c.spacedSeeds) sameSpans &= (int)sp.length == span(c);
+    if (c.alphabetSize == 4 && c.syncmerSize == 0 && sameSpans) {
+        std::string rc = seq;
+        skch::CommonFunc::makeUpperCaseAndValidDNA(&rc[0], rc.size());
+        rc = reverseComplement(rc);
+        std::vector<skch::MinmerInfo> rcSketch;
+        current_kernel = "sketchSequence";
+        skch::CommonFunc::sketchSequence(rcSketch, &rc[0], rc.size(), c.kmerSize, c.alphabetSize,
+                                         c.sketchSize, seqId, c.spacedSeeds, c.syncmerSize);
+        std::vector<skch::hash_t> fwdHashes, rcHashes;
+        for (const auto& mi : liveSketch) fwdHashes.push_back(mi.hash);
+        for (const auto& mi : rcSketch) rcHashes.push_back(mi.hash);
+        std::sort(fwdHashes.begin(), fwdHashes.end());
+        std::sort(rcHashes.begin(), rcHashes.end());
+        check(fwdHashes == rcHashes, "sketchSequence strand symmetry", seed, iteration, describe(c, seq));
+    }
+}
+
+// Mappings of one query with many ties: shared starts and ends, equal scores, nested intervals
+skch::MappingResultsVector_t randomMappings(rng_t& rng) {
+    skch::MappingResultsVector_t mappings(uniform(rng, 0, 60));
+    const int queryLen = uniform(rng, 100, 20000);
+    std::vector<skch::offset_t> starts, ends;
+    for (int i = uniform(rng, 1, 8); i > 0; --i) starts.push_back(uniform(rng, 0, queryLen - 2));
+    const float identities[] = {0.7f, 0.85f, 0.9f, 0.95f, 1.0f};
+    for (auto& m : mappings) {
+        m = skch::MappingResult{};
+        m.queryLen = queryLen;
+        m.querySeqId = 0;
+        m.queryStartPos = uniform(rng, 0, 1) ? starts[uniform(rng, 0, starts.size() - 1)] : uniform(rng, 0, queryLen - 2);
+        m.queryEndPos = std::min<skch::offset_t>(queryLen, m.queryStartPos + 1 + uniform(rng, 0, uniform(rng, 0, 1) ? 50 : queryLen));
+        m.refSeqId = uniform(rng, 0, 3);
+        m.refStartPos = uniform(rng, 0, 100000);
+        m.refEndPos = m.refStartPos + (m.queryEndPos - m.queryStartPos);
+        m.blockLength = uniform(rng, 0, 9) == 0 ? 0 : m.queryEndPos - m.queryStartPos;
+        m.blockNucIdentity = identities[uniform(rng, 0, 4)];
+        m.nucIdentity = m.blockNucIdentity;
+        m.strand = uniform(rng, 0, 1) ? skch::strnd::FWD : skch::strnd::REV;
+        m.n_merged = 1;
+    }
+    return mappings;
+}
+
+bool sameMappings(const skch::MappingResultsVector_t& a, const skch::MappingResultsVector_t& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (std::tie(a[i].queryStartPos, a[i].queryEndPos, a[i].refSeqId, a[i].refStartPos, a[i].refEndPos,
+                     a[i].blockLength, a[i].blockNucIdentity, a[i].strand, a[i].discard, a[i].overlapped)
+            != std::tie(b[i].queryStartPos, b[i].queryEndPos, b[i].refSeqId, b[i].refStartPos, b[i].refEndPos,
+                        b[i].blockLength, b[i].blockNucIdentity, b[i].strand, b[i].discard, b[i].overlapped)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string describe(const skch::MappingResultsVector_t& mappings, int secondaryToKeep, bool dropRand, double overlap) {
+    std::stringstream ss;
+    ss << "secondaries=" << secondaryToKeep << " dropRand=" << dropRand << " overlap=" << overlap << " mappings=";
+    for (const auto& m : mappings) {
+        ss << "[" << m.queryStartPos << "," << m.queryEndPos << ") ref " << m.refSeqId << ":" << m.refStartPos
+           << " len " << m.blockLength << " id " << m.blockNucIdentity << "; ";
+    }
+    return ss.str();
+}
+
+void fuzzFilters(rng_t& rng, uint64_t seed, uint64_t iteration, progress_meter::ProgressMeter& progress) {
+    const skch::MappingResultsVector_t mappings = randomMappings(rng);
+    const int secondaryToKeep = uniform(rng, 0, 3);
+    const bool dropRand = uniform(rng, 0, 1);
+    const double overlapThresholds[] = {0.0, 0.5, 0.95, 1.0};
+    const double overlap = overlapThresholds[uniform(rng, 0, 3)];
+
+    auto live = mappings, ref = mappings;
+    current_kernel = "liFilterAlgorithm";
+    skch::Filter::query::liFilterAlgorithm(live, secondaryToKeep, dropRand, overlap, progress);
+    skch::Reference::query::liFilterAlgorithm(ref, secondaryToKeep, dropRand, overlap, progress);
+    check(sameMappings(live, ref), "liFilterAlgorithm", seed, iteration, describe(mappings, secondaryToKeep, dropRand, overlap));
+
+    live = mappings, ref = mappings;
+    current_kernel = "indexedFilterAlgorithm";
+    skch::Filter::query::indexedFilterAlgorithm(live, secondaryToKeep);
+    skch::Reference::query::indexedFilterAlgorithm(ref, secondaryToKeep);
+    check(sameMappings(live, ref), "indexedFilterAlgorithm", seed, iteration, describe(mappings, secondaryToKeep, false, 1.0));
+}
+
+void fuzzFormatting(rng_t& rng, uint64_t seed, uint64_t iteration) {
+    // A compressed CIGAR with repeated operations, as left by patching, inside a longer string
+    std::string cigar = randomBases(rng, uniform(rng, 0, 5), "=XID");
+    const int cigarStart = cigar.size();
+    uint64_t targetConsumed = 0;
+    for (int n = uniform(rng, 0, 40); n > 0; --n) {
+        const int len = uniform(rng, 1, 0 == uniform(rng, 0, 9) ? 100000 : 30);
+        const char op = "=XIDM"[uniform(rng, 0, 4)];
+        cigar += std::to_string(len) + op;
+        if (op != 'I') targetConsumed += len;
+    }
+    const int cigarEnd = cigar.size();
+    cigar += randomBases(rng, uniform(rng, 0, 5), "=XID");
+
+    const int targetStart = uniform(rng, 0, 100);
+    const std::string target = adversarialSequence(rng, targetStart + targetConsumed);
+
+    // Runs of the compressed CIGAR, parsed the plain way: a number, then its operation
+    std::vector<wflign::wavefront::cigar_run_t> runs, plainRuns;
+    current_kernel = "cigar_to_runs";
+    wflign::wavefront::cigar_to_runs(cigar.c_str(), cigarStart, cigarEnd, runs);
+    std::istringstream plain(cigar.substr(cigarStart, cigarEnd - cigarStart));
+    uint32_t len;
+    char op;
+    while (plain >> len >> op) {
+        if (!plainRuns.empty() && plainRuns.back().op == op) {
+            plainRuns.back().len += len;
+        } else {
+            plainRuns.push_back({len, op});
+        }
+    }
+    bool sameRuns = runs.size() == plainRuns.size();
+    for (size_t i = 0; sameRuns && i < runs.size(); ++i) {
+        sameRuns = runs[i].len == plainRuns[i].len && runs[i].op == plainRuns[i].op;
+    }
+    check(sameRuns, "cigar_to_runs", seed, iteration, cigar.substr(cigarStart, cigarEnd - cigarStart));
+
+    std::string live;
+    current_kernel = "append_md_tag";
+    wflign::wavefront::append_md_tag(live, cigar.c_str(), cigarStart, cigarEnd, targetStart, target.c_str());
+    std::stringstream ref;
+    wflign::wavefront::reference::write_tag_and_md_string(ref, cigar.c_str(), cigarStart, cigarEnd, targetStart, target.c_str());
+    check(live == ref.str(), "append_md_tag", seed, iteration, cigar.substr(cigarStart, cigarEnd - cigarStart));
+
+    const bool revComp = uniform(rng, 0, 1);
+    const std::string query = adversarialSequence(rng, 0);
+    live.clear();
+    current_kernel = "append_seq";
+    wflign::wavefront::append_seq(live, query.c_str(), query.size(), revComp);
+    std::stringstream refSeq;
+    wflign::wavefront::reference::write_seq(refSeq, query.c_str(), query.size(), revComp);
+    check(live == refSeq.str(), "append_seq", seed, iteration, query);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    uint64_t seed = 42;
+    uint64_t iterations = 1000;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if ((arg == "-s" || arg == "--seed") && i + 1 < argc) {
+            seed = std::strtoull(argv[++i], nullptr, 10);
+        } else if ((arg == "-n" || arg == "--iterations") && i + 1 < argc) {
+            iterations = std::strtoull(argv[++i], nullptr, 10);
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [-s seed] [-n iterations]" << std::endl;
+            return 1;
+        }
+    }
+
+    for (const int sig : {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT}) {
+        std::signal(sig, onCrash);
+    }
+    current_seed = seed;
+
+    progress_meter::ProgressMeter progress(iterations, "[wfmash::fuzz] kernels", false);
+    for (uint64_t iteration = 0; iteration < iterations; ++iteration) {
+        current_iteration = iteration;
+        // One generator per iteration so that any iteration can be replayed on its own
+        rng_t rng(seed * 1000003 + iteration);
+        fuzzSketching(rng, seed, iteration, progress);
+        fuzzFilters(rng, seed, iteration, progress);
+        fuzzFormatting(rng, seed, iteration);
+    }
+    progress.finish();
+
+    std::cerr << "[wfmash::fuzz] " << cases << " cases, " << failures << " mismatches (seed " << seed << ", "
+              << iterations << " iterations)" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,787 @@
+/**
+ * @file    reference_kernels.hpp
+ * @brief   frozen copies of the hot mapping and formatting kernels, used as the ground truth
+ *          by fuzz_kernels when a faster implementation replaces one of them
+ * @details These must not be changed when the live kernels are optimized. An optimization is
+ *          accepted when fuzz_kernels finds no input on which its output differs bit-for-bit.
+ *          The hashing and reverse-complement primitives of skch::CommonFunc are shared, they
+ *          define the values being compared rather than how the sketch is computed.
+ *          The sketching kernels are the plain k-mer versions of the baseline tree; spaced seeds
+ *          and syncmers have no reference and are checked for invariants only.
+ */
+
+#ifndef REFERENCE_KERNELS_HPP
+#define REFERENCE_KERNELS_HPP
+
+#include <charconv>
+#include <ostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "map/include/commonFunc.hpp"
+#include "map/include/sequenceIds.hpp"
+#include "map/include/filter.hpp"
+#include "common/wflign/src/dna.hpp"
+
+namespace skch
+{
+  namespace Reference
+  {
+    using namespace CommonFunc;
+
+    /**
+     * @brief   skch::CommonFunc::sketchSequence before spaced seeds and syncmers (k-mers only)
+     */
+    template <typename T>
+      inline void sketchSequence(
+          std::vector<T> &minmerIndex,
+          char* seq,
+          offset_t len,
+          int kmerSize,
+          int alphabetSize,
+          int sketchSize,
+          seqno_t seqCounter)
+    {
+      makeUpperCaseAndValidDNA(seq, len);
+
+      //Compute reverse complement of seq
+      std::unique_ptr<char[]> seqRev(new char[len]);
+      //char* seqRev = new char[len];
+
+      if(alphabetSize == 4) //not protein
+        CommonFunc::reverseComplement(seq, seqRev.get(), len);
+
+      // TODO cleanup
+      ankerl::unordered_dense::map<hash_t, MinmerInfo> sketched_vals;
+      std::vector<hash_t> sketched_heap;
+      sketched_heap.reserve(sketchSize+1);
+
+      // Get distance until last "N"
+      int ambig_kmer_count = 0;
+      for (int i = kmerSize - 1; i >= 0; i--)
+      {
+        if (seq[i] == 'N')
+        {
+            ambig_kmer_count = i+1;
+            break;
+        }
+      }
+
+      for(offset_t i = 0; i < len - kmerSize + 1; i++)
+      {
+
+        if (seq[i+kmerSize-1] == 'N')
+        {
+          ambig_kmer_count = kmerSize;
+        }
+        //Hash kmers
+        hash_t hashFwd = CommonFunc::getHash(seq + i, kmerSize);
+        hash_t hashBwd;
+
+        if(alphabetSize == 4)
+          hashBwd = CommonFunc::getHash(seqRev.get() + len - i - kmerSize, kmerSize);
+        else  //proteins
+          hashBwd = std::numeric_limits<hash_t>::max();   //Pick a dummy high value so that it is ignored later
+
+        //Consider non-symmetric kmers only
+        if(hashBwd != hashFwd && ambig_kmer_count == 0)
+        {
+          //Take minimum value of kmer and its reverse complement
+          hash_t currentKmer = std::min(hashFwd, hashBwd);
+
+          //Check the strand of this minimizer hash value
+          auto currentStrand = hashFwd < hashBwd ? strnd::FWD : strnd::REV;
+
+          if (sketched_heap.size() < sketchSize || currentKmer <= sketched_heap.front())
+          {
+            if (sketched_heap.empty() || sketched_vals.find(currentKmer) == sketched_vals.end())
+            {
+
+              // Add current hash to heap
+              if (sketched_vals.size() < sketchSize || currentKmer < sketched_heap.front())
+              {
+                  sketched_vals[currentKmer] = MinmerInfo{currentKmer, i, i, seqCounter, currentStrand};
+                  sketched_heap.push_back(currentKmer);
+                  std::push_heap(sketched_heap.begin(), sketched_heap.end());
+              }
+
+              // Remove one if too large
+              if (sketched_vals.size() > sketchSize)
+              {
+                  sketched_vals.erase(sketched_heap[0]);
+                  std::pop_heap(sketched_heap.begin(), sketched_heap.end());
+                  sketched_heap.pop_back();
+              }
+            }
+            else
+            {
+              // TODO these sketched values might never be useful, might save memory by deleting
+              // extend the length of the window
+              sketched_vals[currentKmer].wpos_end = i;
+              sketched_vals[currentKmer].strand += currentStrand == strnd::FWD ? 1 : -1;
+            }
+          }
+        }
+        if (ambig_kmer_count > 0)
+        {
+          ambig_kmer_count--;
+        }
+      }
+
+      minmerIndex.resize(sketched_heap.size());
+      for (auto rev_it = minmerIndex.rbegin(); rev_it != minmerIndex.rend(); rev_it++)
+      {
+        *rev_it = (std::move(sketched_vals[sketched_heap.front()]));
+        (*rev_it).strand = (*rev_it).strand > 0 ? strnd::FWD : ((*rev_it).strand == 0 ? strnd::AMBIG : strnd::REV);
+
+        std::pop_heap(sketched_heap.begin(), sketched_heap.end());
+        sketched_heap.pop_back();
+      }
+      return;
+    }
+
+    /**
+     * @brief   skch::CommonFunc::addMinmers before spaced seeds and syncmers (k-mers only)
+     */
+    template <typename T>
+      inline void addMinmers(std::vector<T> &minmerIndex,
+          char* seq, offset_t len,
+          int kmerSize,
+          int windowSize,
+          int alphabetSize,
+          int sketchSize,
+          seqno_t seqCounter,
+          progress_meter::ProgressMeter* progress)
+      {
+        /**
+         * Double-ended queue (saves minimum at front end)
+         * Saves pair of the minimizer and the position of hashed kmer in the sequence
+         * Position of kmer is required to discard kmers that fall out of current window
+         */
+        std::deque< std::tuple<hash_t, strand_t, offset_t> > Q;
+        using MinmerKmerPair_t = std::pair<MinmerInfo, std::deque<KmerInfo>>;
+
+        // Sort by hash, then by position
+        constexpr auto KIHeap_cmp = [](KmerInfo& a, KmerInfo& b)
+          {return std::tie(a.hash, a.pos) > std::tie(b.hash, b.pos);};
+        using windowMap_t = std::map<hash_t, MinmerKmerPair_t>;
+        windowMap_t sortedWindow;
+        std::vector<KmerInfo> heapWindow;
+
+        makeUpperCaseAndValidDNA(seq, len);
+
+        //Compute reverse complement of seq
+        std::unique_ptr<char[]> seqRev(new char[kmerSize]);
+
+        //if(alphabetSize == 4) //not protein
+          //CommonFunc::reverseComplement(seq, seqRev.get(), len);
+
+        // Get distance until last "N"
+        int ambig_kmer_count = 0;
+
+        // usleep(5*1000); // milisecond test
+
+        for(offset_t i = 0; i < len - kmerSize + 1; i++)
+        {
+            progress->increment(1);
+          //The serial number of current sliding window
+          //First valid window appears when i = windowSize - 1
+          offset_t currentWindowId = i + kmerSize - windowSize;
+
+          // Remove expired kmers from heap
+          if (heapWindow.size() > 2*windowSize)
+          {
+            heapWindow.erase(
+                std::remove_if(
+                  heapWindow.begin(),
+                  heapWindow.end(),
+                  [currentWindowId](KmerInfo& ki) { return ki.pos < currentWindowId; }
+                ),
+                heapWindow.end());
+            std::make_heap(heapWindow.begin(), heapWindow.end(), KIHeap_cmp);
+          }
+
+          //Hash kmers
+          hash_t hashFwd = CommonFunc::getHash(seq + i, kmerSize);
+          hash_t hashBwd;
+
+          if(alphabetSize == 4)
+          {
+              CommonFunc::reverseComplement(seq + i, seqRev.get(), kmerSize);
+            hashBwd = CommonFunc::getHash(seqRev.get(), kmerSize);
+          }
+          else  //proteins
+            hashBwd = std::numeric_limits<hash_t>::max();   //Pick a dummy high value so that it is ignored later
+
+          //Take minimum value of kmer and its reverse complement
+          hash_t currentKmer = std::min(hashFwd, hashBwd);
+
+
+          //Check the strand of this minimizer hash value
+          auto currentStrand = hashFwd < hashBwd ? strnd::FWD : strnd::REV;
+
+          //If front minimum is not in the current window, remove it
+          if (!Q.empty() && std::get<2>(Q.front()) <  currentWindowId)
+          {
+            const auto [leaving_hash, leaving_strand, _] = Q.front();
+
+            if (sortedWindow.size() > 0 && leaving_hash <= std::prev(sortedWindow.end())->first)
+            {
+
+              auto& leaving_pair = sortedWindow.find(leaving_hash)->second;
+
+              // Check if this is the only occurence of this hash in the window
+              if (leaving_pair.second.size() == 1)
+              {
+                leaving_pair.first.wpos_end = currentWindowId;
+                minmerIndex.push_back(leaving_pair.first);
+                sortedWindow.erase(leaving_hash);
+              }
+              else
+              {
+                // Not removing hash, but need to adjust the strand
+                if (leaving_pair.first.strand - leaving_strand == 0
+                        || leaving_pair.first.strand == 0)
+                {
+                  leaving_pair.first.wpos_end = currentWindowId;
+                  minmerIndex.push_back(leaving_pair.first);
+                  leaving_pair.first.wpos = currentWindowId;
+                  leaving_pair.first.wpos_end = -1;
+                }
+                leaving_pair.first.strand -= leaving_strand;
+
+                // Remove position from poslist
+                leaving_pair.second.pop_front();
+              }
+            }
+            Q.pop_front();
+          }
+
+          if (seq[i+kmerSize-1] == 'N')
+          {
+            ambig_kmer_count = kmerSize;
+          }
+          //Consider non-symmetric kmers only
+          if(hashBwd != hashFwd && ambig_kmer_count == 0)
+          {
+            // Add current hash to window
+            Q.push_back(std::make_tuple(currentKmer, currentStrand, i));
+
+            // Check if current kmer is already in the map
+            auto kmer_it = sortedWindow.find(currentKmer);
+            if (kmer_it != sortedWindow.end())
+            {
+              auto& current_pair = kmer_it->second;
+              current_pair.second.emplace_back(KmerInfo {currentKmer, seqCounter, i, currentStrand});
+              // Not removing hash, but need to adjust the strand
+              if (current_pair.first.strand + currentStrand == 0
+                      || current_pair.first.strand == 0)
+              {
+                current_pair.first.wpos_end = currentWindowId;
+                minmerIndex.push_back(current_pair.first);
+                current_pair.first.wpos = currentWindowId;
+                current_pair.first.wpos_end = -1;
+              }
+              current_pair.first.strand += currentStrand;
+            }
+            // Going in the heap
+            else
+            {
+              heapWindow.emplace_back(KmerInfo {currentKmer, seqCounter, i, currentStrand});
+              std::push_heap(heapWindow.begin(), heapWindow.end(), KIHeap_cmp);
+            }
+          }
+          if (ambig_kmer_count > 0)
+          {
+            ambig_kmer_count--;
+          }
+
+          // Add kmers from heap to window until full
+          if(currentWindowId >= 0)
+          {
+            // Ignore expired kmers
+            while (!heapWindow.empty() && heapWindow.front().pos < currentWindowId)
+            {
+              std::pop_heap(heapWindow.begin(), heapWindow.end(), KIHeap_cmp);
+              heapWindow.pop_back();
+            }
+
+            //TODO leq?
+            if (sortedWindow.size() > 0 && heapWindow.size() > 0
+                && sortedWindow.size() == sketchSize
+                && (heapWindow.front().hash < std::prev(sortedWindow.end())->first))
+            {
+              auto& largest = std::prev(sortedWindow.end())->second;
+              // Add largest to index
+              largest.first.wpos_end = currentWindowId;
+              minmerIndex.push_back(largest.first);
+
+              // Add kmers back to heap
+              for (KmerInfo& kmer : largest.second)
+              {
+                if (kmer.pos > currentWindowId) {
+                    heapWindow.push_back(kmer);
+                    std::push_heap(heapWindow.begin(), heapWindow.end(), KIHeap_cmp);
+                }
+              }
+
+              // Remove from window
+              sortedWindow.erase(largest.first.hash);
+            }
+
+            while (!heapWindow.empty() && sortedWindow.size() < sketchSize)
+            {
+              if (heapWindow.front().pos < currentWindowId)
+              {
+                std::pop_heap(heapWindow.begin(), heapWindow.end(), KIHeap_cmp);
+                heapWindow.pop_back();
+              }
+              // Add kmers of same value
+              const KmerInfo newKmer = heapWindow.front();
+              sortedWindow[newKmer.hash].first = MinmerInfo{newKmer.hash, currentWindowId, -1, seqCounter, 0};
+              while (!heapWindow.empty() && heapWindow.front().hash == newKmer.hash)
+              {
+                sortedWindow[newKmer.hash].second.push_back(heapWindow.front());
+                sortedWindow[newKmer.hash].first.strand += heapWindow.front().strand;
+                std::pop_heap(heapWindow.begin(), heapWindow.end(), KIHeap_cmp);
+                heapWindow.pop_back();
+              }
+            }
+          }
+        }
+
+        // Add remaining open minmer windows
+        uint64_t rank = 1;
+        auto iter = sortedWindow.begin();
+        while (iter != sortedWindow.end() && rank <= sketchSize)
+        {
+          if (iter->second.first.wpos != -1)
+          {
+            iter->second.first.wpos_end = len - kmerSize + 1;
+            minmerIndex.push_back(iter->second.first);
+          }
+          std::advance(iter, 1);
+          rank += 1;
+        }
+
+        //// TODO Not sure why these are occuring but they are a bug
+        minmerIndex.erase(
+            std::remove_if(
+              minmerIndex.begin(),
+              minmerIndex.end(),
+              [](auto& mi) { return mi.wpos < 0 || mi.wpos_end < 0 || mi.wpos == mi.wpos_end; }),
+            minmerIndex.end());
+
+
+        //// Split up windows longer than windowSize into chunks of windowSize or less
+        std::vector<MinmerInfo> chunkedMIs;
+        std::for_each(minmerIndex.begin(), minmerIndex.end(), [&chunkedMIs, windowSize, kmerSize] (auto& mi) {
+          mi.strand = mi.strand < 0 ? (mi.strand == 0 ? strnd::AMBIG : strnd::REV) : strnd::FWD;
+          if (mi.wpos_end > mi.wpos + windowSize) {
+            for (int chunk = 0; chunk < std::ceil(float(mi.wpos_end - mi.wpos) / float(windowSize)); chunk++) {
+              chunkedMIs.push_back(
+                MinmerInfo{
+                  mi.hash,
+                  mi.wpos + chunk*windowSize,
+                  std::min(mi.wpos + chunk*windowSize + windowSize, mi.wpos_end),
+                  mi.seqId,
+                  mi.strand
+                }
+              );
+            }
+          }
+        });
+        minmerIndex.erase(
+            std::remove_if(
+              minmerIndex.begin(),
+              minmerIndex.end(),
+              [windowSize](auto& mi) { return mi.wpos_end - mi.wpos > windowSize; }),
+            minmerIndex.end());
+        minmerIndex.insert(minmerIndex.end(), chunkedMIs.begin(), chunkedMIs.end());
+
+        // Sort the index based on start position
+        std::sort(minmerIndex.begin(), minmerIndex.end(), [](auto& l, auto& r) {return std::tie(l.wpos, l.wpos_end) < std::tie(r.wpos, r.wpos_end);});
+
+        //// No duplicate windows
+        //// TODO These should not be occurring. They happen rarely, so just deleting them for now
+        //// but need to fix eventually
+        minmerIndex.erase(
+            std::unique(
+              minmerIndex.begin(),
+              minmerIndex.end(),
+              [](auto& l, auto& r) { return (l.wpos == r.wpos) && (l.hash == r.hash); }),
+            minmerIndex.end());
+
+      }
+
+    /**
+     * @namespace skch::Reference::query
+     * @brief     skch::Filter::query plane sweeps as of the fuzz harness introduction
+     */
+    namespace query
+    {
+      //helper functions for executing plane sweep over query sequence
+      struct Helper
+      {
+        MappingResultsVector_t &vec;
+
+        Helper(MappingResultsVector_t &v) : vec(v) {}
+
+        double get_score(const int x) const {
+            if (vec[x].blockLength <= 0 || vec[x].blockNucIdentity <= 0) {
+                return std::numeric_limits<double>::lowest();
+            }
+            return vec[x].blockNucIdentity * std::log(static_cast<double>(vec[x].blockLength));
+        }
+
+        //Greater than comparison by score and begin position
+        //used to define order in BST
+        bool operator ()(const int x, const int y) const {
+
+          assert(x < vec.size());
+          assert(y < vec.size());
+
+          auto x_score = get_score(x);
+          auto y_score = get_score(y);
+
+          return std::tie(x_score, vec[x].queryStartPos, vec[x].refSeqId) > std::tie(y_score, vec[y].queryStartPos, vec[y].refSeqId);
+        }
+
+        //Greater than comparison by score
+        bool greater_score(const int x, const int y) const {
+
+          assert(x < vec.size());
+          assert(y < vec.size());
+
+          auto x_score = get_score(x);
+          auto y_score = get_score(y);
+
+          return x_score > y_score;
+        }
+
+        // compute the overlap of the two mappings
+        double get_overlap(const int x, const int y) const {
+            offset_t overlap_start = std::max(vec[x].queryStartPos, vec[y].queryStartPos);
+            offset_t overlap_end = std::min(vec[x].queryEndPos, vec[y].queryEndPos);
+            offset_t overlap_length = std::max(0, static_cast<int>(overlap_end - overlap_start));
+            offset_t x_length = vec[x].queryEndPos - vec[x].queryStartPos;
+            offset_t y_length = vec[y].queryEndPos - vec[y].queryStartPos;
+            return static_cast<double>(overlap_length) / std::min(x_length, y_length);
+        }
+
+        /*
+         * @brief                         mark the mappings with maximum score as good (on query seq)
+         * @tparam          Type          std::set type to save mappings (sweep line status container)
+         * @param[in/out]   L             container with mappings
+         */
+        template <typename Type>
+        inline void markGood(Type &L, int secondaryToKeep, bool dropRand, double overlapThreshold)
+          {
+            //first segment in the set order
+            auto beg = L.begin();
+
+            // count how many secondary alignments we keep
+            int kept = 0;
+
+            auto it = L.begin();
+            for( ; it != L.end(); it++)
+            {
+                if ((this->greater_score(*beg, *it) || vec[*it].discard == 0) && kept > secondaryToKeep) {
+                    break;
+                }
+
+                vec[*it].discard = 0;
+                ++kept;
+            }
+            auto kit = it;
+
+            // Skip overlap checking if threshold is 1.0 (allow all overlaps)
+            if (overlapThreshold < 1.0) {
+                // Check for overlaps and mark bad if necessary
+                for ( ; it != L.end(); it++) {
+                    if (it == L.begin()) continue;
+                    int idx = *it;
+                    for (auto it2 = L.begin(); it2 != kit; it2++) {
+                        double overlap = get_overlap(idx, *it2);
+                        if (overlap > overlapThreshold) {
+                            vec[idx].overlapped = 1;  // Mark as bad if overlaps more than threshold
+                            vec[idx].discard = 1;
+                            break;
+                        }
+                    }
+                }
+            }
+
+            // check for the case where there are multiple best mappings > secondaryToKeep
+            // which have the same score
+            // we will hash the mapping struct and keep the one with the secondaryToKeep with the lowest hash value
+            if (kept > secondaryToKeep && dropRand) 
+            {
+              // we will use hashes of the mapping structs to break ties
+              // first we'll make a vector of the mappings including the hashes
+              std::vector<std::tuple<double, size_t, MappingResult*>> score_and_hash; // The tuple is (score, hash, pointer to the mapping)
+              for(auto it = L.begin(); it != L.end(); it++)
+              {
+                  if(vec[*it].discard == 0)
+                  {
+                      score_and_hash.emplace_back(get_score(*it), vec[*it].hash(), &vec[*it]);
+                  }
+              }
+              // now we'll sort the vector by score and hash
+              std::sort(score_and_hash.begin(), score_and_hash.end(), std::greater{});
+              // reset kept counter
+              kept = 0;
+              for (auto& x : score_and_hash) {
+                  std::get<2>(x)->discard = 1;
+              }
+              // now we mark the best to keep
+              for (auto& x : score_and_hash) {
+                  if (kept > secondaryToKeep) {
+                      break;
+                  }
+                  std::get<2>(x)->discard = 0;
+                  ++kept;
+              }
+            }
+          }
+      };
+
+     /**
+       * @brief                       filter mappings (best for query sequence)
+       * @details                     evaluate best cover mapping for each base pair
+       * @param[in/out] readMappings  Mappings computed by Mashmap
+       */
+      template <typename VecIn>
+      void liFilterAlgorithm(VecIn &readMappings, int secondaryToKeep, bool dropRand, double overlapThreshold, progress_meter::ProgressMeter& progress)
+        {
+          if(readMappings.size() <= 1)
+            return;
+
+          //Initially mark all mappings as bad
+          //Maintain the order of this vector till end of this function
+          std::for_each(readMappings.begin(), readMappings.end(), [&](MappingResult &e){ 
+            e.discard = 1; 
+            e.overlapped = 0; 
+          });
+
+          //Initialize object of Helper struct
+          Helper obj (readMappings);
+
+          //Plane sweep status
+          //binary search tree of segment ids, ordered by their scores
+          std::set <int, Helper> bst (obj);
+
+          //Event point schedule
+          //vector of triplets <position, event type, segment id>
+          typedef std::tuple<offset_t, int, int> eventRecord_t;
+          std::vector <eventRecord_t>  eventSchedule (2*readMappings.size());
+
+          for(int i = 0; i < readMappings.size(); i++)
+          {
+            eventSchedule.emplace_back (readMappings[i].queryStartPos, event::BEGIN, i);
+            eventSchedule.emplace_back (readMappings[i].queryEndPos, event::END, i);
+          }
+
+          std::sort(eventSchedule.begin(), eventSchedule.end());
+
+          //Execute the plane sweep algorithm
+          for(auto it = eventSchedule.begin(); it!= eventSchedule.end();)
+          {
+            //Find events that correspond to current position
+            auto it2 = std::find_if(it, eventSchedule.end(), [&](const eventRecord_t &e)
+                                    {
+                                      return std::get<0>(e) != std::get<0>(*it);
+                                    });
+
+            //update sweep line status by adding/removing segments
+            std::for_each(it, it2, [&](const eventRecord_t &e)
+                                    {
+                                      int idx = std::get<2>(e);
+                                      if (std::get<1>(e) == event::BEGIN)
+                                        bst.insert (idx);
+                                      else
+                                        bst.erase (idx);
+                                    });
+
+            //mark mappings as good
+            obj.markGood(bst, secondaryToKeep, dropRand, overlapThreshold);
+
+            it = it2;
+          }
+
+          //Remove bad mappings
+          readMappings.erase(
+              std::remove_if(readMappings.begin(), readMappings.end(), [&](MappingResult &e){ 
+                return e.discard == 1 || e.overlapped == 1;
+              }),
+              readMappings.end());
+        }
+
+      /**
+       * @brief                       filter mappings (best for query sequence)
+       * @details                     evaluate best N unmerged mappings for each position, assumes non-overlapping mappings in query
+       * @param[in/out] readMappings  Mappings computed by Mashmap
+       */
+      template <typename VecIn>
+      void indexedFilterAlgorithm(VecIn &readMappings, int secondaryToKeep)
+        {
+          if(readMappings.size() <= 1)
+            return;
+
+          //Initially mark all mappings as bad
+          //Maintain the order of this vector till end of this function
+          std::for_each(readMappings.begin(), readMappings.end(), [&](MappingResult &e){ e.discard = 1; });
+
+          //Initialize object of Helper struct
+          Helper obj (readMappings);
+
+          //Event point schedule
+          //vector of triplets <position, event type, segment id>
+          typedef std::tuple<offset_t, double, int, int> eventRecord_t;
+          std::vector <eventRecord_t>  eventSchedule (2*readMappings.size());
+
+          for(int i = 0; i < readMappings.size(); i++) {
+              eventSchedule.emplace_back (readMappings[i].queryStartPos, obj.get_score(i), event::BEGIN, i);
+              eventSchedule.emplace_back (readMappings[i].queryEndPos, 0, event::END, i); // end should not be preferred
+          }
+
+          std::sort(eventSchedule.begin(), eventSchedule.end());
+
+          //Execute the plane sweep algorithm
+          for(auto it = eventSchedule.begin(); it!= eventSchedule.end();)
+          {
+            //Find events that correspond to current position
+            auto it2 = std::find_if(it, eventSchedule.end(), [&](const eventRecord_t &e)
+                                    {
+                                      return std::get<0>(e) != std::get<0>(*it);
+                                    });
+
+            //mark best secondaryToKeep+1 mappings as good
+            int kept = 0;
+            std::for_each(it, it2, [&](const eventRecord_t &e)
+                                    {
+                                        if (std::get<2>(e) == event::BEGIN && kept <= secondaryToKeep) {
+                                            obj.vec[std::get<3>(e)].discard = 0;
+                                            ++kept;
+                                        }
+                                    });
+
+            it = it2;
+          }
+
+          //Remove bad mappings
+          readMappings.erase(
+              std::remove_if(readMappings.begin(), readMappings.end(), [&](MappingResult &e){ return e.discard == 1; }),
+              readMappings.end());
+        }
+    } //End of query namespace
+  } //End of Reference namespace
+} //End of skch namespace
+
+namespace wflign {
+namespace wavefront {
+namespace reference {
+
+// MD tag writer streaming one character at a time, as used before alignment_formatter.hpp
+inline void write_tag_and_md_string(
+    std::ostream &out,
+    const char *cigar_ops,
+    const int cigar_start,
+    const int cigar_end,
+    const int target_start,
+    const char *target) {
+    out << "MD:Z:";
+
+    char last_op = '\0';
+    int last_len = 0;
+    int t_off = target_start, l_MD = 0;
+    int l = cigar_start;
+    int x = cigar_start;
+
+    while (x < cigar_end) {
+        // Parse the length digits
+        while (x < cigar_end && isdigit(cigar_ops[x]))
+            ++x;
+
+        char op = cigar_ops[x];
+        int len = 0;
+
+        // Convert the substring [l, x) to an integer
+        std::from_chars(cigar_ops + l, cigar_ops + x, len);
+        l = ++x;
+
+        // Process the previous operation if there was one
+        if (last_len) {
+            if (last_op == op) {
+                len += last_len;
+            } else {
+                // Handle the previous operation based on its type
+                if (last_op == '=' || last_op == 'M') {
+                    l_MD += last_len;
+                    t_off += last_len;
+                } else if (last_op == 'X') {
+                    for (uint64_t ii = 0; ii < last_len; ++ii) {
+                        int64_t idx = t_off + ii ;
+                        out << l_MD << target[idx];
+                        l_MD = 0;
+                    }
+                    t_off += last_len;
+                } else if (last_op == 'D') {
+                    out << l_MD << "^";
+                    for (uint64_t ii = 0; ii < last_len; ++ii) {
+                        int64_t idx = t_off + ii;
+                        out << target[idx];
+                    }
+                    l_MD = 0;
+                    t_off += last_len;
+                }
+            }
+        }
+        last_op = op;
+        last_len = len;
+    }
+
+    // Process the last operation
+    if (last_len) {
+        if (last_op == '=' || last_op == 'M') {
+            out << last_len + l_MD;
+        } else if (last_op == 'X') {
+            for (uint64_t ii = 0; ii < last_len; ++ii) {
+                int64_t idx = t_off + ii;
+                out << l_MD << target[idx];
+                l_MD = 0;
+            }
+            out << "0";
+        } else if (last_op == 'I') {
+            out << l_MD;
+        } else if (last_op == 'D') {
+            out << l_MD << "^";
+            for (uint64_t ii = 0; ii < last_len; ++ii) {
+                int64_t idx = t_off + ii;
+                out << target[idx];
+            }
+            out << "0";
+        }
+    }
+}
+
+// SAM SEQ field collected in a stringstream and reverse-complemented as a whole
+inline void write_seq(std::ostream &out, const char* seq, const uint64_t len, const bool rev_comp) {
+    std::stringstream ss;
+    for (uint64_t p = 0; p < len; ++p) {
+        ss << seq[p];
+    }
+    if (rev_comp) {
+        out << reverse_complement(ss.str());
+    } else {
+        out << ss.str();
+    }
+}
+
+} // namespace reference
+} // namespace wavefront
+} // namespace wflign
+
+#endif
@@ -0,0 +1,164 @@
+/**
+ * @file    stress_sorted_output.cpp
+ * @brief   concurrency and merge stress test for the target-sorted output
+ * @details Several threads add records to a TargetSortedWriter with a small memory limit and a
+ *          small merge fan-in, so that many runs are spilled while others are added and the
+ *          runs are merged in several passes. The merged stream and the per-target shards must
+ *          hold exactly the records that were added, sorted by target rank and start. Meant to
+ *          be run under ASan and TSan as well.
+ *
+ *          Usage: stress_sorted_output [-d dir] [-t threads] [-n records per thread]
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/sorted_output.hpp"
+
+namespace {
+
+struct key_t {
+    std::string target;
+    uint64_t start;
+};
+
+key_t keyOf(const std::string& line) {
+    std::stringstream ss(line);
+    std::string f[9];
+    for (auto& field : f) std::getline(ss, field, '\t');
+    return key_t{f[5], std::stoull(f[7])};
+}
+
+// Records of text in target order, then start order, with the same lines as expected
+bool sortedAndComplete(const std::string& text, std::vector<std::string> expected,
+                       const std::vector<std::string>& order, const char* what) {
+    std::vector<std::string> got;
+    std::stringstream in(text);
+    std::string line;
+    while (std::getline(in, line)) got.push_back(line);
+
+    auto rank = [&](const std::string& target) {
+        for (size_t i = 0; i < order.size(); ++i) {
+            if (order[i] == target) return i;
+        }
+        return order.size();
+    };
+    for (size_t i = 1; i < got.size(); ++i) {
+        const key_t a = keyOf(got[i - 1]), b = keyOf(got[i]);
+        if (rank(a.target) > rank(b.target) || (a.target == b.target && a.start > b.start)) {
+            std::cerr << "[wfmash::sorted_output] " << what << " out of order at record " << i << std::endl;
+            return false;
+        }
+    }
+    std::sort(got.begin(), got.end());
+    std::sort(expected.begin(), expected.end());
+    if (got != expected) {
+        std::cerr << "[wfmash::sorted_output] " << what << " has " << got.size() << " records, expected "
+                  << expected.size() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string dir = ".";
+    int threads = 8;
+    int records = 2000;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "-d" && i + 1 < argc) {
+            dir = argv[++i];
+        } else if (arg == "-t" && i + 1 < argc) {
+            threads = std::atoi(argv[++i]);
+        } else if (arg == "-n" && i + 1 < argc) {
+            records = std::atoi(argv[++i]);
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [-d dir] [-t threads] [-n records per thread]" << std::endl;
+            return 1;
+        }
+    }
+
+    // Targets missing from the given order (chrZ*) follow it in order of appearance
+    const std::vector<std::string> names = {"chrA", "chrB", "chrC"};
+    sorted_output::TargetSortedWriter writer(sorted_output::format_t::PAF, names, 20000,
+                                             dir + "/stress-sort-", 4);
+    std::vector<std::string> added;
+    std::mutex added_mutex;
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            std::mt19937 rng(t);
+            std::string batch;
+            for (int i = 0; i < records; ++i) {
+                const std::string target = rng() % 5 == 0 ? "chrZ" + std::to_string(rng() % 2) : names[rng() % 3];
+                const uint64_t start = rng() % 100000;
+                const std::string line = "q" + std::to_string(t) + "_" + std::to_string(i) + "\t1000\t0\t100\t+\t"
+                    + target + "\t200000\t" + std::to_string(start) + "\t" + std::to_string(start + 100) + "\t90\t100\t60";
+                {
+                    std::lock_guard<std::mutex> lock(added_mutex);
+                    added.push_back(line);
+                }
+                batch += line + "\n";
+                if (rng() % 3 == 0) {
+                    writer.add(batch);
+                    batch.clear();
+                }
+            }
+            writer.add(batch);
+        });
+    }
+    for (auto& w : workers) w.join();
+    const size_t spilled = writer.run_count();
+
+    std::stringstream out, index;
+    writer.write(out, "", &index);
+
+    // Unknown targets are ranked when first added, which depends on the thread schedule, so
+    // the order is taken from the output; the given targets must lead it, in their order
+    std::vector<std::string> order;
+    {
+        std::stringstream in(out.str());
+        std::string line;
+        while (std::getline(in, line)) {
+            const std::string target = keyOf(line).target;
+            if (std::find(order.begin(), order.end(), target) == order.end()) order.push_back(target);
+        }
+    }
+    bool ok = order.size() >= names.size() && std::equal(names.begin(), names.end(), order.begin());
+    if (!ok) {
+        std::cerr << "[wfmash::sorted_output] merged output does not start with the given targets" << std::endl;
+    }
+    ok &= sortedAndComplete(out.str(), added, order, "merged output");
+    if (index.str().find("T\t-\tchrA\t") == std::string::npos) {
+        std::cerr << "[wfmash::sorted_output] index has no entry for chrA" << std::endl;
+        ok = false;
+    }
+
+    const std::string prefix = dir + "/stress-shard";
+    writer.write_shards(prefix, "", 4, nullptr);
+    for (const auto& target : order) {
+        std::ifstream shard(prefix + "." + target + ".paf");
+        std::stringstream text;
+        text << shard.rdbuf();
+        std::vector<std::string> expected;
+        for (const auto& line : added) {
+            if (keyOf(line).target == target) expected.push_back(line);
+        }
+        ok &= sortedAndComplete(text.str(), expected, {target}, ("shard " + target).c_str());
+        std::remove((prefix + "." + target + ".paf").c_str());
+    }
+
+    std::cerr << "[wfmash::sorted_output] " << added.size() << " records, " << spilled << " runs: "
+              << (ok ? "ok" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}